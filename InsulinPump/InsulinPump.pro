@@ -7,15 +7,72 @@ QMAKE_CXXFLAGS += -I/Library/Developer/CommandLineTools/SDKs/MacOSX15.2.sdk/usr/
 
 CONFIG += c++11
 
+# The batch kernels (PatientCohort) are written to auto-vectorize. GCC only
+# if-converts their selects at -O3 without FP trap assumptions.
+QMAKE_CXXFLAGS_RELEASE -= -O2
+QMAKE_CXXFLAGS_RELEASE += -O3 -fno-trapping-math
+# They must round exactly like the scalar step, so no fused multiply-adds in
+# the AVX-512 clones (PUMP_TARGET_CLONES) or with -march=native
+QMAKE_CXXFLAGS += -ffp-contract=off
+
+# Hot path timers and counters (profiler.h), off unless built with
+# qmake CONFIG+=pump_profile; the report is printed at exit
+pump_profile: DEFINES += PUMP_PROFILE
+
 SOURCES += \
+    cgmtrace.cpp \
+    checkpoint.cpp \
+    cohortrunner.cpp \
+    commandqueue.cpp \
+    eventlog.cpp \
+    glucosering.cpp \
+    historystore.cpp \
     insulinpump.cpp \
+    logmodel.cpp \
     main.cpp \
     mainwindow.cpp \
-    tests.cpp
+    patientcohort.cpp \
+    philoxrng.cpp \
+    profiler.cpp \
+    profilesweep.cpp \
+    pumpengine.cpp \
+    scenario.cpp \
+    simeventqueue.cpp \
+    simulationclock.cpp \
+    snapshotmailbox.cpp \
+    telemetryfile.cpp \
+    tests.cpp \
+    tracerecorder.cpp \
+    whatifrunner.cpp \
+    workstealingpool.cpp
 
 HEADERS += \
+    cgmtrace.h \
+    checkpoint.h \
+    cohortrunner.h \
+    commandqueue.h \
+    controliq.h \
+    eventlog.h \
+    glucosemodel.h \
+    glucosering.h \
+    historystore.h \
     insulinpump.h \
-    mainwindow.h
+    logmodel.h \
+    mainwindow.h \
+    odeintegrator.h \
+    patientcohort.h \
+    philoxrng.h \
+    profiler.h \
+    profilesweep.h \
+    pumpengine.h \
+    scenario.h \
+    simeventqueue.h \
+    simulationclock.h \
+    snapshotmailbox.h \
+    telemetryfile.h \
+    tracerecorder.h \
+    whatifrunner.h \
+    workstealingpool.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,406 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "insulinpump.h"
+#include "pumpengine.h"
+#include "patientcohort.h"
+#include "cohortrunner.h"
+
+// -------------------- Allocation Counter --------------------
+// Every heap allocation in the process is counted. With glibc the malloc
+// family itself is wrapped, which also catches Qt's containers (they don't
+// go through operator new); elsewhere only operator new is seen.
+static std::atomic<quint64> allocations(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+#else
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+#endif
+
+// -------------------- Signal Counter --------------------
+// One counting connection per signal of the Device and its control system.
+// A connected functor costs a call per emit, about what the GUI's own slots
+// cost to reach.
+static quint64 emittedSignals = 0;
+
+static void countSignals(Device &device) {
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    auto count = [] { emittedSignals++; };
+    QObject::connect(&device, &Device::batteryLevelChanged, count);
+    QObject::connect(&device, &Device::insulinInjected, count);
+    QObject::connect(&device, &Device::devicePoweredOff, count);
+    QObject::connect(ics, &InsulinControlSystem::insulinDelivered, count);
+    QObject::connect(ics, &InsulinControlSystem::glucoseChanged, count);
+    QObject::connect(ics, &InsulinControlSystem::cartChanged, count);
+    QObject::connect(ics, &InsulinControlSystem::IOBChanged, count);
+    QObject::connect(ics, &InsulinControlSystem::addPointy, count);
+}
+
+// -------------------- Benchmark Runner --------------------
+// A benchmark is a number of batches of steps. reset(batch) runs untimed
+// before each batch, step(i) is the timed unit; 'scale' is how many steps
+// one call stands for (patient minutes for a cohort run). Each benchmark is
+// repeated after an untimed warm-up run and the median reported, with the
+// best run next to it. A NoAllocations benchmark is the steady state step
+// path: any heap allocation in its timed steps fails the run. A required
+// speedup compares the best runs of two benchmarks and fails the run if the
+// faster one falls short.
+struct BenchmarkResult {
+    QString name;
+    qint64 steps = 0;               // per repetition
+    double nsPerStep = 0.0;         // median over the repetitions
+    double bestNsPerStep = 0.0;
+    double allocationsPerStep = 0.0;
+    double signalsPerStep = 0.0;
+    bool allocationFree = false;    // required to allocate nothing
+
+    bool failed() const { return allocationFree && allocationsPerStep > 0.0; }
+};
+
+struct SpeedupRequirement {
+    QString name;      // the fast path
+    QString baseline;  // the same work done the slow way
+    double factor = 1.0;
+};
+
+class BenchmarkRunner {
+public:
+    enum Allocations { MayAllocate, NoAllocations };
+
+    BenchmarkRunner(int repetitions, const QString &filter) : repetitions(qMax(1, repetitions)), filter(filter) {}
+
+    template <typename Reset, typename Step>
+    void run(const QString &name, int batches, int batchSize, Reset reset, Step step,
+             Allocations allowed = MayAllocate, qint64 scale = 1);
+
+    // Per step of each, so the two may split the work differently; skipped
+    // when the filter left either one out
+    void requireSpeedup(const QString &name, const QString &baseline, double factor);
+
+    void print(QTextStream &out) const;
+    int printFailures(QTextStream &out) const; // allocated when they must not, or too slow
+    bool writeJson(const QString &fileName) const;
+
+private:
+    const BenchmarkResult *find(const QString &name) const;
+    double speedup(const SpeedupRequirement &requirement) const; // 0 if either didn't run
+
+    int repetitions;
+    QString filter;
+    QVector<BenchmarkResult> results;
+    QVector<SpeedupRequirement> speedups;
+};
+
+template <typename Reset, typename Step>
+void BenchmarkRunner::run(const QString &name, int batches, int batchSize, Reset reset, Step step,
+                          Allocations allowed, qint64 scale) {
+    if (!filter.isEmpty() && !name.contains(filter)) return;
+
+    BenchmarkResult result;
+    result.name = name;
+    result.steps = qint64(batches) * batchSize * scale;
+    result.allocationFree = allowed == NoAllocations;
+    QVector<double> nsPerStep;
+    QElapsedTimer timer;
+    // the warm-up (-1) takes first-use allocations (per-thread profiler and
+    // trace buffers, lazily sized containers) out of the steady state
+    for (int r = -1; r < repetitions; r++) {
+        qint64 ns = 0;
+        quint64 allocated = 0, emitted = 0;
+        for (int b = 0; b < batches; b++) {
+            reset(b);
+            const quint64 allocatedBefore = allocations.load(std::memory_order_relaxed);
+            const quint64 emittedBefore = emittedSignals;
+            timer.start();
+            for (int i = 0; i < batchSize; i++) step(i);
+            ns += timer.nsecsElapsed();
+            allocated += allocations.load(std::memory_order_relaxed) - allocatedBefore;
+            emitted += emittedSignals - emittedBefore;
+        }
+        if (r < 0) continue;
+        nsPerStep.append(double(ns) / result.steps);
+        // the same work every repetition, the last one stands for all
+        result.allocationsPerStep = double(allocated) / result.steps;
+        result.signalsPerStep = double(emitted) / result.steps;
+    }
+    std::sort(nsPerStep.begin(), nsPerStep.end());
+    result.nsPerStep = nsPerStep[nsPerStep.size() / 2];
+    result.bestNsPerStep = nsPerStep.first();
+    results.append(result);
+}
+
+void BenchmarkRunner::requireSpeedup(const QString &name, const QString &baseline, double factor) {
+    SpeedupRequirement requirement;
+    requirement.name = name;
+    requirement.baseline = baseline;
+    requirement.factor = factor;
+    speedups.append(requirement);
+}
+
+const BenchmarkResult *BenchmarkRunner::find(const QString &name) const {
+    for (const BenchmarkResult &r : results) {
+        if (r.name == name) return &r;
+    }
+    return nullptr;
+}
+
+// best against best, so a busy machine slowing one run doesn't decide it
+double BenchmarkRunner::speedup(const SpeedupRequirement &requirement) const {
+    const BenchmarkResult *fast = find(requirement.name), *slow = find(requirement.baseline);
+    if (!fast || !slow || fast->bestNsPerStep <= 0.0) return 0.0;
+    return slow->bestNsPerStep / fast->bestNsPerStep;
+}
+
+void BenchmarkRunner::print(QTextStream &out) const {
+    out << "benchmark                        steps      ns/step     best   allocs/step  signals/step\n";
+    for (const BenchmarkResult &r : results) {
+        out << QString("%1 %2 %3 %4 %5 %6%7\n")
+                   .arg(r.name, -28)
+                   .arg(r.steps, 9)
+                   .arg(r.nsPerStep, 12, 'f', 1)
+                   .arg(r.bestNsPerStep, 8, 'f', 1)
+                   .arg(r.allocationsPerStep, 13, 'f', 3)
+                   .arg(r.signalsPerStep, 13, 'f', 3)
+                   .arg(r.failed() ? "  ALLOCATES" : "");
+    }
+    for (const SpeedupRequirement &s : speedups) {
+        const double x = speedup(s);
+        if (x <= 0.0) continue;
+        out << QString("%1 %2x %3 (at least %4x)%5\n")
+                   .arg(s.name, -28)
+                   .arg(x, 0, 'f', 2)
+                   .arg(s.baseline)
+                   .arg(s.factor, 0, 'f', 1)
+                   .arg(x < s.factor ? "  TOO SLOW" : "");
+    }
+    out.flush();
+}
+
+int BenchmarkRunner::printFailures(QTextStream &out) const {
+    int failures = 0;
+    for (const BenchmarkResult &r : results) {
+        if (!r.failed()) continue;
+        out << QString("FAIL: %1 allocates %2 times per step, its steady state must not allocate\n")
+                   .arg(r.name)
+                   .arg(r.allocationsPerStep, 0, 'f', 4);
+        failures++;
+    }
+    for (const SpeedupRequirement &s : speedups) {
+        const double x = speedup(s);
+        if (x <= 0.0 || x >= s.factor) continue;
+        out << QString("FAIL: %1 is only %2x as fast as %3, it must be at least %4x\n")
+                   .arg(s.name)
+                   .arg(x, 0, 'f', 2)
+                   .arg(s.baseline)
+                   .arg(s.factor, 0, 'f', 1);
+        failures++;
+    }
+    out.flush();
+    return failures;
+}
+
+// One object per benchmark, flat so scripts can diff runs
+bool BenchmarkRunner::writeJson(const QString &fileName) const {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    QTextStream out(&file);
+    out << "{\n  \"repetitions\": " << repetitions << ",\n  \"benchmarks\": [\n";
+    for (int i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        out << QString("    {\"name\": \"%1\", \"steps\": %2, \"ns_per_step\": %3, \"best_ns_per_step\": %4, "
+                       "\"allocations_per_step\": %5, \"signals_per_step\": %6, \"allocation_free\": %7}")
+                   .arg(r.name)
+                   .arg(r.steps)
+                   .arg(r.nsPerStep, 0, 'f', 3)
+                   .arg(r.bestNsPerStep, 0, 'f', 3)
+                   .arg(r.allocationsPerStep, 0, 'f', 4)
+                   .arg(r.signalsPerStep, 0, 'f', 4)
+                   .arg(r.allocationFree ? "true" : "false")
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
+
+// -------------------- Benchmarks --------------------
+static const int Day = 24 * 60;
+
+// The pump as the GUI sets it up, seeded so every run steps the same minutes
+static void setupDevice(Device &device) {
+    device.setNoiseSeed(1);
+    device.setupDevice();
+    device.applyProfile(1.0, 1.8, 10, 5.5);
+    device.startDevice();
+    countSignals(device);
+}
+
+// Calls on the control system the GUI and the device make
+static void microBenchmarks(BenchmarkRunner &runner) {
+    Device device;
+    setupDevice(device);
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    PumpCheckpoint start;
+    device.checkpoint(start);
+
+    int t = 0;
+    runner.run("updateInsulin", 20, Day,
+               [&](int) { device.restore(start); t = start.timeStep; },
+               [&](int) { ics->setTimeStep(++t); ics->updateInsulin(); }, BenchmarkRunner::NoAllocations);
+    runner.run("calculateBolus", 40, 50,
+               [&](int) { device.restore(start); },
+               [&](int) { ics->calculateBolus(30.0, 7.0, 0, 0); });
+    runner.run("calculateBolus.extended", 40, 50,
+               [&](int) { device.restore(start); },
+               [&](int) { ics->calculateBolus(30.0, 7.0, 2, 0); });
+    runner.run("simulateBolus", 40, 200,
+               [&](int) { device.restore(start); },
+               [&](int) { ics->simulateBolus(1.0, 0.2); });
+    runner.run("depleteCartridge", 40, 500,
+               [&](int) { device.restore(start); },
+               [&](int) { ics->depleteCartridge(0.5); });
+}
+
+// Whole runs: the GUI device for a day and a month (charged every four
+// hours, untimed, since a full battery lasts five), then a day of it with
+// boluses and scheduled events, the headless engine for a month and a
+// cohort of 10,000 patients for a day on every core
+static void macroBenchmarks(BenchmarkRunner &runner) {
+    Device device;
+    setupDevice(device);
+    PumpCheckpoint start;
+    device.checkpoint(start);
+    const int charge = 240;
+    auto rechargeFrom = [&](int batch) {
+        if (batch == 0) device.restore(start);
+        device.chargeBattery();
+    };
+    auto step = [&](int) { device.runDevice(); };
+    runner.run("device.1day", Day / charge, charge, rechargeFrom, step, BenchmarkRunner::NoAllocations);
+    runner.run("device.30day", 30 * Day / charge, charge, rechargeFrom, step, BenchmarkRunner::NoAllocations);
+
+    // every four hours a meal with a 3 hour extended bolus and a scheduled
+    // pause, resume and profile switch (untimed), and at the end of each
+    // four hours a timed in-memory checkpoint as --checkpoint takes; writing
+    // it to disk is I/O and stays out, like mapping telemetry blocks
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    PumpCheckpoint taken;
+    runner.run("device.1day.events", Day / charge, charge, [&](int batch) {
+        rechargeFrom(batch);
+        const int now = ics->getState().timeStep;
+        ics->calculateBolus(60.0, 8.0, 3, 0);
+        ics->scheduleEvent(SimEvent::pauseInsulin(now + 100));
+        ics->scheduleEvent(SimEvent::resumeInsulin(now + 130));
+        ics->scheduleEvent(SimEvent::profileSwitch(now + 200, 1.1, 1.8, 10, 5.5));
+    }, [&](int i) {
+        device.runDevice();
+        if (i == charge - 1) device.checkpoint(taken);
+    }, BenchmarkRunner::NoAllocations);
+
+    PumpEngine fresh(1);
+    fresh.setupDevice();
+    fresh.setBatteryDrain(false);
+    fresh.applyProfile(1.0, 1.8, 10, 5.5);
+    fresh.startDevice();
+    PumpEngine engine;
+    runner.run("engine.30day", 1, 30 * Day,
+               [&](int) { engine = fresh; },
+               [&](int) { engine.step(); }, BenchmarkRunner::NoAllocations);
+
+    // a week with insulin paused, stepped and fast-forwarded; the skip still
+    // draws each minute's noise, which keeps it to about 3x
+    PumpEngine paused(fresh);
+    paused.setState(PumpState::Pause);
+    runner.run("engine.pausedWeek.stepped", 1, 7 * Day,
+               [&](int) { engine = paused; },
+               [&](int) { engine.step(); }, BenchmarkRunner::NoAllocations);
+    runner.run("engine.pausedWeek", 1, 1,
+               [&](int) { engine = paused; },
+               [&](int) { engine.run(7 * Day); }, BenchmarkRunner::NoAllocations, 7 * Day);
+    runner.requireSpeedup("engine.pausedWeek", "engine.pausedWeek.stepped", 1.5);
+
+    const int patients = 10000;
+    PatientCohort initial(patients, 1);
+    for (int i = 0; i < patients; i++) {
+        initial.applyProfile(i, 0.8 + (i % 5) * 0.1, 1.8, 10, 5.0 + (i % 3) * 0.5);
+    }
+    PatientCohort cohort;
+    CohortRunner cohortRunner;
+    runner.run("cohort.10k.1day", 1, 1,
+               [&](int) { cohort = initial; },
+               [&](int) { cohortRunner.run(cohort, Day); },
+               BenchmarkRunner::MayAllocate, qint64(patients) * Day);
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption outputOption("output", "Write the results as JSON to <file>.", "file");
+    parser.addOption(outputOption);
+    QCommandLineOption repetitionsOption("repetitions", "Runs of each benchmark, the median is reported (default 5).", "count", "5");
+    parser.addOption(repetitionsOption);
+    QCommandLineOption filterOption("filter", "Only run benchmarks whose name contains <text>.", "text");
+    parser.addOption(filterOption);
+    parser.process(app);
+
+    BenchmarkRunner runner(parser.value(repetitionsOption).toInt(), parser.value(filterOption));
+    microBenchmarks(runner);
+    macroBenchmarks(runner);
+
+    QTextStream out(stdout);
+    runner.print(out);
+#ifdef PUMP_PROFILE
+    out << "\n" << Profiler::report();
+    out.flush();
+#endif
+    if (parser.isSet(outputOption) && !runner.writeJson(parser.value(outputOption))) {
+        out << "cannot write " << parser.value(outputOption) << "\n";
+        return 1;
+    }
+    return runner.printFailures(out) > 0 ? 1 : 0;
+}
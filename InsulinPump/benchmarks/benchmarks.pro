@@ -0,0 +1,64 @@
+# Throughput benchmarks for the controller, separate from the GUI and the
+# unit tests so they can run headless (see benchmarks.cpp for the options)
+QT += core
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+TARGET = benchmarks
+
+# Same optimization as the application, numbers are only comparable that way
+QMAKE_CXXFLAGS_RELEASE -= -O2
+QMAKE_CXXFLAGS_RELEASE += -O3 -fno-trapping-math
+QMAKE_CXXFLAGS += -ffp-contract=off
+
+# With the hot path timers in (see profiler.h) the per-stage report follows the results
+pump_profile: DEFINES += PUMP_PROFILE
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    benchmarks.cpp \
+    ../cgmtrace.cpp \
+    ../checkpoint.cpp \
+    ../cohortrunner.cpp \
+    ../commandqueue.cpp \
+    ../eventlog.cpp \
+    ../glucosering.cpp \
+    ../historystore.cpp \
+    ../insulinpump.cpp \
+    ../patientcohort.cpp \
+    ../philoxrng.cpp \
+    ../profiler.cpp \
+    ../pumpengine.cpp \
+    ../scenario.cpp \
+    ../simeventqueue.cpp \
+    ../simulationclock.cpp \
+    ../snapshotmailbox.cpp \
+    ../telemetryfile.cpp \
+    ../tracerecorder.cpp \
+    ../workstealingpool.cpp
+
+HEADERS += \
+    ../cgmtrace.h \
+    ../checkpoint.h \
+    ../cohortrunner.h \
+    ../commandqueue.h \
+    ../controliq.h \
+    ../eventlog.h \
+    ../glucosemodel.h \
+    ../glucosering.h \
+    ../historystore.h \
+    ../insulinpump.h \
+    ../odeintegrator.h \
+    ../patientcohort.h \
+    ../philoxrng.h \
+    ../profiler.h \
+    ../pumpengine.h \
+    ../scenario.h \
+    ../simeventqueue.h \
+    ../simulationclock.h \
+    ../snapshotmailbox.h \
+    ../telemetryfile.h \
+    ../tracerecorder.h \
+    ../workstealingpool.h
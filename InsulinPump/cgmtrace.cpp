@@ -0,0 +1,221 @@
+#include "cgmtrace.h"
+#include <QSaveFile>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+// -------------------- CGM Trace --------------------
+const int CgmTrace::MaxGapMinutes;
+const quint32 CgmTrace::Version;
+
+static const char CgmMagic[8] = { 'P', 'U', 'M', 'P', 'C', 'G', 'M', '1' };
+static const double MgdlPerMmol = 18.016;
+
+static_assert(sizeof(CgmSample) == 8, "CgmSample is the binary record layout");
+
+CgmTrace::CgmTrace() : mapping(nullptr), samples(nullptr), count(0) {}
+
+CgmTrace::~CgmTrace() {
+    close();
+}
+
+bool CgmTrace::open(const QString &fileName) {
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return fail("cannot open " + fileName);
+    const qint64 length = file.size();
+    if (length == 0) return fail(fileName + " is empty");
+    mapping = file.map(0, length);
+    if (!mapping) return fail("cannot map " + fileName);
+
+    if (length >= qint64(sizeof(Header)) && memcmp(mapping, CgmMagic, sizeof(CgmMagic)) == 0) {
+        const Header *header = reinterpret_cast<const Header *>(mapping);
+        if (header->version != Version || header->sampleBytes != sizeof(CgmSample)) {
+            return fail(fileName + " is a CGM file of another version");
+        }
+        if (header->count > quint64(length - qint64(sizeof(Header))) / sizeof(CgmSample)) {
+            return fail(fileName + " is truncated");
+        }
+        const CgmSample *mapped = reinterpret_cast<const CgmSample *>(mapping + sizeof(Header));
+        const qint64 mappedCount = qint64(header->count);
+        if (mappedCount == 0) return fail(fileName + " has no readings");
+        // the same rule the CSV parser applies line by line; glucoseAt relies on it
+        for (qint64 i = 1; i < mappedCount; i++) {
+            if (mapped[i].minute <= mapped[i - 1].minute) {
+                return fail(QString("%1: reading %2: minutes must increase").arg(fileName).arg(i));
+            }
+        }
+        samples = mapped;
+        count = mappedCount;
+        return true;
+    }
+
+    if (!parseCsv(reinterpret_cast<const char *>(mapping), length)) return false;
+    // the samples are copied out, the text isn't needed any more
+    file.unmap(mapping);
+    mapping = nullptr;
+    file.close();
+    return true;
+}
+
+// Hand-rolled number parsing on the mapped text: no line copies, no locale,
+// and memchr (vectorized in the C library) to find the line ends
+bool CgmTrace::parseCsv(const char *data, qint64 length) {
+    static const double tenths[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001 };
+    const char *end = data + length;
+    parsed.clear();
+    parsed.reserve(int(qMin<qint64>(length / 8, 1 << 26)));
+
+    qint64 line = 0;
+    for (const char *p = data; p < end; ) {
+        const char *lineEnd = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+        if (!lineEnd) lineEnd = end;
+        line++;
+
+        while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+        if (p == lineEnd || *p == '\r' || *p == '#') {
+            p = lineEnd + 1;
+            continue;
+        }
+        if (*p < '0' || *p > '9') {
+            if (line == 1) { // header
+                p = lineEnd + 1;
+                continue;
+            }
+            return fail(QString("line %1: expected a minute").arg(line));
+        }
+
+        qint64 minute = 0;
+        while (p < lineEnd && *p >= '0' && *p <= '9') minute = minute * 10 + (*p++ - '0');
+        while (p < lineEnd && (*p == ',' || *p == ';' || *p == '\t' || *p == ' ')) p++;
+
+        qint64 whole = 0;
+        int digits = 0;
+        while (p < lineEnd && *p >= '0' && *p <= '9') {
+            whole = whole * 10 + (*p++ - '0');
+            digits++;
+        }
+        qint64 fraction = 0;
+        int fractionDigits = 0;
+        if (p < lineEnd && *p == '.') {
+            p++;
+            while (p < lineEnd && *p >= '0' && *p <= '9') {
+                if (fractionDigits < 6) {
+                    fraction = fraction * 10 + (*p - '0');
+                    fractionDigits++;
+                }
+                p++;
+                digits++;
+            }
+        }
+        if (digits == 0) return fail(QString("line %1: expected a glucose value").arg(line));
+        if (minute > INT_MAX) return fail(QString("line %1: minute out of range").arg(line));
+        if (!parsed.isEmpty() && minute <= parsed.last().minute) {
+            return fail(QString("line %1: minutes must increase").arg(line));
+        }
+
+        double glucose = double(whole) + double(fraction) * tenths[fractionDigits];
+        if (glucose > 35.0) glucose /= MgdlPerMmol;
+        CgmSample s;
+        s.minute = qint32(minute);
+        s.glucose = float(glucose);
+        parsed.append(s);
+        p = lineEnd + 1;
+    }
+
+    if (parsed.isEmpty()) return fail("no readings");
+    samples = parsed.constData();
+    count = parsed.size();
+    return true;
+}
+
+void CgmTrace::close() {
+    if (mapping) file.unmap(mapping);
+    mapping = nullptr;
+    file.close();
+    samples = nullptr;
+    count = 0;
+    parsed.clear();
+}
+
+bool CgmTrace::isOpen() const {
+    return samples != nullptr;
+}
+
+bool CgmTrace::fail(const QString &message) {
+    close();
+    error = message;
+    return false;
+}
+
+QString CgmTrace::errorString() const {
+    return error;
+}
+
+bool CgmTrace::writeBinary(const QString &fileName) const {
+    if (!isOpen()) return false;
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly)) return false;
+
+    Header header;
+    memcpy(header.magic, CgmMagic, sizeof(CgmMagic));
+    header.version = Version;
+    header.sampleBytes = sizeof(CgmSample);
+    header.count = quint64(count);
+    header.reserved = 0;
+    if (out.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+            || out.write(reinterpret_cast<const char *>(samples), count * qint64(sizeof(CgmSample))) != count * qint64(sizeof(CgmSample))) {
+        out.cancelWriting();
+        return false;
+    }
+    return out.commit();
+}
+
+qint64 CgmTrace::size() const {
+    return count;
+}
+
+const CgmSample &CgmTrace::sample(qint64 index) const {
+    return samples[index];
+}
+
+int CgmTrace::firstMinute() const {
+    return count ? samples[0].minute : 0;
+}
+
+int CgmTrace::lastMinute() const {
+    return count ? samples[count - 1].minute : 0;
+}
+
+bool CgmTrace::glucoseAt(int minute, double &glucose) const {
+    qint64 cursor = 0;
+    return glucoseAt(minute, glucose, cursor);
+}
+
+bool CgmTrace::glucoseAt(int minute, double &glucose, qint64 &cursor) const {
+    if (count == 0 || minute < samples[0].minute || minute > samples[count - 1].minute) return false;
+
+    // the segment [cursor, cursor + 1] that holds minute
+    qint64 i = cursor;
+    if (!(i < count - 1 && samples[i].minute <= minute && minute < samples[i + 1].minute)) {
+        if (i + 1 < count - 1 && samples[i + 1].minute <= minute && minute < samples[i + 2].minute) {
+            i++;
+        } else {
+            const CgmSample *next = std::upper_bound(samples, samples + count, minute,
+                                                     [](int m, const CgmSample &s) { return m < s.minute; });
+            i = qMax<qint64>(0, (next - samples) - 1);
+        }
+        cursor = i;
+    }
+
+    const CgmSample &a = samples[i];
+    if (a.minute == minute || i == count - 1) {
+        glucose = a.glucose;
+        return true;
+    }
+    const CgmSample &b = samples[i + 1];
+    if (b.minute - a.minute > MaxGapMinutes) return false;
+    const double t = double(minute - a.minute) / double(b.minute - a.minute);
+    glucose = a.glucose + (b.glucose - a.glucose) * t;
+    return true;
+}
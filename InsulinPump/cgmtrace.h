@@ -0,0 +1,73 @@
+#ifndef CGMTRACE_H
+#define CGMTRACE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QFile>
+
+// -------------------- CGM Sample --------------------
+// One recorded sensor reading, minutes from the start of the trace
+struct CgmSample {
+    qint32 minute;
+    float glucose;   // mmol/L
+};
+
+// -------------------- CGM Trace --------------------
+// A recorded glucose stream, read from a memory-mapped file:
+//  - CSV: "minute,glucose" per line (',', ';', tab or space separated), an
+//    optional header line and '#' comments. Values above 35 are taken to be
+//    mg/dL and converted. Parsed straight from the mapping into samples.
+//  - Binary: a 32 byte header ("PUMPCGM1", version, count) followed by the
+//    CgmSample array, used in place from the mapping without any copy.
+// Sensors report every 5 minutes; glucoseAt() interpolates linearly to the
+// 1 minute step and has no reading inside gaps longer than MaxGapMinutes.
+// Minutes strictly increase in either format, files that break this are
+// rejected. An open trace is read-only, so any number of threads can read it;
+// each reader keeps its own cursor.
+class CgmTrace {
+public:
+    static const int MaxGapMinutes = 15;
+    static const quint32 Version = 1;
+
+    CgmTrace();
+    ~CgmTrace();
+
+    bool open(const QString &fileName); // CSV or binary, decided by the header
+    void close();
+    bool isOpen() const;
+    bool writeBinary(const QString &fileName) const;
+    QString errorString() const;
+
+    qint64 size() const;
+    const CgmSample &sample(qint64 index) const;
+    int firstMinute() const;
+    int lastMinute() const;
+
+    // Interpolated reading at 'minute'; false outside the trace or in a gap.
+    // 'cursor' is the caller's, the segment its last call used (start at 0):
+    // consecutive minutes are O(1), anything else is a binary search.
+    bool glucoseAt(int minute, double &glucose, qint64 &cursor) const;
+    bool glucoseAt(int minute, double &glucose) const; // one-off lookup
+
+private:
+    struct Header {
+        char magic[8];
+        quint32 version;
+        quint32 sampleBytes;
+        quint64 count;
+        quint64 reserved;
+    };
+
+    bool parseCsv(const char *data, qint64 length);
+    bool fail(const QString &message);
+
+    QFile file;
+    uchar *mapping;
+    const CgmSample *samples; // into the mapping (binary) or into parsed (CSV)
+    qint64 count;
+    QVector<CgmSample> parsed;
+    QString error;
+};
+
+#endif // CGMTRACE_H
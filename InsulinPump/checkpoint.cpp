@@ -0,0 +1,118 @@
+#include "checkpoint.h"
+#include <QSaveFile>
+#include <QFile>
+#include <QDataStream>
+
+// -------------------- Pump Checkpoint --------------------
+const quint32 PumpCheckpoint::Magic;
+const quint32 PumpCheckpoint::Version;
+
+// Fields are written one by one in a fixed order; a new field means a new Version
+static void writePayload(QDataStream &out, const PumpCheckpoint &c) {
+    out << qint32(c.timeStep) << qint32(c.batteryLevel) << c.running;
+    out << qint32(c.pump.timeStep) << c.pump.basalRate << c.pump.profileBasalRate << c.pump.correctionFactor
+        << qint32(c.pump.carbRatio) << c.pump.targetGlucose << c.pump.currentGlucose << c.pump.insulinOnBoard
+        << c.pump.cartLevel << qint32(c.pump.currentState);
+    const GlucoseModelState &m = c.pump.physiology;
+    out << qint32(c.pump.glucoseModel) << m.insulinAction << m.carbsOnBoard;
+    out << m.insulinDepot[0] << m.insulinDepot[1] << m.plasmaInsulin << m.gut[0] << m.gut[1];
+    out << c.noiseSeed << c.noiseStream;
+    out << qint32(c.events.size());
+    for (const SimEvent &e : c.events) {
+        out << qint32(e.due) << qint32(e.kind) << qint32(e.remaining);
+        for (double v : e.values) out << v;
+    }
+}
+
+// 'size' bounds the event count a damaged file can claim
+static bool readPayload(QDataStream &in, quint32 version, qint64 size, PumpCheckpoint &c) {
+    qint32 timeStep, batteryLevel, pumpTimeStep, carbRatio, state, eventCount, model = GlucoseModel::Classic;
+    in >> timeStep >> batteryLevel >> c.running;
+    in >> pumpTimeStep >> c.pump.basalRate >> c.pump.profileBasalRate >> c.pump.correctionFactor
+       >> carbRatio >> c.pump.targetGlucose >> c.pump.currentGlucose >> c.pump.insulinOnBoard
+       >> c.pump.cartLevel >> state;
+    GlucoseModelState &m = c.pump.physiology;
+    if (version >= 2) {
+        in >> model >> m.insulinAction >> m.carbsOnBoard;
+    }
+    if (version >= 3) {
+        in >> m.insulinDepot[0] >> m.insulinDepot[1] >> m.plasmaInsulin >> m.gut[0] >> m.gut[1];
+    }
+    in >> c.noiseSeed >> c.noiseStream;
+    in >> eventCount;
+    if (in.status() != QDataStream::Ok || eventCount < 0 || eventCount > size || state < PumpState::Run || state > PumpState::Resume
+        || model < 0 || model >= GlucoseModel::KindCount) {
+        return false;
+    }
+
+    c.timeStep = timeStep;
+    c.batteryLevel = batteryLevel;
+    c.pump.timeStep = pumpTimeStep;
+    c.pump.carbRatio = carbRatio;
+    c.pump.currentState = PumpState::Mode(state);
+    c.pump.glucoseModel = GlucoseModel::Kind(model);
+    c.events.reserve(eventCount);
+    for (int i = 0; i < eventCount && in.status() == QDataStream::Ok; i++) {
+        qint32 due, kind, remaining;
+        in >> due >> kind >> remaining;
+        if (kind < SimEvent::ExtendedBolus || kind > SimEvent::ResumeInsulin) return false;
+        SimEvent e;
+        e.due = due;
+        e.kind = SimEvent::Kind(kind);
+        e.remaining = remaining;
+        for (double &v : e.values) in >> v;
+        c.events.append(e);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+// Version 4 on: the payload goes in as one length-prefixed block followed by
+// its CRC, so a truncated or corrupted file is rejected instead of restored
+bool PumpCheckpoint::save(const QString &fileName) const {
+    QByteArray payload;
+    {
+        QDataStream body(&payload, QIODevice::WriteOnly);
+        body.setVersion(QDataStream::Qt_6_0);
+        writePayload(body, *this);
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << Magic << Version << payload << quint16(qChecksum(payload));
+    if (out.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit(); // renames over the old checkpoint
+}
+
+bool PumpCheckpoint::load(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if (magic != Magic || version < 1 || version > Version) return false;
+
+    PumpCheckpoint c;
+    if (version < 4) {
+        // no checksum yet, fields follow the header directly
+        if (!readPayload(in, version, file.size(), c)) return false;
+    } else {
+        QByteArray payload;
+        quint16 checksum = 0;
+        in >> payload >> checksum;
+        if (in.status() != QDataStream::Ok || !in.atEnd() || checksum != qChecksum(payload)) return false;
+        QDataStream body(payload);
+        body.setVersion(QDataStream::Qt_6_0);
+        if (!readPayload(body, version, payload.size(), c) || !body.atEnd()) return false;
+    }
+
+    *this = c;
+    return true;
+}
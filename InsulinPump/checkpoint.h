@@ -0,0 +1,32 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include "controliq.h"
+#include "simeventqueue.h"
+
+// -------------------- Pump Checkpoint --------------------
+// Everything needed to carry on a run: the device, the pump state, the
+// noise stream and the scheduled events (extended boluses included). Saved
+// as a small versioned binary file through QSaveFile, so the file on disk is
+// always either the previous checkpoint or the new one, never half of each.
+// The payload carries a CRC-16, checked before anything is restored.
+struct PumpCheckpoint {
+    static const quint32 Magic = 0x50434B50; // "PCKP"
+    static const quint32 Version = 4; // 2 added the glucose model (version 1 loads as ClassicModel), 3 its compartments, 4 the checksum
+
+    int timeStep = 0;
+    int batteryLevel = 100;
+    bool running = false;
+    PumpState pump;
+    quint64 noiseSeed = 0;
+    quint64 noiseStream = 0;
+    QVector<SimEvent> events; // in the order they were scheduled
+
+    bool save(const QString &fileName) const;
+    bool load(const QString &fileName); // leaves *this untouched on failure
+};
+
+#endif // CHECKPOINT_H
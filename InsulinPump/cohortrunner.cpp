@@ -0,0 +1,34 @@
+#include "cohortrunner.h"
+
+// -------------------- Cohort Runner --------------------
+CohortRunner::CohortRunner(int threads) : pool(threads) {}
+
+int CohortRunner::threadCount() const {
+    return pool.threadCount();
+}
+
+void CohortRunner::run(PatientCohort &cohort, int minutes) {
+    const int blocks = (cohort.size() + PatientCohort::BlockSize - 1) / PatientCohort::BlockSize;
+    if (blocks == 0 || minutes <= 0) return;
+
+    // A few chunks per thread leaves room for stealing without making the
+    // chunks so small that the blocks stop fitting in cache
+    const int chunkBlocks = qMax(1, blocks / (threadCount() * 4));
+    const int chunks = (blocks + chunkBlocks - 1) / chunkBlocks;
+
+    const int firstStep = cohort.getTimeStep() + 1;
+    pool.run(chunks, [&](int chunk) {
+        const int begin = chunk * chunkBlocks * PatientCohort::BlockSize;
+        const int end = qMin(cohort.size(), begin + chunkBlocks * PatientCohort::BlockSize);
+        // patients don't interact, so each block can run all its minutes
+        // while it is still hot in cache
+        for (int b = begin; b < end; b += PatientCohort::BlockSize) {
+            const int blockEnd = qMin(end, b + PatientCohort::BlockSize);
+            for (int m = 0; m < minutes; m++) {
+                cohort.stepBlock(b, blockEnd, firstStep + m);
+            }
+        }
+    });
+
+    cohort.advanceClock(minutes);
+}
@@ -0,0 +1,24 @@
+#ifndef COHORTRUNNER_H
+#define COHORTRUNNER_H
+
+#include "patientcohort.h"
+#include "workstealingpool.h"
+
+// -------------------- Cohort Runner --------------------
+// Runs a PatientCohort on every core. The cohort is cut into chunks of whole
+// blocks and each chunk is stepped through all the requested minutes on
+// whichever worker picks it up. Every patient has its own noise stream and
+// never reads another patient's state, so the result is bit-identical for
+// any thread count or schedule.
+class CohortRunner {
+public:
+    explicit CohortRunner(int threads = 0); // 0 = one per core
+
+    void run(PatientCohort &cohort, int minutes);
+    int threadCount() const;
+
+private:
+    WorkStealingPool pool;
+};
+
+#endif // COHORTRUNNER_H
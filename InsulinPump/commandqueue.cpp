@@ -0,0 +1,87 @@
+#include "commandqueue.h"
+
+// -------------------- Pump Command --------------------
+PumpCommand PumpCommand::applyProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose) {
+    PumpCommand c(ApplyProfile);
+    c.values[0] = basalRate;
+    c.values[1] = correctionFactor;
+    c.values[2] = carbRatio;
+    c.values[3] = targetGlucose;
+    return c;
+}
+
+PumpCommand PumpCommand::bolus(double carbs, double glucose, int hours, int minutes) {
+    PumpCommand c(Bolus);
+    c.values[0] = carbs;
+    c.values[1] = glucose;
+    c.values[2] = hours;
+    c.values[3] = minutes;
+    return c;
+}
+
+PumpCommand PumpCommand::setBattery(int level) {
+    PumpCommand c(SetBattery);
+    c.values[0] = level;
+    return c;
+}
+
+PumpCommand PumpCommand::setCartridge(double level) {
+    PumpCommand c(SetCartridge);
+    c.values[0] = level;
+    return c;
+}
+
+PumpCommand PumpCommand::setSpeed(int speed) {
+    PumpCommand c(SetSpeed);
+    c.values[0] = speed;
+    return c;
+}
+
+PumpCommand PumpCommand::log(const QString &text, LogRecord::Severity severity) {
+    PumpCommand c(Log);
+    c.values[0] = severity;
+    c.text = LogText::fromString(text);
+    return c;
+}
+
+// -------------------- Command Queue --------------------
+const int CommandQueue::Capacity;
+
+CommandQueue::CommandQueue() : tail(0), head(0) {
+    for (int i = 0; i < Capacity; i++) {
+        ring[i].sequence.store(quint32(i), std::memory_order_relaxed);
+    }
+}
+
+bool CommandQueue::push(const PumpCommand &command) {
+    quint32 position = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot &slot = ring[position & Mask];
+        const qint32 lag = qint32(slot.sequence.load(std::memory_order_acquire) - position);
+        if (lag == 0) {
+            // free: claim it, on failure 'position' is reloaded with the new tail
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                slot.command = command;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (lag < 0) {
+            return false; // the consumer hasn't taken this slot's last lap yet
+        } else {
+            position = tail.load(std::memory_order_relaxed); // another producer got it
+        }
+    }
+}
+
+bool CommandQueue::take(PumpCommand &command) {
+    Slot &slot = ring[head & Mask];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) return false;
+    command = slot.command;
+    slot.sequence.store(head + Capacity, std::memory_order_release); // free for the next lap
+    head++;
+    return true;
+}
+
+bool CommandQueue::isEmpty() const {
+    return ring[head & Mask].sequence.load(std::memory_order_acquire) != head + 1;
+}
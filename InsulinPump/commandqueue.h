@@ -0,0 +1,81 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include "eventlog.h"
+
+// -------------------- Pump Command --------------------
+// A GUI action for the device, posted from the GUI thread and applied on the
+// simulation thread between two steps. Plain value like SimEvent, so the
+// queue is one preallocated array.
+struct PumpCommand {
+    enum Kind {
+        PowerOn,          // starts the device and its clock
+        PowerOff,         // stops both
+        StartClock,       // the clock only, the device keeps its state (after a checkpoint restore)
+        Pause,
+        Resume,
+        ApplyProfile,
+        Bolus,
+        Refill,
+        Charge,
+        SetBattery,       // battery level, %
+        SetCartridge,     // cartridge level, units
+        SetSpeed,         // SimulationClock::Speed
+        Occlusion,        // stops the device like PowerOff
+        ResolveOcclusion, // starts it again like PowerOn
+        Disconnect,
+        Reconnect,
+        Log               // text for the event log, stamped with the device's time step
+    };
+
+    Kind kind = PowerOn;
+    // apply profile: basal rate, correction factor, carb ratio, target glucose
+    // bolus: carbs, glucose, extended hours, extended minutes
+    // set battery, set cartridge, set speed: the new value
+    // log: LogRecord::Severity
+    double values[4] = { 0.0, 0.0, 0.0, 0.0 };
+    LogText text; // log only
+
+    explicit PumpCommand(Kind kind = PowerOn) : kind(kind) {}
+    static PumpCommand applyProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
+    static PumpCommand bolus(double carbs, double glucose, int hours, int minutes);
+    static PumpCommand setBattery(int level);
+    static PumpCommand setCartridge(double level);
+    static PumpCommand setSpeed(int speed);
+    static PumpCommand log(const QString &text, LogRecord::Severity severity = LogRecord::Event);
+};
+
+// -------------------- Command Queue --------------------
+// Lock-free bounded multi-producer/single-consumer queue. Any thread can
+// push; producers claim a slot with a CAS on the tail and publish it through
+// the slot's sequence number, so a slow producer never blocks the others
+// and the consumer never waits. Nothing is allocated after construction.
+// Commands from one producer are taken in the order they were pushed.
+class CommandQueue {
+public:
+    static const int Capacity = 256; // power of two
+
+    CommandQueue();
+
+    bool push(const PumpCommand &command); // any thread, false when full
+    bool take(PumpCommand &command);       // consumer only, false when empty
+    bool isEmpty() const;                  // consumer only
+
+private:
+    static const quint32 Mask = Capacity - 1;
+
+    // sequence == position: free for the producer claiming that position
+    // sequence == position + 1: holds a command for the consumer
+    struct Slot {
+        std::atomic<quint32> sequence;
+        PumpCommand command;
+    };
+
+    Slot ring[Capacity];
+    std::atomic<quint32> tail; // next position a producer claims
+    quint32 head;              // next position the consumer takes
+};
+
+#endif // COMMANDQUEUE_H
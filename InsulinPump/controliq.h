@@ -0,0 +1,258 @@
+#ifndef CONTROLIQ_H
+#define CONTROLIQ_H
+
+#include <QtGlobal>
+#include <cmath>
+#include "glucosemodel.h"
+#include "profiler.h"
+
+// -------------------- Pump State --------------------
+// Plain-value copy of everything the control loop needs. InsulinControlSystem
+// and the headless PumpEngine both step one of these, so the GUI and batch
+// runs share a single implementation of the Control-IQ logic.
+struct PumpState {
+    enum Mode { Run, Stop, Pause, Resume };
+
+    int timeStep = 0;
+    double basalRate = 1.0;
+    double profileBasalRate = 0.0;
+    double correctionFactor = 1.0;
+    int carbRatio = 1;
+    double targetGlucose = 5.0;
+    double currentGlucose = 5.5;
+    double insulinOnBoard = 0.0;
+    double cartLevel = 300.0;
+    Mode currentState = Run;
+    GlucoseModel::Kind glucoseModel = GlucoseModel::Classic;
+    GlucoseModelState physiology; // whatever the glucose model keeps between steps
+};
+
+// What happened during one step, so callers can report it however they like
+struct StepResult {
+    bool stepped = false;       // false while stopped
+    bool pausedBasal = false;   // basal rate forced to 0 because of a pause
+    bool resumedBasal = false;  // basal rate restored to the profile rate
+    bool hypo = false;
+    bool hyper = false;
+    double basalEffect = 0.0;   // rounded to 2 decimals like the GUI shows it
+    double predictedGlucose = 0.0;
+};
+
+// Split of a requested bolus into the immediate part and the hourly extended part
+struct BolusPlan {
+    double carbBolus = 0.0;
+    double correctionBolus = 0.0;
+    double totalBolus = 0.0;
+    double finalBolus = 0.0;        // total minus insulin on board
+    double correctionPortion = 0.0;
+    double immediateBolus = 0.0;
+    double extendedBolus = 0.0;
+    double immediateCorrection = 0.0;
+    double bolusPerHour = 0.0;
+    double correctionPerHour = 0.0;
+    int hours = 0;                  // hourly extended deliveries
+};
+
+// -------------------- Control-IQ --------------------
+class ControlIQ {
+public:
+    static constexpr double HypoThreshold = 3.9;
+    static constexpr double HyperThreshold = 8.9;
+
+    // Advances the state by one minute. The two noise values are the random
+    // fluctuations added to the glucose and to the prediction, both in
+    // [-0.1, 0.1). Defined here so batch loops can inline it; step<Model>
+    // runs a given GlucoseModel, the plain overload the one the state names.
+    static StepResult step(PumpState &s, double glucoseNoise, double predictionNoise);
+    template <typename Model>
+    static StepResult step(PumpState &s, double glucoseNoise, double predictionNoise);
+    // Same step driven by a sensor reading: insulin is delivered as usual but
+    // the modelled glucose is replaced by the reading before the controller
+    // decides, e.g. when replaying a recorded CGM trace
+    static StepResult sensorStep(PumpState &s, double reading, double predictionNoise);
+    template <typename Model>
+    static StepResult sensorStep(PumpState &s, double reading, double predictionNoise);
+
+    // Hours until the insulin on board is used up (only needed for display)
+    static double iobHoursRemaining(double insulinOnBoard);
+
+    // Bolus calculator (60% now, 40% spread over the duration) and the effect
+    // of one delivery on insulin on board and glucose. The cartridge is left
+    // to the caller since the GUI warns about it.
+    static BolusPlan planBolus(const PumpState &s, double carbInput, double glucoseInput,
+                               double bolusDurationHour, double bolusDurationMin);
+    static void applyBolus(PumpState &s, double bolus, double correctionOnly);
+    template <typename Model>
+    static void applyBolus(PumpState &s, double bolus, double correctionOnly);
+    static void addCarbs(PumpState &s, double grams); // carbs eaten with a bolus
+
+    static double roundCents(double value) { return qRound(value * 100) / 100.0; }
+
+private:
+    // the two halves of a step: basal delivery and the glucose model, then
+    // insulin absorption, the prediction and the basal rate decision
+    template <typename Model>
+    static bool deliver(PumpState &s, StepResult &r, double glucoseNoise);
+    template <typename Model>
+    static void decide(PumpState &s, StepResult &r, double predictionNoise);
+};
+
+inline StepResult ControlIQ::step(PumpState &s, double glucoseNoise, double predictionNoise) {
+    switch (s.glucoseModel) {
+    case GlucoseModel::Bergman: return step<BergmanModel>(s, glucoseNoise, predictionNoise);
+    case GlucoseModel::Compartment: return step<CompartmentModel>(s, glucoseNoise, predictionNoise);
+    default: return step<ClassicModel>(s, glucoseNoise, predictionNoise);
+    }
+}
+
+template <typename Model>
+inline StepResult ControlIQ::step(PumpState &s, double glucoseNoise, double predictionNoise) {
+    // by ICS logic, each time step is a minute
+    StepResult r;
+    if (deliver<Model>(s, r, glucoseNoise)) decide<Model>(s, r, predictionNoise);
+    return r;
+}
+
+inline StepResult ControlIQ::sensorStep(PumpState &s, double reading, double predictionNoise) {
+    switch (s.glucoseModel) {
+    case GlucoseModel::Bergman: return sensorStep<BergmanModel>(s, reading, predictionNoise);
+    case GlucoseModel::Compartment: return sensorStep<CompartmentModel>(s, reading, predictionNoise);
+    default: return sensorStep<ClassicModel>(s, reading, predictionNoise);
+    }
+}
+
+template <typename Model>
+inline StepResult ControlIQ::sensorStep(PumpState &s, double reading, double predictionNoise) {
+    StepResult r;
+    if (deliver<Model>(s, r, 0.0)) {
+        s.currentGlucose = roundCents(reading);
+        decide<Model>(s, r, predictionNoise);
+    }
+    return r;
+}
+
+template <typename Model>
+inline bool ControlIQ::deliver(PumpState &s, StepResult &r, double glucoseNoise) {
+    double basalEffect = 0;
+
+    if (s.currentState == PumpState::Stop) return false;
+    r.stepped = true;
+    {
+        PUMP_PROFILE_SCOPE(State);
+        if (s.currentState == PumpState::Pause){
+            s.basalRate = 0;
+            r.pausedBasal = true;
+        } else if (s.currentState == PumpState::Resume){
+            s.currentState = PumpState::Run;
+            s.basalRate = s.profileBasalRate;
+            r.resumedBasal = true;
+        }
+    }
+
+    PUMP_PROFILE_SCOPE(Insulin);
+    // Adjust active basal rate based on profile basal rate
+    if (s.currentState != PumpState::Pause){
+        // Simulate effect of basal insulin delivery
+        // Calculate basal effect as 1/10th basal rate for simultation reasons
+        basalEffect = s.basalRate * 0.1;
+        s.insulinOnBoard += basalEffect;
+    }
+    Model::basal(s.currentGlucose, s.insulinOnBoard, s.basalRate, s.currentState == PumpState::Pause, s.physiology);
+
+    // Add random fluctuations to prevent stabilization
+    s.currentGlucose += glucoseNoise;
+
+    // Ensure values remain stable and avoid floating-point errors
+    s.currentGlucose = roundCents(s.currentGlucose);
+    s.cartLevel -= basalEffect;
+    r.basalEffect = roundCents(basalEffect);
+    return true;
+}
+
+template <typename Model>
+inline void ControlIQ::decide(PumpState &s, StepResult &r, double predictionNoise) {
+    {
+        PUMP_PROFILE_SCOPE(Absorption);
+        Model::absorb(s.insulinOnBoard, s.physiology);
+    }
+
+    double predictedGlu;
+    {
+        PUMP_PROFILE_SCOPE(Prediction);
+        // Predict glucose trend 30 minutes ahead
+        predictedGlu = Model::predict(s.currentGlucose, s.insulinOnBoard, s.physiology);
+        // Small random fluctuation
+        predictedGlu += predictionNoise;
+        predictedGlu = roundCents(predictedGlu);
+    }
+    r.predictedGlucose = predictedGlu;
+
+    PUMP_PROFILE_SCOPE(Basal);
+    // Adjust insulin delivery based on Control-IQ technology rules
+    if (predictedGlu <= s.targetGlucose-0.1) {
+        s.basalRate = 0.0;  // Suspend insulin if glucose is too low
+    } else if (predictedGlu <= s.targetGlucose+0.03) {
+        s.basalRate = qMax(s.basalRate * 0.5, 0.1);  // Reduce basal insulin when predict glucose is in the range of target glucose
+    } else if (predictedGlu >= s.targetGlucose+0.5) {
+        double maxBasalRate = 2.0;
+        s.basalRate = qMin(s.basalRate * 1.2, maxBasalRate);  // Increase insulin
+    }
+
+    r.hypo = s.currentGlucose < HypoThreshold;
+    r.hyper = s.currentGlucose >= HyperThreshold;
+}
+
+inline double ControlIQ::iobHoursRemaining(double insulinOnBoard) {
+    if (insulinOnBoard <= 0.01) return 0.0;
+    // remaining time for consuming insulin on board
+    double remainingTimeMinutes = std::log(100 / insulinOnBoard) / std::log(1.02); // Using a decay formula
+    return remainingTimeMinutes / 60.0;  // Convert minutes to hours
+}
+
+inline BolusPlan ControlIQ::planBolus(const PumpState &s, double carbInput, double glucoseInput,
+                                      double bolusDurationHour, double bolusDurationMin) {
+    BolusPlan b;
+    double bolusDuration = bolusDurationHour + (bolusDurationMin / 60.0);
+
+    b.carbBolus = carbInput / s.carbRatio;
+    b.correctionBolus = glucoseInput > s.targetGlucose ? (glucoseInput - s.targetGlucose) / s.correctionFactor : 0;
+    b.totalBolus = b.carbBolus + b.correctionBolus;
+    b.finalBolus = b.totalBolus > s.insulinOnBoard ? b.totalBolus - s.insulinOnBoard : 0;
+    b.correctionPortion = b.correctionBolus > s.insulinOnBoard ? b.correctionBolus - s.insulinOnBoard : 0;
+
+    // Immediate and Extended Bolus (60% Immediate, 40% Extended over duration)
+    double immediateFraction = 0.6;
+    b.immediateBolus = immediateFraction * b.finalBolus;
+    b.extendedBolus = (1 - immediateFraction) * b.finalBolus;
+    b.bolusPerHour = b.extendedBolus / bolusDuration;
+
+    // Only apply correction bolus on glucose
+    b.immediateCorrection = 0.6 * b.correctionPortion;
+    b.correctionPerHour = (b.correctionPortion - b.immediateCorrection) / bolusDuration;
+    b.hours = int(bolusDuration);
+    return b;
+}
+
+inline void ControlIQ::applyBolus(PumpState &s, double bolus, double correctionOnly) {
+    switch (s.glucoseModel) {
+    case GlucoseModel::Bergman: applyBolus<BergmanModel>(s, bolus, correctionOnly); break;
+    case GlucoseModel::Compartment: applyBolus<CompartmentModel>(s, bolus, correctionOnly); break;
+    default: applyBolus<ClassicModel>(s, bolus, correctionOnly); break;
+    }
+}
+
+template <typename Model>
+inline void ControlIQ::applyBolus(PumpState &s, double bolus, double correctionOnly) {
+    s.insulinOnBoard += bolus;
+    Model::bolus(s.currentGlucose, bolus, correctionOnly, s.correctionFactor, s.physiology);
+}
+
+inline void ControlIQ::addCarbs(PumpState &s, double grams) {
+    switch (s.glucoseModel) {
+    case GlucoseModel::Bergman: BergmanModel::carbs(grams, s.physiology); break;
+    case GlucoseModel::Compartment: CompartmentModel::carbs(grams, s.physiology); break;
+    default: ClassicModel::carbs(grams, s.physiology); break;
+    }
+}
+
+#endif // CONTROLIQ_H
@@ -0,0 +1,217 @@
+#include "eventlog.h"
+#include <cstring>
+
+// -------------------- Log Text --------------------
+const int LogText::MaxBytes;
+
+LogText LogText::fromString(const QString &text) {
+    const QByteArray bytes = text.toUtf8();
+    int n = qMin(int(bytes.size()), MaxBytes);
+    // don't split a multi-byte character, continuation bytes are 10xxxxxx
+    while (n > 0 && n < bytes.size() && (uchar(bytes[n]) & 0xC0) == 0x80) n--;
+    LogText t;
+    t.length = quint8(n);
+    memcpy(t.utf8, bytes.constData(), size_t(n));
+    return t;
+}
+
+QString LogText::toString() const {
+    return QString::fromUtf8(utf8, length);
+}
+
+// -------------------- Event Log --------------------
+const int EventLog::DefaultCapacity;
+const int EventLog::DefaultTextCapacity;
+const int EventLog::RecordSlack;
+const int EventLog::TextSlack;
+const int EventLog::RecordWords;
+const int EventLog::TextWords;
+
+static_assert(sizeof(LogRecord) % sizeof(quint64) == 0, "LogRecord is stored as whole words");
+static_assert(sizeof(LogText) % sizeof(quint64) == 0, "LogText is stored as whole words");
+
+// Readers only look at the newest maxRecords (maxTexts); the slack behind
+// them is what the writer can fill while a read is in progress
+EventLog::EventLog(int capacity, int textCapacity)
+    : maxRecords(qMax(1, capacity)), recordSlots(maxRecords + RecordSlack),
+      maxTexts(qMax(1, textCapacity)), textSlots(maxTexts + TextSlack),
+      records(size_t(recordSlots) * RecordWords), texts(size_t(textSlots) * TextWords),
+      written(0), newestError(-1), textsWritten(0) {}
+
+// the release fences pair with the acquire fence in stillValid() and
+// format(): a reader that sees the new words also sees that the slot has
+// moved on
+void EventLog::append(int timeStep, LogRecord::Kind kind, LogRecord::Severity severity,
+                      double a, double b, double c, double d, double e) {
+    LogRecord r;
+    r.timeStep = timeStep;
+    r.kind = kind;
+    r.severity = severity;
+    r.values[0] = a;
+    r.values[1] = b;
+    r.values[2] = c;
+    r.values[3] = d;
+    r.values[4] = e;
+    quint64 words[RecordWords];
+    memcpy(words, &r, sizeof(r));
+
+    const qint64 n = written.load(std::memory_order_relaxed);
+    std::atomic<quint64> *slot = &records[size_t(n % recordSlots) * RecordWords];
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < RecordWords; i++) slot[i].store(words[i], std::memory_order_relaxed);
+    written.store(n + 1, std::memory_order_release);
+    // after written, so a reader that sees it can also read the record
+    if (severity == LogRecord::Error) newestError.store(n, std::memory_order_release);
+}
+
+void EventLog::appendText(int timeStep, const QString &text, LogRecord::Severity severity) {
+    appendText(timeStep, LogText::fromString(text), severity);
+}
+
+// The text is published before its record, so a reader holding the record
+// finds the text
+void EventLog::appendText(int timeStep, const LogText &text, LogRecord::Severity severity) {
+    quint64 words[TextWords];
+    memcpy(words, &text, sizeof(text));
+
+    const qint64 n = textsWritten.load(std::memory_order_relaxed);
+    std::atomic<quint64> *slot = &texts[size_t(n % textSlots) * TextWords];
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < TextWords; i++) slot[i].store(words[i], std::memory_order_relaxed);
+    textsWritten.store(n + 1, std::memory_order_release);
+    append(timeStep, LogRecord::Text, severity, double(n));
+}
+
+void EventLog::clear() {
+    written.store(0, std::memory_order_release);
+    newestError.store(-1, std::memory_order_release);
+    textsWritten.store(0, std::memory_order_release);
+}
+
+qint64 EventLog::end() const {
+    return written.load(std::memory_order_acquire);
+}
+
+qint64 EventLog::begin() const {
+    return qMax<qint64>(0, end() - maxRecords);
+}
+
+qint64 EventLog::lastError() const {
+    const qint64 error = newestError.load(std::memory_order_acquire);
+    return error >= 0 && error >= end() - maxRecords ? error : -1;
+}
+
+qint64 EventLog::read(qint64 from, int maxCount, QVector<LogRecord> &out) const {
+    for (;;) {
+        out.clear();
+        const qint64 end = written.load(std::memory_order_acquire);
+        const qint64 first = qMax(from, qMax<qint64>(0, end - maxRecords));
+        const qint64 to = qMin(end, first + qMax(0, maxCount));
+        LogRecord record;
+        for (qint64 i = first; i < to; i++) {
+            readRecord(i, record);
+            out.append(record);
+        }
+        if (stillValid(first)) return first;
+        // the writer lapped us while we were reading, try again from the new tail
+    }
+}
+
+bool EventLog::at(qint64 sequence, LogRecord &record) const {
+    const qint64 end = written.load(std::memory_order_acquire);
+    if (sequence < 0 || sequence >= end || sequence < end - maxRecords) return false;
+    return readRecord(sequence, record);
+}
+
+qint64 EventLog::firstAtOrAfter(int timeStep) const {
+    for (;;) {
+        const qint64 end = written.load(std::memory_order_acquire);
+        qint64 lowestRead = end;
+        const qint64 first = firstAtOrAfter(qMax<qint64>(0, end - maxRecords), end, timeStep, lowestRead);
+        if (stillValid(lowestRead)) return first;
+    }
+}
+
+bool EventLog::readRecord(qint64 sequence, LogRecord &record) const {
+    const std::atomic<quint64> *slot = &records[size_t(sequence % recordSlots) * RecordWords];
+    quint64 words[RecordWords];
+    for (int i = 0; i < RecordWords; i++) words[i] = slot[i].load(std::memory_order_relaxed);
+    memcpy(&record, words, sizeof(record));
+    return stillValid(sequence);
+}
+
+qint64 EventLog::firstAtOrAfter(qint64 lo, qint64 hi, int timeStep, qint64 &lowestRead) const {
+    while (lo < hi) {
+        const qint64 mid = lo + (hi - lo) / 2;
+        lowestRead = qMin(lowestRead, mid);
+        // timeStep is the first word of a record
+        const quint64 word = records[size_t(mid % recordSlots) * RecordWords].load(std::memory_order_relaxed);
+        int step;
+        memcpy(&step, &word, sizeof(step));
+        if (step < timeStep) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Everything from record firstRead on was read before the writer got to reuse its slot
+bool EventLog::stillValid(qint64 firstRead) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return firstRead > written.load(std::memory_order_relaxed) - recordSlots;
+}
+
+QString EventLog::format(const LogRecord &r) const {
+    const double *v = r.values;
+    switch (r.kind) {
+    case LogRecord::Separator: return QString("------------------");
+    case LogRecord::Text: {
+        const qint64 number = qint64(v[0]);
+        const qint64 end = textsWritten.load(std::memory_order_acquire);
+        if (number < 0 || number >= end || number < end - maxTexts) return QString("(text overwritten)");
+        const std::atomic<quint64> *slot = &texts[size_t(number % textSlots) * TextWords];
+        quint64 words[TextWords];
+        for (int i = 0; i < TextWords; i++) words[i] = slot[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (number <= textsWritten.load(std::memory_order_relaxed) - textSlots) return QString("(text overwritten)");
+        LogText text;
+        memcpy(&text, words, sizeof(text));
+        return text.toString();
+    }
+    case LogRecord::TimeStep: return QString("Time Step: %1").arg(r.timeStep);
+    case LogRecord::DeviceSetup: return QString("Device setup complete.");
+    case LogRecord::DeviceStarted: return QString("Device started.");
+    case LogRecord::DeviceStopped: return QString("Device stopped.");
+    case LogRecord::DeviceAutoStopped: return QString("Device automatically stopped due to depleted battery.");
+    case LogRecord::BatteryCharged: return QString("Battery charged to 100%.");
+    case LogRecord::BatteryDepleted: return QString("Battery depleted.");
+    case LogRecord::BatteryLow: return QString("WARNING: Battery level low (10%).");
+    case LogRecord::StateChanged: return QString("State changed.");
+    case LogRecord::BasalRateSet: return QString("Basal rate set to %1").arg(v[0]);
+    case LogRecord::ProfileBasalRateSet: return QString("Profile basal rate set to %1").arg(v[0]);
+    case LogRecord::CorrectionFactorSet: return QString("Correction Factor set to %1").arg(v[0]);
+    case LogRecord::CarbRatioSet: return QString("Carb Ratio set to %1").arg(v[0]);
+    case LogRecord::TargetGlucoseSet: return QString("Target Glucose set to %1").arg(v[0]);
+    case LogRecord::Hypoglycemic: return QString("User is hypoglycemic");
+    case LogRecord::Hyperglycemic: return QString("User is hyperglycemic");
+    case LogRecord::BasalDelivered:
+        return QString("Basal insulin delivered: %1 | Glucose: %2 | Predicted: %3").arg(v[0]).arg(v[1]).arg(v[2]);
+    case LogRecord::BolusInputs:
+        return QString("Carb Value: %1, Carb Ratio: %2, Glucose Input: %3, TargetBGL %4, Correction Factor: %5")
+                .arg(v[0]).arg(v[1]).arg(v[2]).arg(v[3]).arg(v[4]);
+    case LogRecord::BolusTotals:
+        return QString("IOB: %1 | Total Bolus: %2, Final Bolus: %3, Correction Portion: %4")
+                .arg(v[0]).arg(v[1]).arg(v[2]).arg(v[3]);
+    case LogRecord::BolusPlanned:
+        return QString("Immediate Bolus: %1 units | Extended: %2 units over 3 hrs")
+                .arg(v[0], 0, 'f', 2).arg(v[1], 0, 'f', 2);
+    case LogRecord::BolusInjected: return QString("Bolus injected: %1 | Glucose: %2").arg(v[0]).arg(v[1]);
+    case LogRecord::CartridgeLow: return QString("WARNING: Insulin level low (30 units).");
+    case LogRecord::CartridgeEmpty: return QString("Cartridge is empty.");
+    case LogRecord::LoggedBasalRate: return QString("Basal rate: %1").arg(v[0]);
+    case LogRecord::LoggedBolus: return QString("Bolus: %1").arg(v[0]);
+    }
+    return QString();
+}
@@ -0,0 +1,106 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <vector>
+
+// -------------------- Log Text --------------------
+// Free text of a Text record as UTF-8 in a fixed buffer, so storing it never
+// allocates. Longer text is cut at a character boundary.
+struct LogText {
+    static const int MaxBytes = 127;
+
+    quint8 length = 0;
+    char utf8[MaxBytes];
+
+    static LogText fromString(const QString &text);
+    QString toString() const;
+};
+
+// -------------------- Log Record --------------------
+// One log line in binary form. The text is only built by EventLog::format,
+// when somebody actually looks at the log.
+struct LogRecord {
+    enum Severity : quint8 { Event, Error };
+    enum Kind : quint16 {
+        Separator, Text,
+        // Device
+        TimeStep, DeviceSetup, DeviceStarted, DeviceStopped, DeviceAutoStopped,
+        BatteryCharged, BatteryDepleted, BatteryLow,
+        // InsulinControlSystem
+        StateChanged, BasalRateSet, ProfileBasalRateSet, CorrectionFactorSet, CarbRatioSet, TargetGlucoseSet,
+        Hypoglycemic, Hyperglycemic, BasalDelivered, BolusInputs, BolusTotals, BolusPlanned, BolusInjected,
+        CartridgeLow, CartridgeEmpty,
+        // Logger
+        LoggedBasalRate, LoggedBolus
+    };
+
+    int timeStep = 0;
+    quint16 kind = Separator;
+    quint8 severity = Event;
+    double values[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 }; // meaning depends on kind, Text keeps its text number in values[0]
+};
+
+// -------------------- Event Log --------------------
+// Preallocated ring of LogRecords, oldest overwritten first. Records are
+// addressed by their sequence number (0 for the first record ever written)
+// so a reader can pick up where it left off. Free text goes to a second,
+// smaller ring of LogTexts; a Text record that outlives its text formats to a
+// placeholder.
+// One thread writes (the device's, see Device::post for the GUI's text);
+// any other thread reads without locking. Like GlucoseRing, both rings keep
+// slack slots past their capacity and a read the writer lapped is retried.
+class EventLog {
+public:
+    static const int DefaultCapacity = 1 << 18;     // 256k records, 12 MB
+    static const int DefaultTextCapacity = 1 << 14; // 16k texts, 2 MB
+
+    explicit EventLog(int capacity = DefaultCapacity, int textCapacity = DefaultTextCapacity);
+
+    // writer thread only
+    void append(int timeStep, LogRecord::Kind kind, LogRecord::Severity severity = LogRecord::Event,
+                double a = 0.0, double b = 0.0, double c = 0.0, double d = 0.0, double e = 0.0);
+    void appendText(int timeStep, const QString &text, LogRecord::Severity severity = LogRecord::Event);
+    void appendText(int timeStep, const LogText &text, LogRecord::Severity severity = LogRecord::Event);
+    void clear(); // and no reader running
+
+    qint64 end() const;   // sequence number the next record will get
+    qint64 begin() const; // oldest sequence number still held
+    qint64 lastError() const; // sequence number of the newest Error record, -1 if none
+    // Copies up to maxCount records starting at sequence number 'from' (clamped to begin())
+    // and returns the sequence number of the first one copied
+    qint64 read(qint64 from, int maxCount, QVector<LogRecord> &out) const;
+    bool at(qint64 sequence, LogRecord &record) const;
+    // First sequence number held with a time step >= timeStep, end() if none.
+    // Records are appended in time step order, so this is a binary search.
+    qint64 firstAtOrAfter(int timeStep) const;
+
+    QString format(const LogRecord &record) const;
+
+private:
+    static const int RecordSlack = 1024;
+    static const int TextSlack = 64;
+    // Slots are stored as relaxed atomic words, so a torn read is a retry
+    // rather than a data race
+    static const int RecordWords = int(sizeof(LogRecord) / sizeof(quint64));
+    static const int TextWords = int(sizeof(LogText) / sizeof(quint64));
+
+    bool readRecord(qint64 sequence, LogRecord &record) const; // false if lapped
+    qint64 firstAtOrAfter(qint64 lo, qint64 hi, int timeStep, qint64 &lowestRead) const;
+    bool stillValid(qint64 firstRead) const;
+
+    const int maxRecords;
+    const int recordSlots;
+    const int maxTexts;
+    const int textSlots;
+    std::vector<std::atomic<quint64>> records; // RecordWords per slot
+    std::vector<std::atomic<quint64>> texts;   // TextWords per slot
+    std::atomic<qint64> written;      // total records appended, the slot is written % recordSlots
+    std::atomic<qint64> newestError;
+    std::atomic<qint64> textsWritten; // total texts appended, the slot is textsWritten % textSlots
+};
+
+#endif // EVENTLOG_H
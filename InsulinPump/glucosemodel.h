@@ -0,0 +1,238 @@
+#ifndef GLUCOSEMODEL_H
+#define GLUCOSEMODEL_H
+
+#include <QtGlobal>
+#include <QString>
+#include "odeintegrator.h"
+
+// -------------------- Glucose Model --------------------
+// The patient side of the simulation: how glucose reacts to insulin and
+// carbs, and what the controller predicts from it. Each model is a struct of
+// static inline hooks that ControlIQ takes as a template parameter, so a
+// batch loop stepping one model has everything inlined and no dispatch per
+// step. PumpState names the model it runs (see ControlIQ::step for the
+// runtime dispatch the GUI goes through).
+//
+// Every hook gets the model's own state; models that don't need it ignore it.
+struct GlucoseModelState {
+    double insulinAction = 0.0; // remote insulin action X (1/min), BergmanModel and CompartmentModel
+    double carbsOnBoard = 0.0;  // grams still to be absorbed, BergmanModel
+    double insulinDepot[2] = { 0.0, 0.0 }; // subcutaneous insulin (U), CompartmentModel
+    double plasmaInsulin = 0.0; // U, CompartmentModel
+    double gut[2] = { 0.0, 0.0 }; // grams in the stomach and the gut, CompartmentModel
+};
+
+class GlucoseModel {
+public:
+    enum Kind : quint8 { Classic, Bergman, Compartment, KindCount };
+
+    static QString name(Kind kind);
+    static bool fromName(const QString &name, Kind &kind); // case-insensitive
+};
+
+// The model the pump shipped with, kept exactly as it was so existing
+// trajectories (and the cohort kernel, which mirrors it) don't change.
+struct ClassicModel {
+    // one minute of glucose change for the basal rate in effect
+    static void basal(double &glucose, double insulinOnBoard, double basalRate, bool suspended, GlucoseModelState &m) {
+        Q_UNUSED(insulinOnBoard); Q_UNUSED(m);
+        if (!suspended) {
+            glucose -= 0.1 * basalRate;
+        } else {
+            // Increase the blood glucose since insulin stops
+            glucose += 0.05;
+        }
+    }
+
+    // insulin is absorbed 2% per minute
+    static void absorb(double &insulinOnBoard, GlucoseModelState &m) {
+        Q_UNUSED(m);
+        insulinOnBoard *= 0.98;
+        if (insulinOnBoard <= 0.01) {
+            insulinOnBoard = 0.0;
+        }
+    }
+
+    // glucose trend 30 minutes ahead
+    static double predict(double glucose, double insulinOnBoard, const GlucoseModelState &m) {
+        Q_UNUSED(m);
+        return glucose - (insulinOnBoard * 0.1667);
+    }
+
+    // only the correction part of a bolus acts on glucose, and right away
+    static void bolus(double &glucose, double units, double correctionOnly, double correctionFactor, GlucoseModelState &m) {
+        Q_UNUSED(units); Q_UNUSED(m);
+        double glucoseDrop = correctionOnly * correctionFactor;
+        glucose = glucose > glucoseDrop ? glucose - glucoseDrop : 0;
+    }
+
+    // carbs are covered by the bolus alone
+    static void carbs(double grams, GlucoseModelState &m) {
+        Q_UNUSED(grams); Q_UNUSED(m);
+    }
+};
+
+// Bergman minimal model in mmol/L and minutes, with a one compartment gut:
+//   dX/dt = -P2 X + P3 IOB
+//   dG/dt = -(P1 + X) G + P1 Gb + CarbEffect Ka Q
+//   dQ/dt = -Ka Q
+// stepped with explicit Euler at the pump's one minute resolution. Gb is the
+// glucose the liver drives toward with no insulin at all, so a T1D patient
+// without basal drifts up. With the default 1 U/h basal the steady state
+// insulin on board (~5 U) holds glucose near 6 mmol/L.
+struct BergmanModel {
+    static constexpr double P1 = 0.01;          // glucose effectiveness (1/min)
+    static constexpr double P2 = 0.025;         // insulin action decay (1/min)
+    static constexpr double P3 = 2.5e-5;        // insulin action gain (1/min^2 per U)
+    static constexpr double Gb = 9.0;           // endogenous glucose (mmol/L)
+    static constexpr double Ka = 0.02;          // carb absorption (1/min)
+    static constexpr double CarbEffect = 0.2;   // mmol/L per gram absorbed
+    static constexpr double Horizon = 30.0;     // prediction (min)
+
+    static double rate(double glucose, const GlucoseModelState &m) {
+        return -(P1 + m.insulinAction) * glucose + P1 * Gb + CarbEffect * Ka * m.carbsOnBoard;
+    }
+
+    // insulin acts through X whether or not basal is suspended
+    static void basal(double &glucose, double insulinOnBoard, double basalRate, bool suspended, GlucoseModelState &m) {
+        Q_UNUSED(basalRate); Q_UNUSED(suspended);
+        const double dG = rate(glucose, m);
+        m.insulinAction += -P2 * m.insulinAction + P3 * insulinOnBoard;
+        m.carbsOnBoard -= Ka * m.carbsOnBoard;
+        glucose = qMax(0.0, glucose + dG);
+    }
+
+    static void absorb(double &insulinOnBoard, GlucoseModelState &m) {
+        ClassicModel::absorb(insulinOnBoard, m);
+    }
+
+    static double predict(double glucose, double insulinOnBoard, const GlucoseModelState &m) {
+        Q_UNUSED(insulinOnBoard);
+        return glucose + Horizon * rate(glucose, m);
+    }
+
+    // a bolus only adds to insulin on board, X does the rest
+    static void bolus(double &glucose, double units, double correctionOnly, double correctionFactor, GlucoseModelState &m) {
+        Q_UNUSED(glucose); Q_UNUSED(units); Q_UNUSED(correctionOnly); Q_UNUSED(correctionFactor); Q_UNUSED(m);
+    }
+
+    static void carbs(double grams, GlucoseModelState &m) {
+        m.carbsOnBoard += qMax(0.0, grams);
+    }
+};
+
+// Multi-compartment model after Hovorka: insulin goes through two
+// subcutaneous depots into plasma, acts through X as in the Bergman model,
+// and carbs pass through two gut compartments before they appear:
+//   dS1/dt = u - S1 / Ti           dD1/dt = -D1 / Tg
+//   dS2/dt = (S1 - S2) / Ti        dD2/dt = (D1 - D2) / Tg
+//   dI/dt  = S2 / Ti - Ke I        dX/dt  = -P2 X + P3 I
+//   dG/dt  = -(P1 + X) G + P1 Gb + CarbEffect D2 / Tg
+// u is the basal delivery in the pump's units (0.1 x rate per minute, like
+// insulin on board). One RK4 step per minute through OdeIntegrator, which
+// PatientCohort runs on whole blocks of patients. At 1 U/h the insulin
+// steady state holds glucose near 6 mmol/L.
+struct CompartmentModel {
+    static constexpr double Ti = 55.0;          // subcutaneous absorption (min)
+    static constexpr double Ke = 0.138;         // plasma insulin elimination (1/min)
+    static constexpr double P1 = 0.01;          // glucose effectiveness (1/min)
+    static constexpr double P2 = 0.025;         // insulin action decay (1/min)
+    static constexpr double P3 = 1.7e-4;        // insulin action gain (1/min^2 per U)
+    static constexpr double Gb = 9.0;           // endogenous glucose (mmol/L)
+    static constexpr double Tg = 40.0;          // carb absorption (min)
+    static constexpr double CarbEffect = 0.2;   // mmol/L per gram absorbed
+    static constexpr double Horizon = 30.0;     // prediction (min)
+
+    enum Variable { Depot1, Depot2, Plasma, Action, Stomach, Gut, Glucose, VariableCount };
+
+    // Right hand side for a batch of patients. 'live' scales every
+    // derivative, 0 leaves a lane exactly as it was (stopped pumps).
+    struct System {
+        static const int Variables = VariableCount;
+        const double *infusion; // per lane, U/min into the first depot
+        const double *live;     // per lane, 1 or 0
+
+        void derivatives(const double *const *x, double *const *dx, int lane, int n) const {
+            const double *__restrict u = infusion + lane;
+            const double *__restrict on = live + lane;
+            const double *__restrict s1 = x[Depot1], *__restrict s2 = x[Depot2], *__restrict ip = x[Plasma];
+            const double *__restrict xa = x[Action], *__restrict d1 = x[Stomach], *__restrict d2 = x[Gut];
+            const double *__restrict g = x[Glucose];
+            double *__restrict ds1 = dx[Depot1], *__restrict ds2 = dx[Depot2], *__restrict dip = dx[Plasma];
+            double *__restrict dxa = dx[Action], *__restrict dd1 = dx[Stomach], *__restrict dd2 = dx[Gut];
+            double *__restrict dg = dx[Glucose];
+            for (int i = 0; i < n; i++) {
+                ds1[i] = on[i] * (u[i] - s1[i] / Ti);
+                ds2[i] = on[i] * ((s1[i] - s2[i]) / Ti);
+                dip[i] = on[i] * (s2[i] / Ti - Ke * ip[i]);
+                dxa[i] = on[i] * (-P2 * xa[i] + P3 * ip[i]);
+                dd1[i] = on[i] * (-d1[i] / Tg);
+                dd2[i] = on[i] * ((d1[i] - d2[i]) / Tg);
+                dg[i] = on[i] * glucoseRate(g[i], xa[i], d2[i]);
+            }
+        }
+    };
+
+    static double glucoseRate(double glucose, double action, double gut) {
+        return -(P1 + action) * glucose + P1 * Gb + CarbEffect * gut / Tg;
+    }
+
+    static void basal(double &glucose, double insulinOnBoard, double basalRate, bool suspended, GlucoseModelState &m) {
+        Q_UNUSED(insulinOnBoard);
+        double x[VariableCount] = { m.insulinDepot[0], m.insulinDepot[1], m.plasmaInsulin, m.insulinAction,
+                                    m.gut[0], m.gut[1], glucose };
+        double *lanes[VariableCount];
+        for (int v = 0; v < VariableCount; v++) lanes[v] = &x[v];
+        const double infusion = suspended ? 0.0 : 0.1 * basalRate;
+        const double live = 1.0;
+        OdeIntegrator::rk4(System{ &infusion, &live }, lanes, 1, 1.0);
+        m.insulinDepot[0] = x[Depot1];
+        m.insulinDepot[1] = x[Depot2];
+        m.plasmaInsulin = x[Plasma];
+        m.insulinAction = x[Action];
+        m.gut[0] = x[Stomach];
+        m.gut[1] = x[Gut];
+        glucose = x[Glucose];
+    }
+
+    static void absorb(double &insulinOnBoard, GlucoseModelState &m) {
+        ClassicModel::absorb(insulinOnBoard, m);
+    }
+
+    static double predict(double glucose, double insulinOnBoard, const GlucoseModelState &m) {
+        Q_UNUSED(insulinOnBoard);
+        return glucose + Horizon * glucoseRate(glucose, m.insulinAction, m.gut[1]);
+    }
+
+    // a bolus goes into the first depot like basal does
+    static void bolus(double &glucose, double units, double correctionOnly, double correctionFactor, GlucoseModelState &m) {
+        Q_UNUSED(glucose); Q_UNUSED(correctionOnly); Q_UNUSED(correctionFactor);
+        m.insulinDepot[0] += units;
+    }
+
+    static void carbs(double grams, GlucoseModelState &m) {
+        m.gut[0] += qMax(0.0, grams);
+    }
+};
+
+inline QString GlucoseModel::name(Kind kind) {
+    switch (kind) {
+    case Classic: return QString("classic");
+    case Bergman: return QString("bergman");
+    case Compartment: return QString("compartment");
+    case KindCount: break;
+    }
+    return QString();
+}
+
+inline bool GlucoseModel::fromName(const QString &name, Kind &kind) {
+    for (int k = 0; k < KindCount; k++) {
+        if (name.compare(GlucoseModel::name(Kind(k)), Qt::CaseInsensitive) == 0) {
+            kind = Kind(k);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // GLUCOSEMODEL_H
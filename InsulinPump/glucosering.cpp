@@ -0,0 +1,118 @@
+#include "glucosering.h"
+
+// -------------------- Glucose Ring --------------------
+const int GlucoseRing::DefaultCapacity;
+const int GlucoseRing::WriterSlack;
+
+// Readers only look at the newest maxSamples; the slack behind them is what
+// the writer can fill while a read is in progress before the read is retried
+GlucoseRing::GlucoseRing(int capacity)
+    : maxSamples(qMax(1, capacity)), slotCount(maxSamples + WriterSlack), times(slotCount), values(slotCount), written(0) {}
+
+void GlucoseRing::append(int timeStep, double glucose) {
+    const qint64 n = written.load(std::memory_order_relaxed);
+    const int slot = int(n % slotCount);
+    // pairs with the acquire fence in stillValid(): a reader that sees the
+    // new values also sees that this slot has moved on
+    std::atomic_thread_fence(std::memory_order_release);
+    times[slot].store(timeStep, std::memory_order_relaxed);
+    values[slot].store(glucose, std::memory_order_relaxed);
+    written.store(n + 1, std::memory_order_release);
+}
+
+int GlucoseRing::capacity() const {
+    return maxSamples;
+}
+
+int GlucoseRing::size() const {
+    return int(qMin<qint64>(written.load(std::memory_order_acquire), maxSamples));
+}
+
+bool GlucoseRing::latest(int &timeStep, double &glucose) const {
+    const qint64 end = written.load(std::memory_order_acquire);
+    if (end == 0) return false;
+    const int slot = int((end - 1) % slotCount);
+    timeStep = times[slot].load(std::memory_order_relaxed);
+    glucose = values[slot].load(std::memory_order_relaxed);
+    return stillValid(end - 1);
+}
+
+void GlucoseRing::decimate(int fromStep, int toStep, int columns, QVector<QPointF> &points) const {
+    columns = qMax(1, columns);
+    const double columnsPerStep = double(columns) / double(qMax(1, toStep - fromStep + 1));
+
+    int column = -1;
+    int minStep = 0, maxStep = 0;
+    double minValue = 0.0, maxValue = 0.0;
+    auto flush = [&]() {
+        if (column < 0) return;
+        if (minStep == maxStep) {
+            points.append(QPointF(minStep, minValue));
+        } else if (minStep < maxStep) {
+            points.append(QPointF(minStep, minValue));
+            points.append(QPointF(maxStep, maxValue));
+        } else {
+            points.append(QPointF(maxStep, maxValue));
+            points.append(QPointF(minStep, minValue));
+        }
+    };
+
+    for (;;) {
+        points.clear();
+        column = -1;
+        const qint64 end = written.load(std::memory_order_acquire);
+        const qint64 begin = qMax<qint64>(0, end - maxSamples);
+        qint64 lowestRead = end;
+        const qint64 first = firstAtOrAfter(begin, end, fromStep, lowestRead);
+
+        int slot = int(first % slotCount);
+        for (qint64 i = first; i < end; i++) {
+            const int t = times[slot].load(std::memory_order_relaxed);
+            if (t > toStep) break;
+            const double g = values[slot].load(std::memory_order_relaxed);
+            if (++slot == slotCount) slot = 0;
+
+            const int c = int((t - fromStep) * columnsPerStep);
+            if (c != column) {
+                flush();
+                column = c;
+                minStep = maxStep = t;
+                minValue = maxValue = g;
+            } else if (g < minValue) {
+                minValue = g;
+                minStep = t;
+            } else if (g > maxValue) {
+                maxValue = g;
+                maxStep = t;
+            }
+        }
+        flush();
+
+        if (stillValid(qMin(first, lowestRead))) return;
+        // the writer lapped us while we were reading, try again from the new tail
+    }
+}
+
+// one column per step leaves nothing to merge
+void GlucoseRing::samples(int fromStep, int toStep, QVector<QPointF> &points) const {
+    decimate(fromStep, toStep, qMax(1, toStep - fromStep + 1), points);
+}
+
+qint64 GlucoseRing::firstAtOrAfter(qint64 lo, qint64 hi, int timeStep, qint64 &lowestRead) const {
+    while (lo < hi) {
+        const qint64 mid = lo + (hi - lo) / 2;
+        lowestRead = qMin(lowestRead, mid);
+        if (times[int(mid % slotCount)].load(std::memory_order_relaxed) < timeStep) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Everything from sample firstRead on was read before the writer got to reuse its slot
+bool GlucoseRing::stillValid(qint64 firstRead) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return firstRead > written.load(std::memory_order_relaxed) - slotCount;
+}
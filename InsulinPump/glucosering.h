@@ -0,0 +1,45 @@
+#ifndef GLUCOSERING_H
+#define GLUCOSERING_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QPointF>
+#include <atomic>
+#include <vector>
+
+// -------------------- Glucose Ring --------------------
+// Fixed-capacity history of (time step, glucose) samples, oldest overwritten
+// first. One thread appends; any other thread can read without locking, a
+// read that raced with the writer wrapping around is simply retried.
+class GlucoseRing {
+public:
+    static const int DefaultCapacity = 30 * 24 * 60; // 30 days of minutes
+    static const int WriterSlack = 1024; // extra slots so readers rarely have to retry
+
+    explicit GlucoseRing(int capacity = DefaultCapacity);
+
+    void append(int timeStep, double glucose); // writer thread only
+
+    int capacity() const;
+    int size() const;
+    bool latest(int &timeStep, double &glucose) const;
+
+    // Reduces the samples between the two steps (inclusive) to at most two
+    // points per column, the min and the max in time order, so spikes survive
+    // however many samples share a pixel.
+    void decimate(int fromStep, int toStep, int columns, QVector<QPointF> &points) const;
+    // Every sample between the two steps, as (time step, glucose)
+    void samples(int fromStep, int toStep, QVector<QPointF> &points) const;
+
+private:
+    qint64 firstAtOrAfter(qint64 lo, qint64 hi, int timeStep, qint64 &lowestRead) const;
+    bool stillValid(qint64 firstRead) const;
+
+    const int maxSamples;
+    const int slotCount;
+    std::vector<std::atomic<int>> times;
+    std::vector<std::atomic<double>> values;
+    std::atomic<qint64> written; // total appended, the slot is written % slotCount
+};
+
+#endif // GLUCOSERING_H
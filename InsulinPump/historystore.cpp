@@ -0,0 +1,207 @@
+#include "historystore.h"
+#include "controliq.h"
+#include <cstring>
+
+// -------------------- History Bucket --------------------
+void HistoryBucket::add(double glucose) {
+    if (count == 0) {
+        min = max = glucose;
+    } else {
+        min = qMin(min, glucose);
+        max = qMax(max, glucose);
+    }
+    sum += glucose;
+    count++;
+    if (glucose >= ControlIQ::HypoThreshold && glucose < ControlIQ::HyperThreshold) inRange++;
+}
+
+void HistoryBucket::merge(const HistoryBucket &other) {
+    if (other.count == 0) return;
+    if (count == 0) {
+        min = other.min;
+        max = other.max;
+    } else {
+        min = qMin(min, other.min);
+        max = qMax(max, other.max);
+    }
+    sum += other.sum;
+    count += other.count;
+    inRange += other.inRange;
+}
+
+// -------------------- History Store --------------------
+const int HistoryStore::WriterSlack;
+const int HistoryStore::BucketWords;
+
+static_assert(sizeof(HistoryBucket) % sizeof(quint64) == 0, "HistoryBucket is stored as whole words");
+
+HistoryStore::HistoryStore() {
+    // how long each level is kept: a week of minutes, a month of 5 minutes,
+    // a year of hours and ten years of days
+    const int retentionDays[LevelCount] = { 7, 30, 365, 3650 };
+    for (int l = 0; l < LevelCount; l++) {
+        levels[l].minutes = levelMinutes(Level(l));
+        levels[l].capacity = retentionDays[l] * 24 * 60 / levels[l].minutes;
+        levels[l].slotCount = levels[l].capacity + WriterSlack;
+        levels[l].buckets = std::vector<Slot>(size_t(levels[l].slotCount));
+    }
+}
+
+int HistoryStore::levelMinutes(Level level) {
+    switch (level) {
+    case Minute: return 1;
+    case FiveMinutes: return 5;
+    case Hour: return 60;
+    case Day: return 24 * 60;
+    default: return 1;
+    }
+}
+
+void HistoryStore::append(int timeStep, double glucose) {
+    for (LevelRing &ring : levels) {
+        const int start = timeStep - timeStep % ring.minutes;
+        const qint64 n = ring.written.load(std::memory_order_relaxed);
+        if (n > 0 && ring.newest.start == start) {
+            ring.newest.add(glucose);
+            write(ring, n - 1, ring.newest);
+            continue;
+        }
+        ring.newest = HistoryBucket();
+        ring.newest.start = start;
+        ring.newest.add(glucose);
+        write(ring, n, ring.newest);
+        ring.written.store(n + 1, std::memory_order_release);
+    }
+}
+
+void HistoryStore::clear() {
+    for (LevelRing &ring : levels) {
+        ring.written.store(0, std::memory_order_release);
+        ring.newest = HistoryBucket();
+    }
+}
+
+int HistoryStore::latestTimeStep() const {
+    const LevelRing &ring = levels[Minute];
+    for (;;) {
+        const qint64 end = ring.written.load(std::memory_order_acquire);
+        if (end == 0) return -1;
+        bool valid = true;
+        const int start = read(ring, end - 1, valid).start;
+        if (valid) return start;
+    }
+}
+
+HistoryStore::Level HistoryStore::query(int fromStep, int toStep, int maxBuckets, QVector<HistoryBucket> &buckets) const {
+    maxBuckets = qMax(1, maxBuckets);
+    for (;;) {
+        buckets.clear();
+        bool valid = true;
+        qint64 end[LevelCount];
+        for (int l = 0; l < LevelCount; l++) end[l] = levels[l].written.load(std::memory_order_acquire);
+
+        int level = Minute;
+        for (; level < Day; level++) {
+            const LevelRing &ring = levels[level];
+            const int alignedFrom = fromStep - fromStep % ring.minutes;
+            const bool fits = (toStep - alignedFrom) / ring.minutes + 1 <= maxBuckets;
+            // a level that has already dropped the start of the range can't serve it
+            const qint64 first = oldest(ring, end[level]);
+            const bool holdsStart = first == 0 || read(ring, first, valid).start <= fromStep;
+            if (fits && holdsStart) break;
+        }
+
+        const LevelRing &ring = levels[level];
+        for (qint64 i = firstEndingAfter(ring, end[level], fromStep, valid); i < end[level]; i++) {
+            const HistoryBucket bucket = read(ring, i, valid);
+            if (bucket.start > toStep) break;
+            buckets.append(bucket);
+        }
+        if (valid) return Level(level);
+        // the writer lapped us while we were reading, try again from the new tail
+    }
+}
+
+// Walks the range with the largest aligned bucket that fits at each point, so
+// a 90 day range takes about 90 day buckets plus a few dozen at the edges.
+// Exact as long as the edges are still within the finer levels' retention.
+HistoryBucket HistoryStore::summarize(int fromStep, int toStep) const {
+    for (;;) {
+        bool valid = true;
+        qint64 end[LevelCount];
+        for (int l = 0; l < LevelCount; l++) end[l] = levels[l].written.load(std::memory_order_acquire);
+
+        HistoryBucket total;
+        total.start = fromStep;
+        // the coarser buckets below the newest minute are complete, it was appended after them
+        const int latest = end[Minute] > 0 ? read(levels[Minute], end[Minute] - 1, valid).start : -1;
+        const int last = qMin(toStep, latest);
+
+        int t = qMax(0, fromStep);
+        while (t <= last) {
+            int level = Day;
+            while (level > Minute && (t % levels[level].minutes != 0 || t + levels[level].minutes - 1 > last)) {
+                level--;
+            }
+            HistoryBucket bucket;
+            if (find(levels[level], end[level], t, bucket, valid)) total.merge(bucket);
+            t += levels[level].minutes;
+        }
+        if (valid) return total;
+    }
+}
+
+// Seqlock on the slot: the odd version is stored before the words, the even
+// one after them
+void HistoryStore::write(LevelRing &ring, qint64 index, const HistoryBucket &bucket) {
+    quint64 words[BucketWords];
+    memcpy(words, &bucket, sizeof(bucket));
+    Slot &slot = ring.buckets[size_t(index % ring.slotCount)];
+    const quint32 version = slot.version.load(std::memory_order_relaxed);
+    slot.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < BucketWords; i++) slot.words[i].store(words[i], std::memory_order_relaxed);
+    slot.version.store(version + 2, std::memory_order_release);
+}
+
+HistoryBucket HistoryStore::read(const LevelRing &ring, qint64 index, bool &valid) const {
+    const Slot &slot = ring.buckets[size_t(index % ring.slotCount)];
+    quint64 words[BucketWords];
+    for (;;) {
+        const quint32 version = slot.version.load(std::memory_order_acquire);
+        for (int i = 0; i < BucketWords; i++) words[i] = slot.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(version & 1) && slot.version.load(std::memory_order_relaxed) == version) break;
+        // caught the writer in the middle of this bucket, it is a few stores from done
+    }
+    // the slot may have moved on to a later bucket since the query started
+    valid = valid && index > ring.written.load(std::memory_order_relaxed) - ring.slotCount;
+    HistoryBucket bucket;
+    memcpy(&bucket, words, sizeof(bucket));
+    return bucket;
+}
+
+bool HistoryStore::find(const LevelRing &ring, qint64 end, int start, HistoryBucket &bucket, bool &valid) const {
+    const qint64 i = firstEndingAfter(ring, end, start, valid);
+    if (i == end) return false;
+    bucket = read(ring, i, valid);
+    return bucket.start == start;
+}
+
+// index of the first bucket that covers timeStep or comes after it
+qint64 HistoryStore::firstEndingAfter(const LevelRing &ring, qint64 end, int timeStep, bool &valid) const {
+    qint64 lo = oldest(ring, end), hi = end;
+    while (lo < hi) {
+        const qint64 mid = lo + (hi - lo) / 2;
+        if (read(ring, mid, valid).start + ring.minutes <= timeStep) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+qint64 HistoryStore::oldest(const LevelRing &ring, qint64 end) const {
+    return qMax<qint64>(0, end - ring.capacity);
+}
@@ -0,0 +1,83 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <atomic>
+#include <vector>
+
+// -------------------- History Bucket --------------------
+// Glucose summary over one aligned block of minutes
+struct HistoryBucket {
+    int start = 0;      // first time step covered
+    double min = 0.0;
+    double max = 0.0;
+    double sum = 0.0;
+    int count = 0;
+    int inRange = 0;    // samples within 3.9 <= g < 8.9
+
+    double mean() const { return count ? sum / count : 0.0; }
+    double timeInRange() const { return count ? double(inRange) / count : 0.0; } // fraction
+    void add(double glucose);
+    void merge(const HistoryBucket &other);
+};
+
+// -------------------- History Store --------------------
+// Glucose history rolled up at 1 min, 5 min, 1 h and 1 day as it arrives,
+// each level a bounded ring. A query reads a single level, the finest one
+// that fits the requested number of points, so zooming out to months costs
+// no more than looking at the last hour.
+// One thread appends (the device's, see InsulinControlSystem::updateInsulin);
+// any other thread queries without locking. The writer only ever changes
+// the newest bucket of a level, each bucket carries a version so a reader
+// retries a bucket it caught half written, and a query the writer lapped
+// starts over, like GlucoseRing.
+class HistoryStore {
+public:
+    enum Level { Minute, FiveMinutes, Hour, Day, LevelCount };
+    static const int WriterSlack = 1024; // extra buckets per level so queries rarely have to retry
+
+    HistoryStore();
+
+    // writer thread only
+    void append(int timeStep, double glucose); // time steps must not go backwards
+    void clear(); // and no reader running
+
+    static int levelMinutes(Level level);
+    int latestTimeStep() const; // -1 when empty
+
+    // Buckets overlapping [fromStep, toStep] at the finest level that still
+    // holds fromStep and needs at most maxBuckets; returns that level
+    Level query(int fromStep, int toStep, int maxBuckets, QVector<HistoryBucket> &buckets) const;
+    // Exact statistics for [fromStep, toStep], built from the largest buckets that fit
+    HistoryBucket summarize(int fromStep, int toStep) const;
+
+private:
+    static const int BucketWords = int(sizeof(HistoryBucket) / sizeof(quint64));
+
+    struct Slot {
+        std::atomic<quint32> version{0}; // odd while the writer is changing the bucket
+        std::atomic<quint64> words[BucketWords];
+    };
+
+    struct LevelRing {
+        int minutes = 1;
+        int capacity = 0;  // buckets readers can see
+        int slotCount = 0; // capacity plus the writer's slack
+        std::atomic<qint64> written{0}; // total buckets started, the newest is at (written - 1) % slotCount
+        HistoryBucket newest; // writer's copy of the bucket it is filling
+        std::vector<Slot> buckets;
+    };
+
+    void write(LevelRing &ring, qint64 index, const HistoryBucket &bucket);
+    // The readers take the ring's written count from the start of the query
+    // as 'end' and clear 'valid' if the writer lapped a bucket they read
+    HistoryBucket read(const LevelRing &ring, qint64 index, bool &valid) const;
+    bool find(const LevelRing &ring, qint64 end, int start, HistoryBucket &bucket, bool &valid) const;
+    qint64 firstEndingAfter(const LevelRing &ring, qint64 end, int timeStep, bool &valid) const;
+    qint64 oldest(const LevelRing &ring, qint64 end) const;
+
+    LevelRing levels[LevelCount];
+};
+
+#endif // HISTORYSTORE_H
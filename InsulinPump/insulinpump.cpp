@@ -1,55 +1,194 @@
 #include "insulinpump.h"
-#include <QTimer>
+#include "scenario.h"
+#include "tracerecorder.h"
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
 
 // -------------------- Device Class --------------------
 Device::Device(QObject *parent)
-    : QObject(parent), batteryLevel(100), timeStep(0), isRunning(false) {
+    : QObject(parent), batteryLevel(100), timeStep(0), isRunning(false), checkpointInterval(0), scenario(nullptr),
+      wakeQueued(false) {
     ics = new InsulinControlSystem(this);
     logger = new Logger(this);
+    clock = new SimulationClock(this);
+
+    connect(clock, &SimulationClock::advance, this, &Device::advance);
 
     connect(ics, SIGNAL(insulinDelivered(double)), this, SIGNAL(insulinInjected(double)));
-    connect(ics, SIGNAL(logEvent(QString)), this, SIGNAL(logEvent(QString)));
-    connect(ics, SIGNAL(logError(QString)), this, SIGNAL(logError(QString)));
+    ics->setEventLog(&logger->getEventLog());
+    // one snapshot per step, at the end of runDevice; changes outside a step
+    // (bolus, refill) are published by runCommands
 }
 
 void Device::setupDevice() {
-    emit logEvent(QString("------------------"));
+    log(LogRecord::Separator);
     ics->setBasalRate(1.0);
     ics->setCurrentGlucose(5.5); // mmol/L baseline
     ics->setState(InsulinControlSystem::Run);
-    emit logEvent("Device setup complete.");
+    log(LogRecord::DeviceSetup);
 }
 
 void Device::startDevice() {
-    emit logEvent(QString("------------------"));
+    log(LogRecord::Separator);
     isRunning = true;
     ics->setState(InsulinControlSystem::Run);
-    emit logEvent("Device started.");
+    log(LogRecord::DeviceStarted);
 }
 
 void Device::runDevice() {
     if (!isRunning) return;
-    emit logEvent(QString("------------------"));
-
-    timeStep++;
-    emit logEvent(QString("Time Step: %1").arg(timeStep));
+    TraceScope trace("sim", "step", "time step", timeStep + 1);
+    PUMP_PROFILE_SCOPE(Step);
+    PUMP_PROFILE_COUNT(Steps, 1);
+    bool perStepSignals = !clock->isFast();
+    {
+        PUMP_PROFILE_SCOPE(Logging);
+        log(LogRecord::Separator);
+        timeStep++;
+        log(LogRecord::TimeStep);
+    }
     ics->setTimeStep(timeStep);
+    {
+        PUMP_PROFILE_SCOPE(Events);
+        ics->runDueEvents();
+    }
     ics->updateInsulin();
 
     if (timeStep % 3 == 0) {
         batteryLevel -= 1;
         if (batteryLevel <= 0) {
             batteryLevel = 0;
+            clock->stop();
             stopDevice();
-            emit logEvent("Device automatically stopped due to depleted battery.");
-            emit logError("Device automatically stopped due to depleted battery.");
+            log(LogRecord::DeviceAutoStopped, LogRecord::Error);
             emit devicePoweredOff();
         }
-        emit batteryLevelChanged(batteryLevel); // This will trigger setBatteryLevel indirectly via UI
+        if (perStepSignals) {
+            emit batteryLevelChanged(batteryLevel); // This will trigger setBatteryLevel indirectly via UI
+            PUMP_PROFILE_COUNT(EmittedSignals, 1);
+        }
+    }
+    {
+        PUMP_PROFILE_SCOPE(Telemetry);
+        logger->logStep(timeStep, ics->getState(), ics->getLastStep(), batteryLevel);
+    }
+    if (checkpointInterval > 0 && timeStep % checkpointInterval == 0 && !saveCheckpoint(checkpointFile)) {
+        logText("Checkpoint to " + checkpointFile + " failed.", LogRecord::Error);
+    }
+    PUMP_PROFILE_SCOPE(Snapshot);
+    publishSnapshot();
+}
+
+// At the fast speeds the per-step ICS signals are held back; the GUI only
+// picks up the latest snapshot when it refreshes
+void Device::advance(int steps) {
+    TraceScope trace("sim", "advance", "steps", steps);
+    bool wasBlocked = clock->isFast() ? ics->blockSignals(true) : ics->signalsBlocked();
+    if (scenario && !scenario->finished()) {
+        runCommands();
+        scenario->run(*this, steps); // keeps time going through disconnects
+    } else {
+        for (int i = 0; i < steps; i++) {
+            if (!commands.isEmpty()) runCommands(); // between two steps
+            if (!isRunning) break;
+            runDevice();
+        }
+    }
+    ics->blockSignals(wasBlocked);
+}
+
+// While the clock runs the next step picks the command up anyway; the
+// queued call covers an idle device, at most one on its way at a time
+bool Device::post(const PumpCommand &command) {
+    if (!commands.push(command)) return false;
+    if (!wakeQueued.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, &Device::runCommands, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void Device::runCommands() {
+    // cleared first, so a command posted while draining queues a new call
+    wakeQueued.store(false, std::memory_order_release);
+    PumpCommand command;
+    bool applied = false;
+    while (commands.take(command)) {
+        apply(command);
+        applied = true;
+    }
+    if (applied) publishSnapshot(); // the GUI sees the change even with the clock stopped
+}
+
+// The calls the GUI made on the device, now made on the device's thread
+void Device::apply(const PumpCommand &c) {
+    const double *v = c.values;
+    switch (c.kind) {
+    case PumpCommand::PowerOn:
+        startDevice();
+        clock->start(); // speed picked in the GUI
+        break;
+    case PumpCommand::PowerOff:
+        clock->stop();
+        stopDevice();
+        break;
+    case PumpCommand::Occlusion:
+    case PumpCommand::Disconnect:
+        TraceRecorder::instant("device", c.kind == PumpCommand::Occlusion ? "occlusion" : "disconnect");
+        clock->stop();
+        stopDevice();
+        break;
+    case PumpCommand::ResolveOcclusion:
+    case PumpCommand::Reconnect:
+        TraceRecorder::instant("device", c.kind == PumpCommand::ResolveOcclusion ? "occlusion resolved" : "reconnect");
+        startDevice();
+        clock->start();
+        break;
+    case PumpCommand::StartClock: clock->start(); break;
+    case PumpCommand::Pause: ics->setState(InsulinControlSystem::Pause); break;
+    case PumpCommand::Resume: ics->setState(InsulinControlSystem::Resume); break;
+    case PumpCommand::ApplyProfile: applyProfile(v[0], v[1], int(v[2]), v[3]); break;
+    case PumpCommand::Bolus: ics->calculateBolus(v[0], v[1], v[2], v[3]); break;
+    case PumpCommand::Refill: refillCartridge(); break;
+    case PumpCommand::Charge: chargeBattery(); break;
+    case PumpCommand::SetBattery: setBatteryLevel(int(v[0])); break;
+    case PumpCommand::SetCartridge: ics->depleteCartridge(ics->getCartridgeLevel() - v[0]); break;
+    case PumpCommand::SetSpeed: clock->setSpeed(SimulationClock::Speed(int(v[0]))); break;
+    case PumpCommand::Log: logger->getEventLog().appendText(timeStep, c.text, LogRecord::Severity(int(v[0]))); break;
     }
 }
 
+SimulationClock *Device::getClock() const {
+    return clock;
+}
+
+void Device::publishSnapshot() {
+    const PumpState &state = ics->getState();
+    PumpSnapshot snapshot;
+    snapshot.timeStep = timeStep;
+    snapshot.currentGlucose = state.currentGlucose;
+    snapshot.insulinOnBoard = state.insulinOnBoard;
+    snapshot.cartLevel = state.cartLevel;
+    snapshot.basalRate = state.basalRate;
+    snapshot.batteryLevel = batteryLevel;
+    snapshot.currentState = state.currentState;
+    snapshots.publish(snapshot);
+}
+
+bool Device::takeSnapshot(PumpSnapshot &snapshot) {
+    return snapshots.take(snapshot);
+}
+
+const GlucoseRing &Device::getGlucoseHistory() const {
+    return ics->getGlucoseHistory();
+}
+
+const HistoryStore &Device::getHistory() const {
+    return ics->getHistory();
+}
+
 void Device::applyProfile(double pbasalRate, double correctionFactor, int carbRatio, double targetGlucose) {
+    TraceScope trace("sim", "apply profile", "basal rate", pbasalRate);
     if (ics) {
         ics->setProfileBasalRate(pbasalRate);
         ics->setCorrectionFactor(correctionFactor);
@@ -61,39 +200,118 @@ void Device::applyProfile(double pbasalRate, double correctionFactor, int carbRa
 void Device::stopDevice() {
     isRunning = false;
     ics->setState(InsulinControlSystem::Stop);
-    emit logEvent(QString("------------------"));
-    emit logEvent("Device stopped.");
-    emit logError("Device stopped.");
+    log(LogRecord::Separator);
+    log(LogRecord::DeviceStopped, LogRecord::Error);
 }
 
 void Device::chargeBattery() {
     batteryLevel = 100;
     emit batteryLevelChanged(batteryLevel);
-    emit logEvent("Battery charged to 100%.");
+    log(LogRecord::BatteryCharged);
 }
 
 void Device::depleteBattery() {
     batteryLevel = 0;
     emit batteryLevelChanged(batteryLevel);
-    emit logEvent("Battery depleted.");
-    emit logError("Battery depleted.");
+    log(LogRecord::BatteryDepleted, LogRecord::Error);
 }
 
 void Device::setBatteryLevel(int level) {
     batteryLevel = qBound(0, level, 100);
     if (batteryLevel == 10) {
-        emit logEvent("WARNING: Battery level low (10%).");
-        emit logError("WARNING: Battery level low (10%).");
+        log(LogRecord::BatteryLow, LogRecord::Error);
     }
     emit batteryLevelChanged(batteryLevel);
 }
 
+void Device::log(LogRecord::Kind kind, LogRecord::Severity severity) {
+    logger->getEventLog().append(timeStep, kind, severity);
+}
+
+void Device::logText(const QString &text, LogRecord::Severity severity) {
+    logger->getEventLog().appendText(timeStep, text, severity);
+}
+
+EventLog &Device::getEventLog() {
+    return logger->getEventLog();
+}
+
+Logger *Device::getLogger() const {
+    return logger;
+}
+
 int Device::getBatteryLevel() const {
     return batteryLevel;
 }
 
 double InsulinControlSystem::getCartridgeLevel() const {
-    return cartLevel;
+    return pump.cartLevel;
+}
+
+void Device::setNoiseSeed(quint64 seed) {
+    ics->setNoiseSeed(seed);
+}
+
+void Device::setGlucoseModel(GlucoseModel::Kind model) {
+    ics->setGlucoseModel(model);
+}
+
+void Device::scheduleEvent(const SimEvent &event) {
+    ics->scheduleEvent(event);
+}
+
+bool Device::isDeviceRunning() const {
+    return isRunning;
+}
+
+void Device::checkpoint(PumpCheckpoint &checkpoint) const {
+    checkpoint.timeStep = timeStep;
+    checkpoint.batteryLevel = batteryLevel;
+    checkpoint.running = isRunning;
+    checkpoint.pump = ics->getState();
+    checkpoint.noiseSeed = ics->getNoiseSource().getSeed();
+    checkpoint.noiseStream = ics->getNoiseSource().getStream();
+    // copied into the checkpoint's own storage, so taking one every so often
+    // into the same PumpCheckpoint doesn't allocate once it has grown; the
+    // heap's order isn't scheduling order, the sequence numbers are
+    const QVector<SimEvent> &pending = ics->getEventQueue().pending();
+    checkpoint.events.resize(pending.size());
+    std::copy(pending.cbegin(), pending.cend(), checkpoint.events.begin());
+    std::sort(checkpoint.events.begin(), checkpoint.events.end(),
+              [](const SimEvent &a, const SimEvent &b) { return a.sequence < b.sequence; });
+}
+
+void Device::restore(const PumpCheckpoint &checkpoint) {
+    timeStep = checkpoint.timeStep;
+    batteryLevel = checkpoint.batteryLevel;
+    isRunning = checkpoint.running;
+    ics->setNoiseSource(PhiloxRng(checkpoint.noiseSeed, checkpoint.noiseStream));
+    ics->restore(checkpoint.pump, checkpoint.events);
+    emit batteryLevelChanged(batteryLevel);
+    publishSnapshot();
+}
+
+bool Device::saveCheckpoint(const QString &fileName) {
+    PumpCheckpoint c;
+    checkpoint(c);
+    return c.save(fileName);
+}
+
+bool Device::restoreCheckpoint(const QString &fileName) {
+    PumpCheckpoint c;
+    if (!c.load(fileName)) return false;
+    restore(c);
+    logText(QString("Resumed from checkpoint at time step %1.").arg(timeStep));
+    return true;
+}
+
+void Device::setScenario(ScenarioDriver *driver) {
+    scenario = driver;
+}
+
+void Device::setCheckpointFile(const QString &fileName, int intervalMinutes) {
+    checkpointFile = fileName;
+    checkpointInterval = qMax(0, intervalMinutes);
 }
 
 void Device::refillCartridge() {
@@ -104,257 +322,343 @@ void Device::refillCartridge() {
 
 // -------------------- InsulinControlSystem --------------------
 InsulinControlSystem::InsulinControlSystem(QObject *parent)
-    : QObject(parent), basalRate(1.0), correctionFactor(1.0), carbRatio(1), targetGlucose(5.0), currentGlucose(5.5), insulinOnBoard(0.0), cartLevel(300.00), currentState(Run), profileBasalRate(0.0){}
+    : QObject(parent), glucoseTrace(nullptr), traceCursor(0), noise(QRandomGenerator::global()->generate64()), eventLog(nullptr) {}
+
+void InsulinControlSystem::setEventLog(EventLog *log) {
+    eventLog = log;
+}
+
+void InsulinControlSystem::log(LogRecord::Kind kind, LogRecord::Severity severity,
+                               double a, double b, double c, double d, double e) {
+    if (eventLog) eventLog->append(pump.timeStep, kind, severity, a, b, c, d, e);
+}
 
 void InsulinControlSystem::setState(State state) {
-    currentState = state;
-    emit logEvent("State changed.");
+    static const char *const stateNames[] = { "run", "stop", "pause", "resume" };
+    TraceRecorder::instant("sim", stateNames[state]);
+    pump.currentState = PumpState::Mode(state);
+    log(LogRecord::StateChanged);
 }
 
 void InsulinControlSystem::setBasalRate(double rate) {
-    basalRate = rate;
-    emit logEvent(QString("Basal rate set to %1").arg(rate));
+    pump.basalRate = rate;
+    log(LogRecord::BasalRateSet, LogRecord::Event, rate);
 }
 
 void InsulinControlSystem::setProfileBasalRate(double rate) {
-    profileBasalRate = rate;
-    emit logEvent(QString("Profile basal rate set to %1").arg(rate));
+    pump.profileBasalRate = rate;
+    log(LogRecord::ProfileBasalRateSet, LogRecord::Event, rate);
 }
 
 double InsulinControlSystem::getCorrectionFactor() const {
-    return correctionFactor;
+    return pump.correctionFactor;
 }
 
 void InsulinControlSystem::setCorrectionFactor(double factor){
-    correctionFactor = factor;
-    emit logEvent(QString("Correction Factor set to %1").arg(factor));
+    pump.correctionFactor = factor;
+    log(LogRecord::CorrectionFactorSet, LogRecord::Event, factor);
 }
 
 double InsulinControlSystem::getCarbRatio() const {
-    return carbRatio;
+    return pump.carbRatio;
 }
 
 void InsulinControlSystem::setCarbRatio(int carb){
-    carbRatio = carb;
-    emit logEvent(QString("Carb Ratio set to %1").arg(carb));
+    pump.carbRatio = carb;
+    log(LogRecord::CarbRatioSet, LogRecord::Event, carb);
 }
 
 double InsulinControlSystem::getTargetGlucose() const{
-    return targetGlucose;
+    return pump.targetGlucose;
 }
 
 void InsulinControlSystem::setTargetGlucose(double level){
-    targetGlucose = level;
-    emit logEvent(QString("Target Glucose set to %1").arg(level));
+    pump.targetGlucose = level;
+    log(LogRecord::TargetGlucoseSet, LogRecord::Event, level);
 }
 
 void InsulinControlSystem::setCurrentGlucose(double level) {
-    currentGlucose = level;
-    emit glucoseChanged(currentGlucose);
+    pump.currentGlucose = level;
+    emit glucoseChanged(pump.currentGlucose);
+}
+
+double InsulinControlSystem::getCurrentGlucose() const {
+    return pump.currentGlucose;
+}
+
+const PumpState &InsulinControlSystem::getState() const {
+    return pump;
+}
+
+const StepResult &InsulinControlSystem::getLastStep() const {
+    return lastStep;
 }
 
 // for anything time related, ics has an udpated timestep
 void InsulinControlSystem:: setTimeStep(int ts){
-    timeStep = ts;
+    pump.timeStep = ts;
 }
 
 double InsulinControlSystem::getInsulinOnBoard() const {
-    return insulinOnBoard;
+    return pump.insulinOnBoard;
 }
 
-void InsulinControlSystem::updateInsulin() {
-    // by ICS logic, each time step is a minute
-    double basalEffect = 0;
-
-    if (currentState == Stop) return;
-    if (currentState == Pause){
-        setBasalRate(0);
-    } else if (currentState == Resume){
-        currentState = Run;
-        setBasalRate(profileBasalRate);
-    }
-
-    // Adjust active basal rate based on profile basal rate
-    if (currentState != Pause){
-        // Simulate effect of basal insulin delivery
-        // Calculate basal effect as 1/10th basal rate for simultation reasons
-        basalEffect = basalRate * 0.1;
-        insulinOnBoard += basalEffect;
-
-        currentGlucose -= 0.1 * basalRate;
-    } else if (currentState == Pause){
-        // Increase the blood glucose since insulin stops
-        currentGlucose += 0.05;
-    }
-
-    // Add random fluctuations to prevent stabilization
-    double noiseFactor = QRandomGenerator::global()->generateDouble() * 0.2 - 0.1;
-    currentGlucose += noiseFactor;
+// each pump has its own noise stream, seeding it makes a run repeatable (e.g. against PumpEngine)
+void InsulinControlSystem::setNoiseSeed(quint64 seed) {
+    noise.seed(seed);
+}
 
+void InsulinControlSystem::setNoiseSource(const PhiloxRng &rng) {
+    noise = rng;
+}
 
-    // Ensure values remain stable and avoid floating-point errors
-    // problematic logic - may keep numbers stuck
-    currentGlucose = qRound(currentGlucose * 100) / 100.0;
-    cartLevel -= basalEffect;
-    basalEffect = qRound(basalEffect * 100) / 100.0;
+const PhiloxRng &InsulinControlSystem::getNoiseSource() const {
+    return noise;
+}
 
-    // insulin is absorbed 2% per minute
-    insulinOnBoard *= 0.98;
+void InsulinControlSystem::setGlucoseTrace(const CgmTrace *trace) {
+    glucoseTrace = trace;
+    traceCursor = 0;
+}
 
-    // calculate hours remaining for IOB
-    double remainingTimeHours;
+void InsulinControlSystem::setGlucoseModel(GlucoseModel::Kind model) {
+    pump.glucoseModel = model;
+    pump.physiology = GlucoseModelState();
+}
 
-    // remaining time for consuming insulin on board
-    if (insulinOnBoard > 0.01){
-        double remainingTimeMinutes = log(100 / insulinOnBoard) / log(1.02); // Using a decay formula
-        remainingTimeHours= remainingTimeMinutes / 60.0;  // Convert minutes to hours
-    } else{
-        insulinOnBoard = 0.0;
-        remainingTimeHours = 0.0;
+void InsulinControlSystem::updateInsulin() {
+    if (pump.currentState == PumpState::Stop) {
+        lastStep = StepResult();
+        return;
     }
 
-    // Predict glucose trend 30 minutes ahead
-    double predictedGlu = currentGlucose - (insulinOnBoard * 0.1667);
-    // Small random fluctuation
-    predictedGlu += QRandomGenerator::global()->generateDouble() * 0.2 - 0.1;
-    predictedGlu = qRound(predictedGlu * 100) / 100.0;
-
-    // Adjust insulin delivery based on Control-IQ technology rules
-    if (predictedGlu <= targetGlucose-0.1) {
-        basalRate = 0.0;  // Suspend insulin if glucose is too low
-    } else if (predictedGlu <= targetGlucose+0.03) {
-        basalRate = qMax(basalRate * 0.5, 0.1);  // Reduce basal insulin when predict glucose is in the range of target glucose
-    } else if (predictedGlu >= targetGlucose+0.5) {
-        double maxBasalRate = 2.0;
-        basalRate = qMin(basalRate * 1.2, maxBasalRate);  // Increase insulin
+    // the control logic itself lives in ControlIQ::step, this just reports it
+    double glucoseNoise, predictionNoise, reading;
+    {
+        PUMP_PROFILE_SCOPE(Noise);
+        noise.noiseAt(pump.timeStep, glucoseNoise, predictionNoise);
+    }
+    if (glucoseTrace && glucoseTrace->glucoseAt(pump.timeStep, reading, traceCursor)) {
+        lastStep = ControlIQ::sensorStep(pump, reading, predictionNoise);
+    } else {
+        lastStep = ControlIQ::step(pump, glucoseNoise, predictionNoise);
     }
+    const StepResult &r = lastStep;
+    PUMP_PROFILE_COUNT(Hypo, r.hypo);
+    PUMP_PROFILE_COUNT(Hyper, r.hyper);
+
+    {
+        PUMP_PROFILE_SCOPE(Logging);
+        if (r.pausedBasal || r.resumedBasal) {
+            log(LogRecord::BasalRateSet, LogRecord::Event, pump.basalRate);
+        }
+
+        if (r.hypo){
+            log(LogRecord::Hypoglycemic, LogRecord::Error);
+        } else if(r.hyper){
+            log(LogRecord::Hyperglycemic, LogRecord::Error);
+        }
 
-    if (currentGlucose < 3.9){
-        emit logEvent("User is hypoglycemic");
-        emit logError("User is hypoglycemic");
-    } else if(currentGlucose >= 8.9){
-        emit logEvent("User is hyperglycemic");
-        emit logError("User is hyperglycemic");
+        glucoseHistory.append(pump.timeStep, pump.currentGlucose);
+        history.append(pump.timeStep, pump.currentGlucose);
+        log(LogRecord::BasalDelivered, LogRecord::Event, r.basalEffect, pump.currentGlucose, r.predictedGlucose);
     }
 
-    emit addPointy(timeStep,currentGlucose);
+    PUMP_PROFILE_SCOPE(Signals);
+    PUMP_PROFILE_COUNT(EmittedSignals, 5);
+    emit addPointy(pump.timeStep, pump.currentGlucose);
     // Emit updated values - gui dependent - change as needed
-    emit IOBChanged(insulinOnBoard, remainingTimeHours);
-    emit insulinDelivered(basalEffect);
-    emit glucoseChanged(currentGlucose);
-    emit cartChanged(cartLevel);
-    emit logEvent(QString("Basal insulin delivered: %1 | Glucose: %2 | Predicted: %3")
-                  .arg(basalEffect).arg(currentGlucose).arg(predictedGlu));
+    emit IOBChanged(pump.insulinOnBoard, ControlIQ::iobHoursRemaining(pump.insulinOnBoard));
+    emit insulinDelivered(r.basalEffect);
+    emit glucoseChanged(pump.currentGlucose);
+    emit cartChanged(pump.cartLevel);
 }
 
 void InsulinControlSystem::calculateBolus(double carbInput, double glucoseInput, double bolusDurationHour, double bolusDurationMin) {
     // Overwrite blood glucose using user input
     setCurrentGlucose(glucoseInput);
 
-    double bolusDuration = bolusDurationHour + (bolusDurationMin / 60.0);
-
     // Bolus Calculation Logic
-    double carbBolus = carbInput / carbRatio;
-    double correctionBolus = glucoseInput > targetGlucose ? (glucoseInput - targetGlucose) / correctionFactor: 0;
-    double totalBolus = carbBolus + correctionBolus;
-    double finalBolus = totalBolus > insulinOnBoard ? totalBolus - insulinOnBoard : 0;
-    double correctionPortion = correctionBolus > insulinOnBoard ? correctionBolus - insulinOnBoard : 0;
+    BolusPlan b = ControlIQ::planBolus(pump, carbInput, glucoseInput, bolusDurationHour, bolusDurationMin);
 
-    emit logEvent(QString("Carb Value: %1, Carb Ratio: %2, Glucose Input: %3, TargetBGL %4, Correction Factor: %5, IOB: %6 | "
-                          "Total Bolus: %7, Final Bolus: %8, Correction Portion: %9")
-                          .arg(carbInput).arg(carbRatio).arg(glucoseInput).arg(targetGlucose).arg(correctionFactor)
-                          .arg(insulinOnBoard).arg(totalBolus).arg(finalBolus).arg(correctionPortion));
+    log(LogRecord::BolusInputs, LogRecord::Event, carbInput, pump.carbRatio, glucoseInput, pump.targetGlucose, pump.correctionFactor);
+    log(LogRecord::BolusTotals, LogRecord::Event, pump.insulinOnBoard, b.totalBolus, b.finalBolus, b.correctionPortion);
 
-    // Immediate and Extended Bolus (60% Immediate, 40% Extended over duration)
-    double immediateFraction = 0.6;
-    double immediateBolus = immediateFraction * finalBolus;
-    double extendedBolus = (1 - immediateFraction) * finalBolus;
-    double bolusPerHour = extendedBolus / bolusDuration;
+    ControlIQ::addCarbs(pump, carbInput);
+    simulateBolus(b.immediateBolus, b.immediateCorrection);
+    scheduleExtendedBolus(b.bolusPerHour, b.correctionPerHour, b.hours);
 
-    // Only apply correction bolus on glucose
-    double immediateCorrection = 0.6 * correctionPortion;
-    double correctionPerHour = (correctionPortion - immediateCorrection) / bolusDuration;
-
-    simulateBolus(immediateBolus, immediateCorrection);
-    scheduleExtendedBolus(bolusPerHour, correctionPerHour, bolusDuration);
-
-    emit logEvent(QString("Immediate Bolus: %1 units | Extended: %2 units over 3 hrs")
-                  .arg(immediateBolus, 0, 'f', 2)
-                  .arg(extendedBolus, 0, 'f', 2));
+    log(LogRecord::BolusPlanned, LogRecord::Event, b.immediateBolus, b.extendedBolus);
 
 }
 
 void InsulinControlSystem::simulateBolus(double bolus, double correctionOnly) {
     // Simulate bolus effect
-    insulinOnBoard += bolus;
-
-    double glucoseDrop = correctionOnly * correctionFactor;
-    // Apply only the correction effect on glucose
-    currentGlucose = currentGlucose > glucoseDrop
-                         ? currentGlucose - glucoseDrop
-                         : 0;
+    ControlIQ::applyBolus(pump, bolus, correctionOnly);
     depleteCartridge(bolus);
 
-    emit glucoseChanged(currentGlucose);
-    emit logEvent(QString("Bolus injected: %1 | Glucose: %2").arg(bolus).arg(currentGlucose));
+    emit glucoseChanged(pump.currentGlucose);
+    log(LogRecord::BolusInjected, LogRecord::Event, bolus, pump.currentGlucose);
 }
 
+// first delivery an hour from now, then hourly on the simulated clock
 void InsulinControlSystem::scheduleExtendedBolus(double bolusPerHour, double correctioPerHour, int hours) {
-    QTimer* timer = new QTimer(this);
-    int* deliveryCount = new int(0);  // use heap to persist in lambda
+    if (hours <= 0) return;
+    TraceRecorder::instant("sim", "schedule extended bolus", "hours", hours);
+    events.schedule(SimEvent::extendedBolus(pump.timeStep + 60, bolusPerHour, correctioPerHour, hours));
+}
 
-    connect(timer, &QTimer::timeout, this, [=]() mutable {
-        if(currentState  == Pause) {
-            return;
-        }
+void InsulinControlSystem::scheduleEvent(const SimEvent &event) {
+    events.schedule(event);
+}
 
-        if (*deliveryCount >= hours) {
-            timer->stop();
-            timer->deleteLater();
-            delete deliveryCount;
-        } else {
-            simulateBolus(bolusPerHour, correctioPerHour);
-            (*deliveryCount)++;
+void InsulinControlSystem::restore(const PumpState &state, const QVector<SimEvent> &scheduled) {
+    pump = state;
+    lastStep = StepResult();
+    events.clear();
+    for (const SimEvent &e : scheduled) {
+        events.schedule(e); // gets a fresh sequence number, same relative order
+    }
+    emit IOBChanged(pump.insulinOnBoard, ControlIQ::iobHoursRemaining(pump.insulinOnBoard));
+    emit glucoseChanged(pump.currentGlucose);
+    emit cartChanged(pump.cartLevel);
+}
+
+void InsulinControlSystem::runDueEvents() {
+    SimEvent e;
+    while (events.takeDue(pump.timeStep, e)) {
+        PUMP_PROFILE_COUNT(DueEvents, 1);
+        switch (e.kind) {
+        case SimEvent::ExtendedBolus:
+            // a paused pump skips the delivery without using it up
+            if (pump.currentState != PumpState::Pause) {
+                TraceScope trace("sim", "extended bolus", "units", e.values[0]);
+                simulateBolus(e.values[0], e.values[1]);
+                e.remaining--;
+            } else {
+                TraceRecorder::instant("sim", "extended bolus skipped", "units", e.values[0]);
+            }
+            if (e.remaining > 0) {
+                e.due += 60;
+                events.schedule(e);
+            }
+            break;
+        case SimEvent::ProfileSwitch: {
+            TraceScope trace("sim", "profile switch", "basal rate", e.values[0]);
+            setProfileBasalRate(e.values[0]);
+            setCorrectionFactor(e.values[1]);
+            setCarbRatio(int(e.values[2]));
+            setTargetGlucose(e.values[3]);
+            break;
         }
-    });
+        case SimEvent::PauseInsulin:
+            if (pump.currentState != PumpState::Stop) setState(Pause);
+            break;
+        case SimEvent::ResumeInsulin:
+            if (pump.currentState != PumpState::Stop) setState(Resume);
+            break;
+        }
+    }
+}
 
-    timer->start(3600000); // every 1 hour
+const SimEventQueue &InsulinControlSystem::getEventQueue() const {
+    return events;
+}
+
+const GlucoseRing &InsulinControlSystem::getGlucoseHistory() const {
+    return glucoseHistory;
+}
+
+const HistoryStore &InsulinControlSystem::getHistory() const {
+    return history;
 }
 
 void InsulinControlSystem::refillCartridge() {
-    cartLevel = 300.0;
-    emit cartChanged(cartLevel);
+    pump.cartLevel = 300.0;
+    emit cartChanged(pump.cartLevel);
 }
 
 void InsulinControlSystem::depleteCartridge(double amount) {
-    cartLevel = qMax(0.0, cartLevel - amount);
-    emit cartChanged(cartLevel);
+    pump.cartLevel = qMax(0.0, pump.cartLevel - amount);
+    emit cartChanged(pump.cartLevel);
     
     // Check for low insulin warning threshold (30 units)
-    if (cartLevel == 30.0) {
-        emit logEvent("WARNING: Insulin level low (30 units).");
-        emit logError("WARNING: Insulin level low (30 units).");
+    if (pump.cartLevel == 30.0) {
+        log(LogRecord::CartridgeLow, LogRecord::Error);
     }
     
-    if (cartLevel == 0) {
-        emit logEvent("Cartridge is empty.");
-        emit logError("Cartridge is empty.");
+    if (pump.cartLevel == 0) {
+        log(LogRecord::CartridgeEmpty, LogRecord::Error);
     }
 }
 
 // -------------------- Logger --------------------
 Logger::Logger(QObject *parent) : QObject(parent) {}
 
-void Logger::logBasalRate(double rate) {
-    eventLog.append(QString("Basal rate: %1").arg(rate));
+void Logger::logBasalRate(double rate, int timeStep) {
+    eventLog.append(timeStep, LogRecord::LoggedBasalRate, LogRecord::Event, rate);
 }
 
-void Logger::logBolus(double amount) {
-    eventLog.append(QString("Bolus: %1").arg(amount));
+void Logger::logBolus(double amount, int timeStep) {
+    eventLog.append(timeStep, LogRecord::LoggedBolus, LogRecord::Event, amount);
 }
 
+// records are only turned into text here and in exportLog
 void Logger::printToConsole() {
-    for (const QString &event : eventLog) {
-        qDebug() << event;
+    QVector<LogRecord> records;
+    for (qint64 next = eventLog.begin(); next < eventLog.end(); next += records.size()) {
+        next = eventLog.read(next, 4096, records);
+        for (const LogRecord &r : records) {
+            qDebug() << eventLog.format(r);
+        }
     }
 }
+
+// one line per record: time step, EVENT or ERROR, text
+bool Logger::exportLog(const QString &fileName) const {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+    QTextStream out(&file);
+    QVector<LogRecord> records;
+    for (qint64 next = eventLog.begin(); next < eventLog.end(); next += records.size()) {
+        next = eventLog.read(next, 4096, records);
+        for (const LogRecord &r : records) {
+            out << r.timeStep << '\t' << (r.severity == LogRecord::Error ? "ERROR" : "EVENT") << '\t'
+                << eventLog.format(r) << '\n';
+        }
+    }
+    return out.status() == QTextStream::Ok;
+}
+
+EventLog &Logger::getEventLog() {
+    return eventLog;
+}
+
+bool Logger::openTelemetry(const QString &fileName) {
+    return telemetry.open(fileName);
+}
+
+void Logger::closeTelemetry() {
+    telemetry.close();
+}
+
+const TelemetryFile &Logger::getTelemetry() const {
+    return telemetry;
+}
+
+// written straight into the mapped file, nothing is kept in memory
+void Logger::logStep(int timeStep, const PumpState &state, const StepResult &step, int batteryLevel) {
+    if (!telemetry.isWritable()) return;
+    TelemetryRow row;
+    row.timeStep = timeStep;
+    row.glucose = state.currentGlucose;
+    row.predictedGlucose = step.predictedGlucose;
+    row.insulinOnBoard = state.insulinOnBoard;
+    row.basalRate = state.basalRate;
+    row.delivered = step.basalEffect;
+    row.cartLevel = state.cartLevel;
+    row.batteryLevel = batteryLevel;
+    row.state = state.currentState;
+    telemetry.append(row);
+}
@@ -7,8 +7,25 @@
 #include <QDebug>
 #include <QString>
 #include <QtCore/QRandomGenerator>
+#include "controliq.h"
+#include "philoxrng.h"
+#include "simeventqueue.h"
+#include "simulationclock.h"
+#include "snapshotmailbox.h"
+#include "glucosering.h"
+#include "historystore.h"
+#include "eventlog.h"
+#include "telemetryfile.h"
+#include "checkpoint.h"
+#include "cgmtrace.h"
+#include "commandqueue.h"
+#include <atomic>
 
 // -------------------- Device Class --------------------
+// The GUI runs it on its own thread (MainWindow::startSimulation). Once that
+// thread runs, other threads only post() commands, take snapshots and read
+// the glucose history and the event log; every other call is for the
+// device's thread, or for setup before the thread starts.
 class Device : public QObject {
     Q_OBJECT
 
@@ -16,31 +33,62 @@ public:
     explicit Device(QObject *parent = nullptr);
     void setupDevice();
     void startDevice();
-    void runDevice();
+    void runDevice(); // one simulated minute, allocation free once running (see the benchmarks)
     void stopDevice();
     void chargeBattery();
     void depleteBattery();
     void refillCartridge();
     void setBatteryLevel(int level);
     int getBatteryLevel() const;
+    void setNoiseSeed(quint64 seed);
+    void setGlucoseModel(GlucoseModel::Kind model);
+    void scheduleEvent(const SimEvent &event); // due in simulated minutes
+    SimulationClock *getClock() const;
+    bool takeSnapshot(PumpSnapshot &snapshot); // newest state for the GUI, false if unchanged
+    const GlucoseRing &getGlucoseHistory() const;
+    const HistoryStore &getHistory() const; // roll-ups of every step, for any thread
+    void logText(const QString &text, LogRecord::Severity severity = LogRecord::Event);
+    EventLog &getEventLog();
+    class Logger *getLogger() const;
+    bool isDeviceRunning() const;
+    void checkpoint(PumpCheckpoint &checkpoint) const;
+    void restore(const PumpCheckpoint &checkpoint);
+    bool saveCheckpoint(const QString &fileName);
+    bool restoreCheckpoint(const QString &fileName);
+    void setCheckpointFile(const QString &fileName, int intervalMinutes); // interval 0 turns it off
+    void setScenario(class ScenarioDriver *driver); // replaces manual input while set, not owned
+    // Any thread. Applied on the device's thread before its next step, or
+    // right away if it's idle; false if the queue is full.
+    bool post(const PumpCommand &command);
 
 public slots:
     void applyProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
+    void advance(int steps); // driven by the clock
+    void publishSnapshot();
+    void runCommands(); // applies everything posted so far
 
 signals:
     void batteryLevelChanged(int level);
     void insulinInjected(double amount);
-    void logEvent(const QString &event);
-    void logError(const QString &event);
     void devicePoweredOff(); // New signal for battery depletion power off
 
 private:
+    void log(LogRecord::Kind kind, LogRecord::Severity severity = LogRecord::Event);
+    void apply(const PumpCommand &command);
+
     int batteryLevel; // 0-100%
     int timeStep;
     bool isRunning;
 
     class InsulinControlSystem *ics;
     class Logger *logger;
+    SimulationClock *clock;
+    SnapshotMailbox snapshots;
+    QString checkpointFile;
+    int checkpointInterval; // simulated minutes, 0 = off
+    class ScenarioDriver *scenario;
+    CommandQueue commands;
+    std::atomic<bool> wakeQueued; // a runCommands call is on its way to the device's thread
 };
 
 // -------------------- Insulin Control System --------------------
@@ -49,7 +97,7 @@ class InsulinControlSystem : public QObject {
 
 public:
     //enum Mode { Normal, Morning, Sleep, Exercise };
-    enum State { Run, Stop, Pause, Resume };
+    enum State { Run = PumpState::Run, Stop = PumpState::Stop, Pause = PumpState::Pause, Resume = PumpState::Resume };
 
     explicit InsulinControlSystem(QObject *parent = nullptr);
 
@@ -59,6 +107,9 @@ public:
     double getTargetGlucose() const;
     double getInsulinOnBoard() const;
     double getCartridgeLevel() const;
+    double getCurrentGlucose() const;
+    const PumpState &getState() const;
+    const StepResult &getLastStep() const; // outcome of the latest updateInsulin
 
     void setState(State state);
     void setBasalRate(double rate);
@@ -73,28 +124,39 @@ public:
     void setTimeStep(int ts);
     void refillCartridge();
     void depleteCartridge(double amount);
+    void setNoiseSeed(quint64 seed);
+    void setNoiseSource(const PhiloxRng &rng);
+    const PhiloxRng &getNoiseSource() const;
+    void setGlucoseTrace(const CgmTrace *trace); // recorded readings replace the glucose model, not owned
+    void setGlucoseModel(GlucoseModel::Kind model); // the model's own state starts over
+    void scheduleEvent(const SimEvent &event);
+    void runDueEvents(); // applies everything due at the current time step
+    const SimEventQueue &getEventQueue() const;
+    void restore(const PumpState &state, const QVector<SimEvent> &scheduled); // replaces state and queue
+    const GlucoseRing &getGlucoseHistory() const;
+    const HistoryStore &getHistory() const;
+    void setEventLog(EventLog *log); // shared with the Device, see Logger
 
 signals:
     void insulinDelivered(double amount);
     void glucoseChanged(double level);
     void cartChanged(double level);
     void IOBChanged(double amount, double hours);
-    void logEvent(const QString &event);
-    void logError(const QString &event);
     void addPointy(int t, double g);
 
 private:
-    int timeStep;
-    double basalRate;
-    double profileBasalRate;
-    double correctionFactor;
-    int carbRatio;
-    double targetGlucose;
-    double currentGlucose;
-    double insulinOnBoard;
-    double cartLevel;
-    State currentState;
-
+    void log(LogRecord::Kind kind, LogRecord::Severity severity = LogRecord::Event,
+             double a = 0.0, double b = 0.0, double c = 0.0, double d = 0.0, double e = 0.0);
+
+    PumpState pump;
+    StepResult lastStep;
+    const CgmTrace *glucoseTrace;
+    qint64 traceCursor; // this pump's place in glucoseTrace
+    PhiloxRng noise; // per pump, keyed by time step so any step can be replayed
+    SimEventQueue events; // extended boluses and scheduled profile/state changes
+    GlucoseRing glucoseHistory; // every addPointy sample, bounded
+    HistoryStore history; // the same samples rolled up, so no reader has to keep up with the ring
+    EventLog *eventLog;
 };
 
 // -------------------- Logger --------------------
@@ -104,13 +166,21 @@ class Logger : public QObject {
 public:
     explicit Logger(QObject *parent = nullptr);
 
-    void logBasalRate(double rate);
-    void logBolus(double amount);
+    void logBasalRate(double rate, int timeStep = 0);
+    void logBolus(double amount, int timeStep = 0);
     //void logCorrectionFactor(double factor);
     void printToConsole();
+    bool exportLog(const QString &fileName) const;
+    EventLog &getEventLog();
+
+    bool openTelemetry(const QString &fileName); // appends if the file exists
+    void closeTelemetry();
+    const TelemetryFile &getTelemetry() const;
+    void logStep(int timeStep, const PumpState &state, const StepResult &step, int batteryLevel);
 
 private:
-    QVector<QString> eventLog;
+    EventLog eventLog; // binary records, formatted only when printed or exported
+    TelemetryFile telemetry; // one row per step, only while opened
 };
 
 #endif // INSULINPUMP_H
@@ -0,0 +1,89 @@
+#include "logmodel.h"
+#include <QColor>
+
+// -------------------- Log Model --------------------
+const int LogModel::ChunkRecords;
+
+LogModel::LogModel(const EventLog *log, QObject *parent)
+    : QAbstractListModel(parent), log(log), severity(AllRecords), fromStep(0), toStep(-1), scanned(0) {
+    rebuild();
+}
+
+int LogModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows.size();
+}
+
+QVariant LogModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= rows.size()) return QVariant();
+    LogRecord record;
+    if (!log->at(rows[index.row()], record)) return QVariant(); // overwritten since the last refresh
+
+    if (role == Qt::DisplayRole) return log->format(record);
+    if (role == Qt::ForegroundRole && record.severity == LogRecord::Error) return QColor(Qt::red);
+    return QVariant();
+}
+
+void LogModel::setFilter(SeverityFilter severity, int fromStep, int toStep) {
+    this->severity = severity;
+    this->fromStep = qMax(0, fromStep);
+    this->toStep = toStep;
+    rebuild();
+}
+
+void LogModel::refresh() {
+    const qint64 begin = log->begin();
+    int dropped = 0;
+    while (dropped < rows.size() && rows[dropped] < begin) dropped++;
+    if (dropped > 0) {
+        beginRemoveRows(QModelIndex(), 0, dropped - 1);
+        rows.remove(0, dropped);
+        endRemoveRows();
+    }
+    scanned = qMax(scanned, begin);
+
+    added.clear();
+    collect(log->end(), added);
+    if (added.isEmpty()) return;
+    beginInsertRows(QModelIndex(), rows.size(), rows.size() + added.size() - 1);
+    rows += added;
+    endInsertRows();
+}
+
+qint64 LogModel::sequenceAt(int row) const {
+    return row >= 0 && row < rows.size() ? rows[row] : -1;
+}
+
+// The time range is found by binary search, so narrowing it to a day of a
+// long run only scans that day
+void LogModel::rebuild() {
+    beginResetModel();
+    rows.clear();
+    scanned = log->firstAtOrAfter(fromStep);
+    collect(log->end(), rows);
+    endResetModel();
+}
+
+void LogModel::collect(qint64 end, QVector<qint64> &matches) {
+    while (scanned < end) {
+        const qint64 first = log->read(scanned, int(qMin<qint64>(ChunkRecords, end - scanned)), chunk);
+        if (chunk.isEmpty()) break;
+        for (int i = 0; i < chunk.size(); i++) {
+            const LogRecord &record = chunk[i];
+            if (toStep >= 0 && record.timeStep > toStep) {
+                scanned = end; // records are in time order, nothing later can match
+                return;
+            }
+            if (accepts(record)) matches.append(first + i);
+        }
+        scanned = first + chunk.size();
+    }
+}
+
+bool LogModel::accepts(const LogRecord &record) const {
+    if (record.timeStep < fromStep) return false;
+    switch (severity) {
+    case EventsOnly: return record.severity == LogRecord::Event;
+    case ErrorsOnly: return record.severity == LogRecord::Error;
+    default: return true;
+    }
+}
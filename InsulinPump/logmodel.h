@@ -0,0 +1,46 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include "eventlog.h"
+
+// -------------------- Log Model --------------------
+// List model over an EventLog for the history panel. It only keeps the
+// sequence numbers of the records that pass the filter; the text of a row is
+// formatted when the view asks for it, which with uniform item sizes is only
+// for the rows on screen.
+class LogModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    enum SeverityFilter { AllRecords, EventsOnly, ErrorsOnly };
+
+    explicit LogModel(const EventLog *log, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // toStep < 0 means no upper bound
+    void setFilter(SeverityFilter severity, int fromStep, int toStep);
+    void refresh(); // adds records appended since the last call, drops the ones the log overwrote
+    qint64 sequenceAt(int row) const;
+
+private:
+    static const int ChunkRecords = 4096;
+
+    void rebuild();
+    void collect(qint64 end, QVector<qint64> &matches);
+    bool accepts(const LogRecord &record) const;
+
+    const EventLog *log;
+    SeverityFilter severity;
+    int fromStep;
+    int toStep;
+    qint64 scanned;              // next sequence number to look at
+    QVector<qint64> rows;        // sequence numbers of the matching records
+    QVector<LogRecord> chunk;    // reused while scanning
+    QVector<qint64> added;
+};
+
+#endif // LOGMODEL_H
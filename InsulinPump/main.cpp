@@ -2,7 +2,9 @@
 #include <QMainWindow>
 #include <QDebug>
 #include <QtTest/QtTest>
+#include <QCommandLineParser>
 #include "mainwindow.h"  // if you're using MainWindow UI
+#include "tracerecorder.h"
 
 // Forward declaration of test class
 class InsulinPumpTest;
@@ -14,13 +16,60 @@ int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption telemetryOption("telemetry", "Append per-step telemetry to <file>.", "file");
+    parser.addOption(telemetryOption);
+    QCommandLineOption checkpointOption("checkpoint", "Resume from <file> if it exists and checkpoint to it while running.", "file");
+    parser.addOption(checkpointOption);
+    QCommandLineOption intervalOption("checkpoint-interval", "Simulated minutes between checkpoints (default 60).", "minutes", "60");
+    parser.addOption(intervalOption);
+    QCommandLineOption scenarioOption("scenario", "Replay the scenario script <file> instead of manual input.", "file");
+    parser.addOption(scenarioOption);
+    QCommandLineOption cgmOption("cgm", "Drive the controller with the recorded CGM trace <file> (CSV or binary).", "file");
+    parser.addOption(cgmOption);
+    QCommandLineOption modelOption("model", "Glucose model for the simulated patient: classic (default), bergman or compartment.", "name");
+    parser.addOption(modelOption);
+    QCommandLineOption traceOption("trace", "Record a timeline of the run and write it to <file> on exit (Chrome trace JSON).", "file");
+    parser.addOption(traceOption);
+    parser.process(app);
+
     // Run the unit tests first
     qDebug() << "===== STARTING INSULIN PUMP UNIT TESTS =====";
     runTests();
     qDebug() << "===== INSULIN PUMP UNIT TESTS COMPLETED =====";
 
     MainWindow w;
+    if (parser.isSet(telemetryOption)) {
+        w.openTelemetry(parser.value(telemetryOption));
+    }
+    if (parser.isSet(modelOption)) {
+        w.setGlucoseModel(parser.value(modelOption)); // before the checkpoint, which brings its own
+    }
+    if (parser.isSet(checkpointOption)) {
+        w.enableCheckpoints(parser.value(checkpointOption), parser.value(intervalOption).toInt());
+    }
+    if (parser.isSet(cgmOption)) {
+        w.loadGlucoseTrace(parser.value(cgmOption));
+    }
+    if (parser.isSet(scenarioOption)) {
+        w.loadScenario(parser.value(scenarioOption));
+    }
+    if (parser.isSet(traceOption)) {
+        TraceRecorder::start();
+    }
+    w.startSimulation();
     w.show();
 
-    return app.exec();
+    const int result = app.exec();
+    if (parser.isSet(traceOption)) {
+        TraceRecorder::stop();
+        if (!TraceRecorder::write(parser.value(traceOption))) {
+            qWarning() << "Could not write the trace to" << parser.value(traceOption);
+        }
+    }
+#ifdef PUMP_PROFILE
+    qInfo().noquote() << Profiler::report();
+#endif
+    return result;
 }
\ No newline at end of file
@@ -1,14 +1,30 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include <QTimer>
+#include <QtMath>
+#include <QScrollBar>
+#include <QFile>
+#include <QThread>
+#include "tracerecorder.h"
+#ifdef PUMP_PROFILE
+#include <QShortcut>
+#endif
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , device(new Device(this))
-    , simulationTimer(new QTimer(this))
+    , device(new Device)
+    , simulationThread(new QThread(this))
+    , refreshTimer(new QTimer(this))
+    , lastPlottedStep(0)
+    , chartMinutes(60)
+    , shownError(-1)
+    , logModel(new LogModel(&device->getEventLog(), this))
 {
     ui->setupUi(this);
+    ui->logView->setModel(logModel);
+    simulationThread->setObjectName("simulation");
+    connect(simulationThread, &QThread::finished, device, &QObject::deleteLater);
 
     connectAllSlots();
     disableAllInput();
@@ -24,14 +40,104 @@ MainWindow::MainWindow(QWidget *parent)
     emit profileUpdated(ui->morningBRSpinBox->value(), ui->morningCFSpinBox->value(), ui->morningCRSpinBox->value(), ui->morningBGSpinBox->value());
 
     initializeGraph();
-    ui->logOutput->setVisible(false);
     ui->logFrame->setVisible(false);
+
+    connect(refreshTimer, &QTimer::timeout, this, &MainWindow::refreshDisplay);
+    refreshTimer->start(RefreshMs);
+
+#ifdef PUMP_PROFILE
+    // the hot path profile so far, on demand
+    QShortcut *profileShortcut = new QShortcut(QKeySequence("Ctrl+Shift+P"), this);
+    connect(profileShortcut, &QShortcut::activated, this, [] { qInfo().noquote() << Profiler::report(); });
+#endif
 }
 
 MainWindow::~MainWindow() {
+    if (simulationThread->isRunning()) {
+        simulationThread->quit();
+        simulationThread->wait();
+    } else {
+        delete device; // never started
+    }
     delete ui;
 }
 
+void MainWindow::startSimulation() {
+    device->moveToThread(simulationThread); // its control system, logger and clock go along
+    simulationThread->start();
+}
+
+// Applied on the simulation thread at the next step boundary. A full queue
+// has no room for a log line either, so that one goes to the error panel only.
+void MainWindow::send(const PumpCommand &command) {
+    if (!device->post(command)) {
+        ui->errorLog->setPlainText("The device is busy, the last action was dropped.");
+    }
+}
+
+void MainWindow::sendProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose) {
+    send(PumpCommand::applyProfile(basalRate, correctionFactor, carbRatio, targetGlucose));
+}
+
+void MainWindow::openTelemetry(const QString &fileName) {
+    Logger *logger = device->getLogger();
+    if (logger->openTelemetry(fileName)) {
+        appendLog(QString("Recording telemetry to %1 (%2 rows so far).").arg(fileName).arg(logger->getTelemetry().rows()));
+    } else {
+        appendErrorLog(QString("Telemetry disabled: %1").arg(logger->getTelemetry().errorString()));
+    }
+}
+
+void MainWindow::enableCheckpoints(const QString &fileName, int intervalMinutes) {
+    if (QFile::exists(fileName)) {
+        if (device->restoreCheckpoint(fileName)) {
+            if (device->isDeviceRunning()) {
+                send(PumpCommand(PumpCommand::StartClock)); // speed picked in speedComboBox
+                enableAllInput();
+                ui->startButton->setText("Power Off");
+            }
+            if (device->findChild<InsulinControlSystem*>()->getState().currentState == PumpState::Pause) {
+                ui->pauseIns->setText("Resume Insulin");
+            }
+        } else {
+            appendErrorLog(QString("Could not resume from %1, starting a new run.").arg(fileName));
+        }
+    }
+    device->setCheckpointFile(fileName, intervalMinutes);
+}
+
+bool MainWindow::loadScenario(const QString &fileName) {
+    if (!scenario.open(fileName)) {
+        appendErrorLog(QString("Scenario not loaded: %1").arg(scenario.getReader().errorString()));
+        return false;
+    }
+    device->setScenario(&scenario);
+    appendLog(QString("Scenario %1 loaded, power on to play it.").arg(fileName));
+    return true;
+}
+
+bool MainWindow::loadGlucoseTrace(const QString &fileName) {
+    if (!glucoseTrace.open(fileName)) {
+        appendErrorLog(QString("CGM trace not loaded: %1").arg(glucoseTrace.errorString()));
+        return false;
+    }
+    device->findChild<InsulinControlSystem*>()->setGlucoseTrace(&glucoseTrace);
+    appendLog(QString("CGM trace %1 loaded, %2 readings over %3 minutes.")
+              .arg(fileName).arg(glucoseTrace.size()).arg(glucoseTrace.lastMinute() - glucoseTrace.firstMinute()));
+    return true;
+}
+
+bool MainWindow::setGlucoseModel(const QString &name) {
+    GlucoseModel::Kind model;
+    if (!GlucoseModel::fromName(name, model)) {
+        appendErrorLog(QString("Unknown glucose model: %1").arg(name));
+        return false;
+    }
+    device->setGlucoseModel(model);
+    appendLog(QString("Glucose model: %1").arg(GlucoseModel::name(model)));
+    return true;
+}
+
 //helper functions
 
 void MainWindow::connectAllSlots(){
@@ -42,6 +148,11 @@ void MainWindow::connectAllSlots(){
     connect(ui->editProfileButton, &QPushButton::clicked, this, &MainWindow::onEditProfileClicked);
     connect(ui->viewCalcButton, &QPushButton::clicked, this, &MainWindow::onCalculateBolus);
     connect(ui->checkHistory, &QPushButton::clicked, this, &MainWindow::checkHistory);
+    connect(ui->speedComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onSpeedChanged);
+    connect(ui->zoomComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onZoomChanged);
+    connect(ui->logSeverityComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onLogFilterChanged);
+    connect(ui->logFromSpinBox, &QSpinBox::valueChanged, this, &MainWindow::onLogFilterChanged);
+    connect(ui->logToSpinBox, &QSpinBox::valueChanged, this, &MainWindow::onLogFilterChanged);
 
 
     // For battery and cartridge refill
@@ -52,19 +163,12 @@ void MainWindow::connectAllSlots(){
     connect(ui->depleteBatteryButton, &QPushButton::clicked, this, &MainWindow::onDepleteBatteryClicked);
     connect(ui->depleteCartridgeButton, &QPushButton::clicked, this, &MainWindow::onDepleteCartridgeClicked);
 
-    connect(device, &Device::batteryLevelChanged, this, &MainWindow::updateBattery);
-    connect(device, &Device::logEvent, this, &MainWindow::appendLog);
+    // the battery level comes with the snapshots
     connect(device, &Device::devicePoweredOff, this, &MainWindow::onBatteryDepleted);
-    connect(this, &MainWindow::profileUpdated, device, &Device::applyProfile);
-    connect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::glucoseChanged, this, &MainWindow::updateGlucose);
-    connect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::IOBChanged, this, &MainWindow::updateIOB);
-    connect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::cartChanged, this, &MainWindow::updateCart);
+    connect(this, &MainWindow::profileUpdated, this, &MainWindow::sendProfile);
     connect(ui->pauseIns, &QPushButton::clicked, this, &MainWindow::onPauseInClicked);
     connect(ui->occlusion, &QPushButton::clicked, this, &MainWindow::onOcclusionClicked);
 
-    connect(simulationTimer, &QTimer::timeout, device, &Device::runDevice);
-    connect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::addPointy, this, &MainWindow::addPoint);
-    connect(device, &Device::logError, this, &MainWindow::appendErrorLog);
 
 
 }
@@ -77,6 +181,11 @@ void MainWindow::disconnectAllSlots(){
     disconnect(ui->viewCalcButton, &QPushButton::clicked, this, &MainWindow::onCalculateBolus);
     disconnect(ui->pauseIns, &QPushButton::clicked, this, &MainWindow::onPauseInClicked);
     disconnect(ui->checkHistory, &QPushButton::clicked, this, &MainWindow::checkHistory);
+    disconnect(ui->speedComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onSpeedChanged);
+    disconnect(ui->zoomComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onZoomChanged);
+    disconnect(ui->logSeverityComboBox, &QComboBox::currentIndexChanged, this, &MainWindow::onLogFilterChanged);
+    disconnect(ui->logFromSpinBox, &QSpinBox::valueChanged, this, &MainWindow::onLogFilterChanged);
+    disconnect(ui->logToSpinBox, &QSpinBox::valueChanged, this, &MainWindow::onLogFilterChanged);
 
     // For battery and cartridge refill
     disconnect(ui->chargeButton, &QPushButton::clicked, this, &MainWindow::onChargeClicked);
@@ -87,17 +196,8 @@ void MainWindow::disconnectAllSlots(){
     disconnect(ui->depleteCartridgeButton, &QPushButton::clicked, this, &MainWindow::onDepleteCartridgeClicked);
     disconnect(ui->occlusion, &QPushButton::clicked, this, &MainWindow::onOcclusionClicked);
 
-    disconnect(device, &Device::batteryLevelChanged, this, &MainWindow::updateBattery);
-    disconnect(device, &Device::logEvent, this, &MainWindow::appendLog);
-    disconnect(device, &Device::logError, this, &MainWindow::appendErrorLog);
     disconnect(device, &Device::devicePoweredOff, this, &MainWindow::onBatteryDepleted);
-    disconnect(this, &MainWindow::profileUpdated, device, &Device::applyProfile);
-    disconnect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::glucoseChanged, this, &MainWindow::updateGlucose);
-    disconnect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::IOBChanged, this, &MainWindow::updateIOB);
-    disconnect(device->findChild<InsulinControlSystem*>(), &InsulinControlSystem::addPointy, this, &MainWindow::addPoint);
-
-
-    disconnect(simulationTimer, &QTimer::timeout, device, &Device::runDevice);
+    disconnect(this, &MainWindow::profileUpdated, this, &MainWindow::sendProfile);
 }
 
 void MainWindow::enableAllInput(){
@@ -159,17 +259,15 @@ void MainWindow::disableAllInput(){
 //slots
 
 void MainWindow::onStartClicked() {
-    if (simulationTimer->isActive()) {
-        simulationTimer->stop();
-        device->stopDevice();
+    if (ui->startButton->text() == "Power Off") {
+        send(PumpCommand(PumpCommand::PowerOff));
         appendLog("Power off.");
         disableAllInput();
         ui->startButton->setEnabled(true);
         ui->chargeButton->setEnabled(true);
         ui->startButton->setText("Power On");
     } else {
-        device->startDevice();
-        simulationTimer->start(1000); // 1 second = 1 time step
+        send(PumpCommand(PumpCommand::PowerOn)); // speed picked in speedComboBox
         appendLog("Power on.");
         enableAllInput();
         ui->startButton->setText("Power Off");
@@ -180,12 +278,12 @@ void MainWindow::onPauseInClicked() {
 
     if (ui->pauseIns->text() == "Pause Insulin"){
         appendLog("Insulin delivery paused.");
-        device->findChild<InsulinControlSystem*>()->setState(InsulinControlSystem::Pause);
+        send(PumpCommand(PumpCommand::Pause));
         ui->pauseIns->setEnabled(true);
         ui->pauseIns->setText("Resume Insulin");
     } else if (ui->pauseIns->text() == "Resume Insulin"){
         appendLog("Insulin delivery resumed.");
-        device->findChild<InsulinControlSystem*>()->setState(InsulinControlSystem::Resume);
+        send(PumpCommand(PumpCommand::Resume));
         ui->pauseIns->setEnabled(true);
         ui->pauseIns->setText("Pause Insulin");
     }
@@ -194,7 +292,7 @@ void MainWindow::onPauseInClicked() {
 
 void MainWindow::onChargeClicked(){
     if(ui->batteryBar->value()!=100){
-        device->chargeBattery();
+        send(PumpCommand(PumpCommand::Charge));
         // Enable the start button after charging
         ui->startButton->setEnabled(true);
         appendLog("Battery charged. Device can now be powered on.");
@@ -203,22 +301,18 @@ void MainWindow::onChargeClicked(){
 
 void MainWindow::onDisconnectClicked(){
     if (ui->disconnectButton->text() == "Disconnect Device"){
-        simulationTimer->stop();
-        device->stopDevice();
+        send(PumpCommand(PumpCommand::Disconnect));
         appendLog("Power off.");
         disableAllInput();
         ui->disconnectButton->setEnabled(true);
         ui->disconnectButton->setText("Reconnect Device");
         appendErrorLog("Device disconnected, reconnect device to user.");
-        appendLog("Device disconnected, reconnect device to user.");
     } else if (ui->disconnectButton->text() == "Reconnect Device"){
-        device->startDevice();
-        simulationTimer->start(1000); // 1 second = 1 time step
+        send(PumpCommand(PumpCommand::Reconnect)); // speed picked in speedComboBox
         appendLog("Power on.");
         enableAllInput();
         ui->disconnectButton->setText("Disconnect Device");
         appendErrorLog("Device reconnected to user.");
-        appendLog("Device reconnected to user.");
 
     }
 
@@ -227,22 +321,18 @@ void MainWindow::onDisconnectClicked(){
 
 void MainWindow::onOcclusionClicked(){
     if (ui->occlusion->text() == "Cause Occlusion"){
-        simulationTimer->stop();
-        device->stopDevice();
+        send(PumpCommand(PumpCommand::Occlusion));
         appendLog("Power off.");
         disableAllInput();
         ui->occlusion->setEnabled(true);
         ui->occlusion->setText("Resolve Occlusion");
         appendErrorLog("Occlusion occured, check infusion site for blockages.");
-        appendLog("Occlusion occured, check infusion site for blockages.");
     } else if (ui->occlusion->text() == "Resolve Occlusion"){
-        device->startDevice();
-        simulationTimer->start(1000); // 1 second = 1 time step
+        send(PumpCommand(PumpCommand::ResolveOcclusion)); // speed picked in speedComboBox
         appendLog("Power on.");
         enableAllInput();
         ui->occlusion->setText("Cause Occlusion");
         appendErrorLog("Occlusion resolved, infusion site has no blockages.");
-        appendLog("Occlusion resolved, infusion site has no blockages.");
 
     }
 }
@@ -319,18 +409,41 @@ void MainWindow::updateIOB(double level, double hours) {
                            .arg(hours, 0, 'f', 2));
 }
 
+// Both post the text; the device appends it to its event log at its own
+// time step, after the commands sent before it, so the log stays in time
+// order. The widgets pick it up in refreshDisplay, errors also show up in
+// the history.
 void MainWindow::appendLog(const QString &msg) {
-    ui->logOutput->appendPlainText(msg);
+    send(PumpCommand::log(msg));
 }
 
 void MainWindow::appendErrorLog(const QString &msg) {
-    ui->errorLog->clear();
-    ui->errorLog->appendPlainText(msg);
+    send(PumpCommand::log(msg, LogRecord::Error));
+}
+
+// The error panel formats only its one record; the history model is only
+// refreshed while the panel is open and formats only the rows on screen
+void MainWindow::updateLogViews() {
+    PUMP_PROFILE_SCOPE(GuiLog);
+    const EventLog &log = device->getEventLog();
+
+    qint64 newestError = log.lastError();
+    LogRecord record;
+    if (newestError != shownError && log.at(newestError, record)) {
+        ui->errorLog->setPlainText(log.format(record));
+        shownError = newestError;
+    }
+
+    if (!ui->logFrame->isVisible()) return;
+    QScrollBar *scrollBar = ui->logView->verticalScrollBar();
+    const bool following = scrollBar->value() == scrollBar->maximum();
+    logModel->refresh();
+    if (following) ui->logView->scrollToBottom();
 }
 
 
+// the device has already stopped itself and its clock
 void MainWindow::onBatteryDepleted() {
-    simulationTimer->stop();
     disableAllInput();
     // Only enable the charge button, not the start button
     ui->chargeButton->setEnabled(true);
@@ -348,18 +461,17 @@ void MainWindow::onCalculateBolus() {
     int bolusDurationHour = ui->extendedDurationHourSpinBox->value();
     int bolusDurationMin = ui->extendedDurationMinSpinBox->value();
 
-    device->findChild<InsulinControlSystem*>()->calculateBolus(carbInput, glucoseInput, bolusDurationHour, bolusDurationMin);
+    send(PumpCommand::bolus(carbInput, glucoseInput, bolusDurationHour, bolusDurationMin));
 
 }
 
 void MainWindow::onRefillCartridgeClicked() {
-    device->refillCartridge();
+    send(PumpCommand(PumpCommand::Refill));
     appendLog("Cartridge refilled to 300 units.");
 }
 
 void MainWindow::onDepleteBatteryClicked() {
     // Call the existing decrement function directly
-    appendLog("Battery depleted.");
     appendErrorLog("Battery depleted.");
     decrementBattery();
 }
@@ -383,7 +495,7 @@ void MainWindow::decrementBattery() {
     }
 
     // Update battery level
-    device->setBatteryLevel(currentLevel);
+    send(PumpCommand::setBattery(currentLevel));
     ui->batteryBar->setValue(currentLevel);
 }
 
@@ -400,17 +512,9 @@ void MainWindow::decrementCartridge() {
         currentLevel = 0.0;
     }
 
-    // Update cartridge level
-    InsulinControlSystem *ics = device->findChild<InsulinControlSystem*>();
-    if (ics) {
-        // Set the cartridge to the new level directly, rather than depleting by units
-        double amountToReduce = ics->getCartridgeLevel() - currentLevel;
-        ics->depleteCartridge(amountToReduce); // This will emit signals to update UI
-    } else {
-        // Fallback in case ICS not found
-        ui->cartridge->setValue(currentLevel);
-        ui->cartridge->setFormat(QString("Cartridge: %1 u").arg(currentLevel, 0, 'f', 2));
-    }
+    // Set the cartridge to the new level directly, rather than depleting by
+    // units; the GUI picks it up with the next snapshot
+    send(PumpCommand::setCartridge(currentLevel));
 }
 
 void MainWindow::initializeGraph(){
@@ -450,30 +554,105 @@ void MainWindow::initializeGraph(){
 
 }
 
-void MainWindow::addPoint(int x, double y){
-    series->append(x, y);
+// The series is rebuilt every frame from whichever level of the device's
+// roll-ups fits the plot width, so its size depends on the chart, not on the
+// run length. The device fills them as it steps, however far it got since
+// the last frame.
+void MainWindow::redrawChart(int latestStep){
+    TraceScope trace("gui", "redraw chart", "time step", latestStep);
+    PUMP_PROFILE_SCOPE(GuiChart);
+    int from = qMax(0, latestStep - chartMinutes);
+    int columns = int(chart->plotArea().width());
+    const HistoryStore &history = device->getHistory();
+    HistoryStore::Level level = history.query(from, latestStep, columns, chartBuckets);
+
+    // one point per minute, otherwise a min-max bar per bucket so spikes survive
+    chartPoints.clear();
+    for (const HistoryBucket &b : chartBuckets) {
+        if (level == HistoryStore::Minute || b.min == b.max) {
+            chartPoints.append(QPointF(b.start, b.min));
+        } else {
+            double x = b.start + HistoryStore::levelMinutes(level) / 2.0;
+            chartPoints.append(QPointF(x, b.min));
+            chartPoints.append(QPointF(x, b.max));
+        }
+    }
+    series->replace(chartPoints);
+
+    // Show the latest window, the axis only starts moving once it has filled up
+    QValueAxis *xAxis = qobject_cast<QValueAxis *>(chart->axes(Qt::Horizontal).first());
+    xAxis->setRange(from, qMax(from + chartMinutes, latestStep));
 
-   // Get the current x-axis range
-   QValueAxis *xAxis = qobject_cast<QValueAxis *>(chart->axes(Qt::Horizontal).first());
+    // Grow the glucose axis so hypo/hyper spikes stay visible
+    double low = 3.0, high = 8.0;
+    for (const QPointF &p : chartPoints) {
+        low = qMin(low, p.y());
+        high = qMax(high, p.y());
+    }
+    QValueAxis *yAxis = qobject_cast<QValueAxis *>(chart->axes(Qt::Vertical).first());
+    yAxis->setRange(qFloor(low), qCeil(high));
 
-   if (x > xAxis->max()) {  // If new point exceeds the max range
-       xAxis->setRange(xAxis->min() + 1, x);  // Shift the range dynamically
-   }
+    HistoryBucket window = history.summarize(from, latestStep);
+    chart->setTitle(QString("Time in range: %1% | Mean: %2 mmol/L")
+                    .arg(window.timeInRange() * 100, 0, 'f', 0)
+                    .arg(window.mean(), 0, 'f', 1));
 
-   chartView->repaint();
-   ui->timeStep->display(QString::number(x));
+    chartView->update(); // painted with the next frame, not synchronously
+    ui->timeStep->display(QString::number(latestStep));
 }
 
 void MainWindow::checkHistory(){
 
     if (ui->checkHistory->text() == "Check History Logs"){
-        ui->logOutput->setVisible(true);
         ui->logFrame->setVisible(true);
         ui->checkHistory->setText("Close History Logs");
+        updateLogViews();
+        ui->logView->scrollToBottom();
     } else if (ui->checkHistory->text() == "Close History Logs"){
-        ui->logOutput->setVisible(false);
         ui->logFrame->setVisible(false);
         ui->checkHistory->setText("Check History Logs");
     }
 
 }
+
+void MainWindow::onSpeedChanged(int index) {
+    send(PumpCommand::setSpeed(index));
+    appendLog(QString("Simulation speed set to %1.").arg(ui->speedComboBox->currentText()));
+}
+
+void MainWindow::onZoomChanged(int index) {
+    // Last hour, 6 hours, day, week, 30 days, 90 days
+    static const int zoomMinutes[] = { 60, 6 * 60, 24 * 60, 7 * 24 * 60, 30 * 24 * 60, 90 * 24 * 60 };
+    chartMinutes = zoomMinutes[qBound(0, index, 5)];
+    redrawChart(lastPlottedStep);
+}
+
+void MainWindow::onLogFilterChanged() {
+    logModel->setFilter(LogModel::SeverityFilter(ui->logSeverityComboBox->currentIndex()),
+                        ui->logFromSpinBox->value(), ui->logToSpinBox->value());
+}
+
+// Runs at a fixed rate whatever the clock speed; intermediate snapshots are
+// simply skipped, so the GUI cost doesn't grow with the step rate
+void MainWindow::refreshDisplay() {
+    TraceScope trace("gui", "refresh");
+    PUMP_PROFILE_SCOPE(GuiRefresh);
+    PUMP_PROFILE_COUNT(GuiRefreshes, 1);
+    updateLogViews();
+
+    PumpSnapshot snapshot;
+    if (!device->takeSnapshot(snapshot)) return;
+    PUMP_PROFILE_COUNT(GuiSnapshots, 1);
+
+    {
+        PUMP_PROFILE_SCOPE(GuiLabels);
+        updateGlucose(snapshot.currentGlucose);
+        updateIOB(snapshot.insulinOnBoard, ControlIQ::iobHoursRemaining(snapshot.insulinOnBoard));
+        updateCart(snapshot.cartLevel);
+        updateBattery(snapshot.batteryLevel);
+    }
+    if (snapshot.timeStep > lastPlottedStep) {
+        redrawChart(snapshot.timeStep);
+        lastPlottedStep = snapshot.timeStep;
+    }
+}
@@ -4,10 +4,14 @@
 
 #include <QMainWindow>
 #include "insulinpump.h"
+#include "logmodel.h"
+#include "scenario.h"
 #include <QtCharts>
 #include <QChartView>
 #include <QLineSeries>
 
+class QThread;
+
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -20,6 +24,15 @@ public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    void openTelemetry(const QString &fileName);
+    void enableCheckpoints(const QString &fileName, int intervalMinutes); // resumes from fileName if it exists
+    bool loadScenario(const QString &fileName); // played once the device is powered on
+    bool loadGlucoseTrace(const QString &fileName);
+    bool setGlucoseModel(const QString &name); // see GlucoseModel::name
+    // Moves the device onto its own thread and starts it; the setup calls
+    // above have to come first. From then on the GUI only posts commands.
+    void startSimulation();
+
 private slots:
     void onStartClicked();
     void onChargeClicked();
@@ -41,26 +54,44 @@ private slots:
     void decrementBattery();
     void decrementCartridge();
     void checkHistory();
+    void onSpeedChanged(int index);
+    void onZoomChanged(int index);
+    void onLogFilterChanged();
+    void refreshDisplay();
+    void sendProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
 
 signals:
     void profileUpdated(double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
 
 
 private:
+    static const int RefreshMs = 33; // ~30 Hz
+
     Ui::MainWindow *ui;
-    Device *device;
-    QTimer *simulationTimer;
+    Device *device;         // lives on simulationThread, deleted there as it finishes
+    QThread *simulationThread;
+    QTimer *refreshTimer;   // pulls the newest device snapshot, independent of the simulation speed
+    int lastPlottedStep;
+    int chartMinutes;      // zoom, picked in zoomComboBox
+    QVector<HistoryBucket> chartBuckets; // reused every frame
+    QVector<QPointF> chartPoints;
+    qint64 shownError;     // record currently in the error panel
+    LogModel *logModel;    // history panel rows
+    ScenarioDriver scenario;
+    CgmTrace glucoseTrace;
     QChart *chart;
     QChartView *chartView;
     QLineSeries *series;
 
+    void send(const PumpCommand &command);
     void connectAllSlots();
     void disconnectAllSlots();
     void enableAllInput();
     void disableAllInput();
     void onCalculateBolus();
     void initializeGraph();
-    void addPoint(int time, double glucose);
+    void updateLogViews();
+    void redrawChart(int latestStep);
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,235 @@
+#ifndef ODEINTEGRATOR_H
+#define ODEINTEGRATOR_H
+
+#include <QtGlobal>
+#include <cmath>
+
+// Batch kernels built for the baseline ISA plus AVX2 and AVX-512, picked at
+// load time. Only where the toolchain supports function multiversioning;
+// everywhere else it's the plain (still auto-vectorized) build.
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+#define PUMP_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define PUMP_TARGET_CLONES
+#endif
+
+// -------------------- ODE Integrator --------------------
+// Explicit Runge-Kutta for a batch of independent systems (one per patient)
+// laid out structure of arrays: variable v of lane i is x[v][i]. Every stage
+// is a flat loop over the lanes, so the compiler vectorizes it the same way
+// as the PatientCohort kernels, and a batch of one is the scalar path. Each
+// lane's arithmetic doesn't depend on the batch size, so a lane integrated
+// alone gives bit-identical results to the same lane inside a batch.
+//
+// A System provides
+//   static const int Variables;
+//   void derivatives(const double *const *x, double *const *dx, int lane, int n) const;
+// filling dx[v][0..n) for the lanes starting at x[v][0]; 'lane' is the index
+// of the first one, for systems with per-lane inputs. Inputs are held
+// constant over a call.
+class OdeIntegrator {
+public:
+    static const int MaxLanes = 256; // lanes per pass, the scratch lives on the stack
+    static constexpr double MinStepFraction = 1e-12; // of the duration, adaptive() gives up below it
+
+    // Classic fourth order Runge-Kutta, 'steps' steps of h. A single lane
+    // (one pump stepping each minute) gets scratch for one lane, not MaxLanes.
+    template <typename System>
+    static void rk4(const System &system, double *const *x, int n, double h, int steps = 1);
+
+    // Bogacki-Shampine 3(2) over 'duration'. Every lane adapts its own step
+    // size and keeps its own time, and a lane that has arrived only waits for
+    // the rest of its pass, so as with rk4 a lane lands on the same bits alone
+    // and in a batch. 'tolerance' bounds the local error relative to
+    // max(1, |x|). A step with a non-finite error estimate is rejected like
+    // one that is too large; a lane whose step would shrink below
+    // MinStepFraction of the duration stops at its last accepted state.
+    // Returns false if any lane stopped early; 'steps' gets the accepted
+    // steps summed over the lanes.
+    template <typename System>
+    static bool adaptive(const System &system, double *const *x, int n, double duration, double tolerance,
+                         double initialStep = 1.0, int *steps = nullptr);
+
+private:
+    template <int Lanes, typename System>
+    static void rk4Pass(const System &system, double *const *x, int lane, int n, double h, int steps);
+    template <int Lanes, typename System>
+    static bool adaptivePass(const System &system, double *const *x, int lane, int n, double duration,
+                             double tolerance, double initialStep, int &steps);
+
+    // out[v][i] = x[v][i] + a * k[v][i]
+    template <int Variables, int Lanes>
+    Q_ALWAYS_INLINE static void axpy(double *const *out, double *const *x, double a, double (*k)[Lanes], int n) {
+        for (int v = 0; v < Variables; v++) {
+            double *__restrict o = out[v];
+            const double *__restrict xv = x[v];
+            const double *__restrict kv = k[v];
+            for (int i = 0; i < n; i++) o[i] = xv[i] + a * kv[i];
+        }
+    }
+};
+
+// Forced inline so a caller built for AVX2/AVX-512 (PUMP_TARGET_CLONES)
+// gets the whole integration compiled for its ISA
+template <typename System>
+Q_ALWAYS_INLINE void OdeIntegrator::rk4(const System &system, double *const *x, int n, double h, int steps) {
+    if (n == 1) {
+        rk4Pass<1>(system, x, 0, 1, h, steps);
+        return;
+    }
+    double *lanes[System::Variables];
+    for (int b = 0; b < n; b += MaxLanes) {
+        for (int v = 0; v < System::Variables; v++) lanes[v] = x[v] + b;
+        rk4Pass<MaxLanes>(system, lanes, b, qMin(n - b, int(MaxLanes)), h, steps); // by value, MaxLanes has no out-of-line definition
+    }
+}
+
+// Scratch is five V x Lanes arrays: 70 KB for a full pass of the compartment
+// model, 280 bytes for one lane
+template <int Lanes, typename System>
+Q_ALWAYS_INLINE void OdeIntegrator::rk4Pass(const System &system, double *const *x, int lane, int n, double h, int steps) {
+    const int V = System::Variables;
+    double k1[V][Lanes], k2[V][Lanes], k3[V][Lanes], k4[V][Lanes], y[V][Lanes];
+    double *kp1[V], *kp2[V], *kp3[V], *kp4[V], *yp[V];
+    for (int v = 0; v < V; v++) {
+        kp1[v] = k1[v]; kp2[v] = k2[v]; kp3[v] = k3[v]; kp4[v] = k4[v]; yp[v] = y[v];
+    }
+
+    for (int s = 0; s < steps; s++) {
+        system.derivatives(x, kp1, lane, n);
+        axpy<V, Lanes>(yp, x, 0.5 * h, k1, n);
+        system.derivatives(yp, kp2, lane, n);
+        axpy<V, Lanes>(yp, x, 0.5 * h, k2, n);
+        system.derivatives(yp, kp3, lane, n);
+        axpy<V, Lanes>(yp, x, h, k3, n);
+        system.derivatives(yp, kp4, lane, n);
+        for (int v = 0; v < V; v++) {
+            double *__restrict xv = x[v];
+            const double *__restrict a = k1[v];
+            const double *__restrict b = k2[v];
+            const double *__restrict c = k3[v];
+            const double *__restrict d = k4[v];
+            for (int i = 0; i < n; i++) {
+                xv[i] = xv[i] + h / 6.0 * (a[i] + 2.0 * b[i] + 2.0 * c[i] + d[i]);
+            }
+        }
+    }
+}
+
+template <typename System>
+inline bool OdeIntegrator::adaptive(const System &system, double *const *x, int n, double duration, double tolerance,
+                                    double initialStep, int *steps) {
+    int accepted = 0;
+    bool finished = true;
+    if (n == 1) {
+        finished = adaptivePass<1>(system, x, 0, 1, duration, tolerance, initialStep, accepted);
+    } else {
+        double *lanes[System::Variables];
+        for (int b = 0; b < n; b += MaxLanes) {
+            for (int v = 0; v < System::Variables; v++) lanes[v] = x[v] + b;
+            finished = adaptivePass<MaxLanes>(system, lanes, b, qMin(n - b, int(MaxLanes)), duration, tolerance,
+                                              initialStep, accepted) && finished;
+        }
+    }
+    if (steps) *steps = accepted;
+    return finished;
+}
+
+// Lanes that have arrived (or given up) take steps of 0, which leave their
+// state and their k1 as they are. The stages still run over the whole pass
+// so they stay flat loops; the step control is per lane.
+template <int Lanes, typename System>
+inline bool OdeIntegrator::adaptivePass(const System &system, double *const *x, int lane, int n, double duration,
+                                        double tolerance, double initialStep, int &steps) {
+    const int V = System::Variables;
+    const double minStep = duration * MinStepFraction;
+    double k1[V][Lanes], k2[V][Lanes], k3[V][Lanes], k4[V][Lanes], y[V][Lanes];
+    double h[Lanes], t[Lanes], worst[Lanes] = {}, step[Lanes] = {};
+    bool active[Lanes];
+    double *kp1[V], *kp2[V], *kp3[V], *kp4[V], *yp[V];
+    for (int v = 0; v < V; v++) {
+        kp1[v] = k1[v]; kp2[v] = k2[v]; kp3[v] = k3[v]; kp4[v] = k4[v]; yp[v] = y[v];
+    }
+
+    int running = 0;
+    for (int i = 0; i < n; i++) {
+        h[i] = initialStep;
+        t[i] = 0.0;
+        active[i] = duration > 0.0;
+        if (active[i]) running++;
+    }
+    bool finished = true;
+    system.derivatives(x, kp1, lane, n);
+    while (running > 0) {
+        for (int i = 0; i < n; i++) step[i] = active[i] ? qMin(h[i], duration - t[i]) : 0.0;
+        for (int v = 0; v < V; v++) {
+            const double *__restrict xv = x[v];
+            const double *__restrict a = k1[v];
+            double *__restrict yv = y[v];
+            for (int i = 0; i < n; i++) yv[i] = xv[i] + 0.5 * step[i] * a[i];
+        }
+        system.derivatives(yp, kp2, lane, n);
+        for (int v = 0; v < V; v++) {
+            const double *__restrict xv = x[v];
+            const double *__restrict b = k2[v];
+            double *__restrict yv = y[v];
+            for (int i = 0; i < n; i++) yv[i] = xv[i] + 0.75 * step[i] * b[i];
+        }
+        system.derivatives(yp, kp3, lane, n);
+        // third order solution in y, its derivative doubles as the next k1 (FSAL)
+        for (int v = 0; v < V; v++) {
+            double *__restrict yv = y[v];
+            const double *__restrict xv = x[v];
+            const double *__restrict a = k1[v];
+            const double *__restrict b = k2[v];
+            const double *__restrict c = k3[v];
+            for (int i = 0; i < n; i++) {
+                yv[i] = xv[i] + step[i] * (2.0 / 9.0 * a[i] + 1.0 / 3.0 * b[i] + 4.0 / 9.0 * c[i]);
+            }
+        }
+        system.derivatives(yp, kp4, lane, n);
+
+        // embedded second order estimate, the worst variable of each lane
+        for (int i = 0; i < n; i++) worst[i] = 0.0;
+        for (int v = 0; v < V; v++) {
+            const double *__restrict yv = y[v];
+            const double *__restrict a = k1[v];
+            const double *__restrict b = k2[v];
+            const double *__restrict c = k3[v];
+            const double *__restrict d = k4[v];
+            for (int i = 0; i < n; i++) {
+                const double error = step[i] * (-5.0 / 72.0 * a[i] + 1.0 / 12.0 * b[i] + 1.0 / 9.0 * c[i] - 1.0 / 8.0 * d[i]);
+                const double scaled = std::fabs(error) / (tolerance * qMax(1.0, std::fabs(yv[i])));
+                // a NaN compares false either way, so it has to be caught explicitly
+                worst[i] = std::isfinite(scaled) ? qMax(worst[i], scaled) : HUGE_VAL;
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (!active[i]) continue;
+            const bool accept = worst[i] <= 1.0;
+            if (accept) {
+                t[i] = step[i] == duration - t[i] ? duration : t[i] + step[i];
+                steps++;
+                for (int v = 0; v < V; v++) {
+                    x[v][i] = y[v][i];
+                    k1[v][i] = k4[v][i];
+                }
+            }
+            // the usual safety factor, growth limited to 5x and shrinking to 0.2x
+            const double scale = worst[i] > 0.0 ? 0.9 * std::pow(worst[i], -1.0 / 3.0) : 5.0;
+            h[i] = step[i] * qBound(0.2, scale, 5.0);
+            if (accept && t[i] >= duration) {
+                active[i] = false;
+                running--;
+            } else if (h[i] < minStep) {
+                active[i] = false; // stuck: a non-finite state or far too stiff for the tolerance
+                running--;
+                finished = false;
+            }
+        }
+    }
+    return finished;
+}
+
+#endif // ODEINTEGRATOR_H
@@ -0,0 +1,223 @@
+#include "patientcohort.h"
+#include <cmath>
+
+// -------------------- Patient Cohort --------------------
+const int PatientCohort::BlockSize;
+
+PatientCohort::PatientCohort(int patients, quint64 seed)
+    : model(GlucoseModel::Classic), timeStep(0), seed(seed) {
+    resize(patients);
+}
+
+void PatientCohort::resize(int patients) {
+    int old = size();
+    PumpState defaults;
+    glucose.resize(patients);
+    insulinOnBoard.resize(patients);
+    basalRate.resize(patients);
+    profileBasalRate.resize(patients);
+    cartLevel.resize(patients);
+    targetGlucose.resize(patients);
+    correctionFactor.resize(patients);
+    carbRatio.resize(patients);
+    mode.resize(patients);
+    for (QVector<double> &c : compartment) c.resize(patients);
+    for (int i = old; i < patients; i++) {
+        setPatient(i, defaults);
+    }
+}
+
+int PatientCohort::size() const {
+    return glucose.size();
+}
+
+int PatientCohort::getTimeStep() const {
+    return timeStep;
+}
+
+void PatientCohort::setPatient(int i, const PumpState &state) {
+    glucose[i] = state.currentGlucose;
+    insulinOnBoard[i] = state.insulinOnBoard;
+    basalRate[i] = state.basalRate;
+    profileBasalRate[i] = state.profileBasalRate;
+    cartLevel[i] = state.cartLevel;
+    targetGlucose[i] = state.targetGlucose;
+    correctionFactor[i] = state.correctionFactor;
+    carbRatio[i] = state.carbRatio;
+    mode[i] = state.currentState;
+    const GlucoseModelState &m = state.physiology;
+    compartment[CompartmentModel::Depot1][i] = m.insulinDepot[0];
+    compartment[CompartmentModel::Depot2][i] = m.insulinDepot[1];
+    compartment[CompartmentModel::Plasma][i] = m.plasmaInsulin;
+    compartment[CompartmentModel::Action][i] = m.insulinAction;
+    compartment[CompartmentModel::Stomach][i] = m.gut[0];
+    compartment[CompartmentModel::Gut][i] = m.gut[1];
+}
+
+PumpState PatientCohort::patient(int i) const {
+    PumpState state;
+    state.timeStep = timeStep;
+    state.currentGlucose = glucose[i];
+    state.insulinOnBoard = insulinOnBoard[i];
+    state.basalRate = basalRate[i];
+    state.profileBasalRate = profileBasalRate[i];
+    state.cartLevel = cartLevel[i];
+    state.targetGlucose = targetGlucose[i];
+    state.correctionFactor = correctionFactor[i];
+    state.carbRatio = carbRatio[i];
+    state.currentState = PumpState::Mode(mode[i]);
+    state.glucoseModel = model;
+    if (model == GlucoseModel::Compartment) {
+        GlucoseModelState &m = state.physiology;
+        m.insulinDepot[0] = compartment[CompartmentModel::Depot1][i];
+        m.insulinDepot[1] = compartment[CompartmentModel::Depot2][i];
+        m.plasmaInsulin = compartment[CompartmentModel::Plasma][i];
+        m.insulinAction = compartment[CompartmentModel::Action][i];
+        m.gut[0] = compartment[CompartmentModel::Stomach][i];
+        m.gut[1] = compartment[CompartmentModel::Gut][i];
+    }
+    return state;
+}
+
+void PatientCohort::applyProfile(int i, double pbasalRate, double pcorrectionFactor, int pcarbRatio, double ptargetGlucose) {
+    profileBasalRate[i] = pbasalRate;
+    correctionFactor[i] = pcorrectionFactor;
+    carbRatio[i] = pcarbRatio;
+    targetGlucose[i] = ptargetGlucose;
+}
+
+void PatientCohort::setState(int i, PumpState::Mode m) {
+    mode[i] = m;
+}
+
+bool PatientCohort::setGlucoseModel(GlucoseModel::Kind kind) {
+    if (kind != GlucoseModel::Classic && kind != GlucoseModel::Compartment) return false;
+    model = kind;
+    return true;
+}
+
+GlucoseModel::Kind PatientCohort::getGlucoseModel() const {
+    return model;
+}
+
+void PatientCohort::step() {
+    stepBlock(0, size(), timeStep + 1);
+    advanceClock();
+}
+
+void PatientCohort::run(int minutes) {
+    for (int m = 0; m < minutes; m++) {
+        step();
+    }
+}
+
+void PatientCohort::advanceClock(int minutes) {
+    timeStep += minutes;
+}
+
+// qRound(value * 100) / 100.0 without the branch, so it vectorizes. Adding
+// copysign(0.5) before truncating rounds exactly like qRound for every value.
+static inline double roundCents(double value) {
+    double t = value * 100;
+    return int(t + std::copysign(0.5, t)) / 100.0;
+}
+
+// Same arithmetic as ControlIQ::step<Model>, in the same order so results are
+// bit-identical, but written as selects instead of branches
+void PatientCohort::stepBlock(int begin, int end, int step) {
+    double glucoseNoise[BlockSize];
+    double predictionNoise[BlockSize];
+    // mode flags widened to doubles so every select below works on same-width lanes
+    double live[BlockSize];
+    double paused[BlockSize];
+    double effect[BlockSize];
+    double predicted[BlockSize];
+
+    for (int b = begin; b < end; b += BlockSize) {
+        const int n = qMin(BlockSize, end - b);
+        // noise for stopped patients is generated too but never used
+        PhiloxRng::noiseBlock(seed, quint64(b), n, quint64(step), glucoseNoise, predictionNoise);
+
+        double *__restrict g = glucose.data() + b;
+        double *__restrict iob = insulinOnBoard.data() + b;
+        double *__restrict rate = basalRate.data() + b;
+        double *__restrict cart = cartLevel.data() + b;
+        int *__restrict m = mode.data() + b;
+        const double *__restrict profileRate = profileBasalRate.data() + b;
+        const double *__restrict target = targetGlucose.data() + b;
+
+        // State handling: pause forces basal to 0, resume restores the profile rate.
+        // Anything but Run is rare, so this stays a plain (well predicted) loop.
+        for (int i = 0; i < n; i++) {
+            if (m[i] == PumpState::Pause) {
+                rate[i] = 0.0;
+            } else if (m[i] == PumpState::Resume) {
+                m[i] = PumpState::Run;
+                rate[i] = profileRate[i];
+            }
+            live[i] = m[i] != PumpState::Stop ? 1.0 : 0.0;
+            paused[i] = m[i] == PumpState::Pause ? 1.0 : 0.0;
+        }
+
+        // Basal effect, glucose drift and noise (paused patients have a 0 rate)
+        if (model == GlucoseModel::Compartment) {
+            for (int i = 0; i < n; i++) {
+                // stopped patients get a zero effect, and x + 0.0 leaves x unchanged
+                effect[i] = live[i] * (rate[i] * 0.1);
+            }
+            // stopped patients' derivatives are scaled to 0, their state stays put
+            integrateBlock(b, n, effect, live);
+            for (int i = 0; i < n; i++) {
+                const double newGlucose = roundCents(g[i] + glucoseNoise[i]);
+                g[i] = live[i] != 0.0 ? newGlucose : g[i];
+                iob[i] = iob[i] + effect[i];
+                cart[i] = cart[i] - effect[i];
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                const double effect = live[i] * (rate[i] * 0.1);
+                const double drift = paused[i] != 0.0 ? 0.05 : -(0.1 * rate[i]);
+                const double newGlucose = roundCents(g[i] + drift + glucoseNoise[i]);
+                g[i] = live[i] != 0.0 ? newGlucose : g[i];
+                iob[i] = iob[i] + effect;
+                cart[i] = cart[i] - effect;
+            }
+        }
+
+        // IOB decay, 2% per minute
+        for (int i = 0; i < n; i++) {
+            const double decayed = iob[i] * 0.98;
+            const double cleared = decayed <= 0.01 ? 0.0 : decayed;
+            iob[i] = live[i] != 0.0 ? cleared : iob[i];
+        }
+
+        // 30 minute prediction, then the three-band basal adjustment
+        if (model == GlucoseModel::Compartment) {
+            const double *__restrict action = compartment[CompartmentModel::Action].constData() + b;
+            const double *__restrict gut = compartment[CompartmentModel::Gut].constData() + b;
+            for (int i = 0; i < n; i++) {
+                predicted[i] = roundCents(g[i] + CompartmentModel::Horizon * CompartmentModel::glucoseRate(g[i], action[i], gut[i])
+                                          + predictionNoise[i]);
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                predicted[i] = roundCents(g[i] - iob[i] * 0.1667 + predictionNoise[i]);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            const double reduced = rate[i] * 0.5 < 0.1 ? 0.1 : rate[i] * 0.5;
+            const double increased = rate[i] * 1.2 < 2.0 ? rate[i] * 1.2 : 2.0;
+            double adjusted = predicted[i] >= target[i] + 0.5 ? increased : rate[i];
+            adjusted = predicted[i] <= target[i] + 0.03 ? reduced : adjusted;
+            adjusted = predicted[i] <= target[i] - 0.1 ? 0.0 : adjusted;
+            rate[i] = live[i] != 0.0 ? adjusted : rate[i];
+        }
+    }
+}
+
+void PatientCohort::integrateBlock(int b, int n, const double *infusion, const double *live) {
+    double *x[CompartmentModel::VariableCount];
+    for (int v = 0; v < CompartmentModel::Glucose; v++) x[v] = compartment[v].data() + b;
+    x[CompartmentModel::Glucose] = glucose.data() + b;
+    OdeIntegrator::rk4(CompartmentModel::System{ infusion, live }, x, n, 1.0);
+}
@@ -0,0 +1,61 @@
+#ifndef PATIENTCOHORT_H
+#define PATIENTCOHORT_H
+
+#include <QtGlobal>
+#include <QVector>
+#include "controliq.h"
+#include "philoxrng.h"
+
+// -------------------- Patient Cohort --------------------
+// Many simulated patients stepped together. Every field of PumpState is kept
+// in its own contiguous array (structure of arrays) and each stage of
+// ControlIQ::step runs as a branch-free loop over a block of patients, so the
+// compiler can vectorize it. Patient i uses noise stream i, so it follows the
+// same trajectory as PumpEngine(seed, i) with battery drain turned off.
+// Patients run ClassicModel, or with setGlucoseModel CompartmentModel, whose
+// ODEs are integrated a block at a time through OdeIntegrator.
+class PatientCohort {
+public:
+    static const int BlockSize = 256; // patients per pass, keeps a block in L1/L2
+
+    explicit PatientCohort(int patients = 0, quint64 seed = 0);
+
+    void resize(int patients);
+    int size() const;
+    int getTimeStep() const;
+
+    void setPatient(int i, const PumpState &state);
+    PumpState patient(int i) const;
+    void applyProfile(int i, double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
+    void setState(int i, PumpState::Mode mode);
+    bool setGlucoseModel(GlucoseModel::Kind model); // every patient; Classic or Compartment, false otherwise
+    GlucoseModel::Kind getGlucoseModel() const;
+
+    void step(); // every patient, one minute
+    void run(int minutes);
+    void stepBlock(int begin, int end, int step); // patients [begin, end) through minute 'step', clock is not advanced
+    void advanceClock(int minutes = 1);
+
+    // Per-field arrays, indexed by patient
+    QVector<double> glucose;
+    QVector<double> insulinOnBoard;
+    QVector<double> basalRate;
+    QVector<double> profileBasalRate;
+    QVector<double> cartLevel;
+    QVector<double> targetGlucose;
+    QVector<double> correctionFactor;
+    QVector<int> carbRatio;
+    QVector<int> mode; // PumpState::Mode
+    QVector<double> compartment[CompartmentModel::Glucose]; // CompartmentModel state by variable, glucose is above
+
+private:
+    // one minute of CompartmentModel for patients [b, b + n), with the
+    // block's basal delivery and live flags
+    void integrateBlock(int b, int n, const double *infusion, const double *live) PUMP_TARGET_CLONES;
+
+    GlucoseModel::Kind model;
+    int timeStep;
+    quint64 seed;
+};
+
+#endif // PATIENTCOHORT_H
@@ -0,0 +1,101 @@
+#include "philoxrng.h"
+#include "odeintegrator.h" // PUMP_TARGET_CLONES
+
+// -------------------- Philox RNG --------------------
+PhiloxRng::PhiloxRng(quint64 seed, quint64 stream)
+    : seedValue(seed), stream(stream), counter(0), spare(0.0), hasSpare(false) {}
+
+void PhiloxRng::seed(quint64 seed, quint64 newStream) {
+    seedValue = seed;
+    stream = newStream;
+    setPosition(0);
+}
+
+quint64 PhiloxRng::getSeed() const {
+    return seedValue;
+}
+
+quint64 PhiloxRng::getStream() const {
+    return stream;
+}
+
+PhiloxRng PhiloxRng::split(quint64 newStream) const {
+    return PhiloxRng(seedValue, newStream);
+}
+
+double PhiloxRng::generateDouble() {
+    if (hasSpare) {
+        hasSpare = false;
+        return spare;
+    }
+    double first;
+    doublesAt(counter++, first, spare);
+    hasSpare = true;
+    return first;
+}
+
+void PhiloxRng::fill(double *out, int count) {
+    int i = 0;
+    if (hasSpare && count > 0) {
+        out[i++] = spare;
+        hasSpare = false;
+    }
+    for (; i + 1 < count; i += 2) {
+        doublesAt(counter++, out[i], out[i + 1]);
+    }
+    if (i < count) {
+        out[i] = generateDouble();
+    }
+}
+
+void PhiloxRng::jumpAhead(quint64 blocks) {
+    counter += blocks;
+    hasSpare = false;
+}
+
+void PhiloxRng::setPosition(quint64 block) {
+    counter = block;
+    hasSpare = false;
+}
+
+quint64 PhiloxRng::position() const {
+    return counter;
+}
+
+// Same rounds as philox(), spelled out on scalars so the loop over lanes
+// vectorizes (4 lanes with AVX2, 2 with SSE2/NEON). Lane i is counter
+// (step + i * stepIncrement, stream + i * streamIncrement).
+static inline void noiseLanes(quint64 seed, quint64 step, quint64 stepIncrement, quint64 stream, quint64 streamIncrement,
+                              int count, double *glucoseNoise, double *predictionNoise) {
+    for (int i = 0; i < count; i++) {
+        const quint64 laneStep = step + quint64(i) * stepIncrement;
+        const quint64 lane = stream + quint64(i) * streamIncrement;
+        quint32 c0 = quint32(laneStep), c1 = quint32(laneStep >> 32), c2 = quint32(lane), c3 = quint32(lane >> 32);
+        quint32 key0 = quint32(seed), key1 = quint32(seed >> 32);
+        for (int round = 0; round < 10; round++) {
+            const quint64 p0 = quint64(0xD2511F53u) * c0;
+            const quint64 p1 = quint64(0xCD9E8D57u) * c2;
+            const quint32 n0 = quint32(p1 >> 32) ^ c1 ^ key0;
+            const quint32 n2 = quint32(p0 >> 32) ^ c3 ^ key1;
+            c1 = quint32(p1);
+            c3 = quint32(p0);
+            c0 = n0;
+            c2 = n2;
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+        glucoseNoise[i] = PhiloxRng::toDouble(c0, c1) * 0.2 - 0.1;
+        predictionNoise[i] = PhiloxRng::toDouble(c2, c3) * 0.2 - 0.1;
+    }
+}
+
+// Built per ISA like the cohort's ODE blocks: AVX2 and AVX-512 run 4 and 8
+// lanes of the 32x32->64 bit multiplies where SSE2 runs 2
+PUMP_TARGET_CLONES void PhiloxRng::noiseBlock(quint64 seed, quint64 firstStream, int count, quint64 step,
+                                              double *glucoseNoise, double *predictionNoise) {
+    noiseLanes(seed, step, 0, firstStream, 1, count, glucoseNoise, predictionNoise);
+}
+
+PUMP_TARGET_CLONES void PhiloxRng::noiseRange(quint64 firstStep, int count, double *glucoseNoise, double *predictionNoise) const {
+    noiseLanes(seedValue, firstStep, 1, stream, 0, count, glucoseNoise, predictionNoise);
+}
@@ -0,0 +1,104 @@
+#ifndef PHILOXRNG_H
+#define PHILOXRNG_H
+
+#include <QtGlobal>
+#include <cstring>
+
+// -------------------- Philox RNG --------------------
+// Counter-based Philox4x32-10 generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). Every output is a pure function of
+// (seed, stream, counter): there is no shared or locked state, streams can be
+// split off for free, jumping ahead is just moving the counter, and any block
+// can be recomputed on its own.
+//
+// The glucose model uses the simulation time step as the counter, so the two
+// noise values of a step can be replayed from the seed and step index alone.
+class PhiloxRng {
+public:
+    explicit PhiloxRng(quint64 seed = 0, quint64 stream = 0);
+
+    void seed(quint64 seed, quint64 stream = 0);
+    quint64 getSeed() const;
+    quint64 getStream() const;
+
+    // Independent generator with the same seed on another stream
+    PhiloxRng split(quint64 stream) const;
+
+    // Sequential use: each block gives two doubles
+    double generateDouble(); // [0, 1)
+    void fill(double *out, int count);
+    void jumpAhead(quint64 blocks);
+    void setPosition(quint64 block);
+    quint64 position() const;
+
+    // Random access: the block at a given counter
+    void block(quint64 counter, quint32 out[4]) const;
+    void doublesAt(quint64 counter, double &first, double &second) const;
+
+    // Glucose and prediction noise in [-0.1, 0.1) for one time step
+    void noiseAt(quint64 step, double &glucoseNoise, double &predictionNoise) const;
+
+    // Batch version of noiseAt for consecutive streams [firstStream, firstStream + count)
+    // at the same step, laid out so the rounds vectorize across streams
+    static void noiseBlock(quint64 seed, quint64 firstStream, int count, quint64 step,
+                           double *glucoseNoise, double *predictionNoise);
+    // Same for consecutive steps [firstStep, firstStep + count) of this stream
+    void noiseRange(quint64 firstStep, int count, double *glucoseNoise, double *predictionNoise) const;
+
+    static void philox(quint32 key0, quint32 key1, quint32 ctr[4]);
+    static double toDouble(quint32 low, quint32 high);
+
+private:
+    quint64 seedValue;
+    quint64 stream;
+    quint64 counter;
+    double spare;
+    bool hasSpare;
+};
+
+inline void PhiloxRng::philox(quint32 key0, quint32 key1, quint32 ctr[4]) {
+    for (int round = 0; round < 10; round++) {
+        const quint64 p0 = quint64(0xD2511F53u) * ctr[0];
+        const quint64 p1 = quint64(0xCD9E8D57u) * ctr[2];
+        const quint32 c0 = quint32(p1 >> 32) ^ ctr[1] ^ key0;
+        const quint32 c2 = quint32(p0 >> 32) ^ ctr[3] ^ key1;
+        ctr[0] = c0;
+        ctr[1] = quint32(p1);
+        ctr[2] = c2;
+        ctr[3] = quint32(p0);
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+inline double PhiloxRng::toDouble(quint32 low, quint32 high) {
+    // top 52 bits as the mantissa of a double in [1, 2), minus 1. Only integer
+    // ops and a bit cast, so it vectorizes (unlike a 64-bit int to double convert).
+    const quint64 bits = ((quint64(high) << 32) | low) >> 12 | 0x3FF0000000000000ull;
+    double d;
+    std::memcpy(&d, &bits, sizeof d);
+    return d - 1.0;
+}
+
+inline void PhiloxRng::block(quint64 ctrValue, quint32 out[4]) const {
+    out[0] = quint32(ctrValue);
+    out[1] = quint32(ctrValue >> 32);
+    out[2] = quint32(stream);
+    out[3] = quint32(stream >> 32);
+    philox(quint32(seedValue), quint32(seedValue >> 32), out);
+}
+
+inline void PhiloxRng::doublesAt(quint64 ctrValue, double &first, double &second) const {
+    quint32 out[4];
+    block(ctrValue, out);
+    first = toDouble(out[0], out[1]);
+    second = toDouble(out[2], out[3]);
+}
+
+inline void PhiloxRng::noiseAt(quint64 step, double &glucoseNoise, double &predictionNoise) const {
+    doublesAt(step, glucoseNoise, predictionNoise);
+    glucoseNoise = glucoseNoise * 0.2 - 0.1;
+    predictionNoise = predictionNoise * 0.2 - 0.1;
+}
+
+#endif // PHILOXRNG_H
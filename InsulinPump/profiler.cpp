@@ -0,0 +1,157 @@
+#include "profiler.h"
+#include <QtAlgorithms>
+
+// -------------------- Profiler --------------------
+std::atomic<Profiler::ThreadStats*> Profiler::threads(nullptr);
+
+// where the tick to ns calibration starts
+static const quint64 originTicks = Profiler::now();
+static const quint64 originNs = Profiler::steadyNs();
+
+static const char *const stageNames[Profiler::StageCount] = {
+    "step", "events", "state", "noise", "insulin", "absorption", "prediction", "basal", "signals",
+    "logging", "telemetry", "snapshot", "gui refresh", "gui labels", "gui chart", "gui log"
+};
+
+static const char *const counterNames[Profiler::CounterCount] = {
+    "steps", "due events", "signals", "hypo steps", "hyper steps", "gui refreshes", "gui snapshots"
+};
+
+const char *Profiler::stageName(Stage stage) {
+    return stageNames[stage];
+}
+
+const char *Profiler::counterName(Counter counter) {
+    return counterNames[counter];
+}
+
+// First use on a thread allocates its stats and pushes them on the list;
+// they're never freed, so a thread that has finished still shows up
+Profiler::ThreadStats &Profiler::local() {
+    thread_local ThreadStats *stats = nullptr;
+    if (!stats) {
+        stats = new ThreadStats(); // value-initialized, all zero
+        ThreadStats *head = threads.load(std::memory_order_relaxed);
+        do {
+            stats->next = head;
+        } while (!threads.compare_exchange_weak(head, stats, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return *stats;
+}
+
+// Assumes an invariant TSC (constant rate, synchronized across cores),
+// which every x86 of the last decade has. Any run longer than a millisecond
+// calibrates itself; a shorter one waits out the millisecond.
+double Profiler::nsPerTick() {
+#ifdef PUMP_PROFILE_TSC
+    quint64 ticks = now(), ns = steadyNs();
+    while (ns - originNs < 1000000 || ticks == originTicks) {
+        ticks = now();
+        ns = steadyNs();
+    }
+    return double(ns - originNs) / double(ticks - originTicks);
+#else
+    return 1.0;
+#endif
+}
+
+// 0-7 ticks one bucket each, then 8 buckets per power of two
+int Profiler::bucket(quint64 ticks) {
+    if (ticks < 8) return int(ticks);
+    const int exponent = 63 - int(qCountLeadingZeroBits(ticks));
+    const int index = (exponent - 2) * 8 + int((ticks >> (exponent - 3)) & 7);
+    return qMin(index, Buckets - 1);
+}
+
+quint64 Profiler::bucketValue(int bucket) {
+    if (bucket < 8) return quint64(bucket);
+    const int shift = bucket / 8 - 1;
+    const quint64 lower = quint64(8 + bucket % 8) << shift;
+    return lower + (quint64(1) << shift) / 2;
+}
+
+void Profiler::record(Stage stage, quint64 ticks) {
+    ThreadStats &s = local();
+    add(s.histogram[stage][bucket(ticks)], 1);
+    add(s.total[stage], ticks);
+    if (ticks > s.max[stage].load(std::memory_order_relaxed)) s.max[stage].store(ticks, std::memory_order_relaxed);
+}
+
+void Profiler::count(Counter counter, quint64 n) {
+    add(local().counters[counter], n);
+}
+
+Profiler::Summary Profiler::summary(Stage stage) {
+    quint64 histogram[Buckets] = {};
+    quint64 total = 0, max = 0;
+    Summary result;
+    for (ThreadStats *s = threads.load(std::memory_order_acquire); s; s = s->next) {
+        for (int b = 0; b < Buckets; b++) histogram[b] += s->histogram[stage][b].load(std::memory_order_relaxed);
+        total += s->total[stage].load(std::memory_order_relaxed);
+        max = qMax(max, s->max[stage].load(std::memory_order_relaxed));
+    }
+    for (int b = 0; b < Buckets; b++) result.count += histogram[b];
+    if (result.count == 0) return result;
+
+    // the smallest bucket holding at least p of the samples
+    const quint64 rank50 = (result.count + 1) / 2;
+    const quint64 rank99 = result.count - result.count / 100;
+    quint64 seen = 0, p50 = 0, p99 = 0;
+    for (int b = 0; b < Buckets; b++) {
+        if (seen < rank50 && seen + histogram[b] >= rank50) p50 = bucketValue(b);
+        if (seen < rank99 && seen + histogram[b] >= rank99) {
+            p99 = bucketValue(b);
+            break;
+        }
+        seen += histogram[b];
+    }
+
+    const double scale = nsPerTick();
+    result.total = total * scale;
+    result.mean = result.total / result.count;
+    result.p50 = p50 * scale;
+    result.p99 = p99 * scale;
+    result.max = max * scale;
+    return result;
+}
+
+quint64 Profiler::counter(Counter counter) {
+    quint64 total = 0;
+    for (ThreadStats *s = threads.load(std::memory_order_acquire); s; s = s->next) {
+        total += s->counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+QString Profiler::report() {
+    QString text("stage              count     mean ns    p50 ns    p99 ns    max ns   total ms\n");
+    for (int stage = 0; stage < StageCount; stage++) {
+        const Summary s = summary(Stage(stage));
+        if (s.count == 0) continue;
+        text += QString("%1 %2 %3 %4 %5 %6 %7\n")
+                    .arg(QString(stageName(Stage(stage))), -12)
+                    .arg(s.count, 12)
+                    .arg(s.mean, 11, 'f', 1)
+                    .arg(s.p50, 9, 'f', 0)
+                    .arg(s.p99, 9, 'f', 0)
+                    .arg(s.max, 9, 'f', 0)
+                    .arg(s.total / 1e6, 10, 'f', 2);
+    }
+    for (int c = 0; c < CounterCount; c++) {
+        text += QString("%1 %2\n").arg(QString(counterName(Counter(c))), -12).arg(counter(Counter(c)), 12);
+    }
+    return text;
+}
+
+// Racy against a thread recording at the same moment, which may put one
+// sample back; good enough to start a measurement over
+void Profiler::reset() {
+    for (ThreadStats *s = threads.load(std::memory_order_acquire); s; s = s->next) {
+        for (int stage = 0; stage < StageCount; stage++) {
+            for (int b = 0; b < Buckets; b++) s->histogram[stage][b].store(0, std::memory_order_relaxed);
+            s->total[stage].store(0, std::memory_order_relaxed);
+            s->max[stage].store(0, std::memory_order_relaxed);
+        }
+        for (int c = 0; c < CounterCount; c++) s->counters[c].store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QtGlobal>
+#include <QString>
+#include <atomic>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PUMP_PROFILE_TSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define PUMP_PROFILE_TSC
+#endif
+
+// -------------------- Profiler --------------------
+// Per-stage timers and counters for the step hot path and the GUI refresh.
+// The instrumentation points (PUMP_PROFILE_SCOPE, PUMP_PROFILE_COUNT) only
+// exist when PUMP_PROFILE is defined (qmake CONFIG+=pump_profile), otherwise
+// they compile to nothing.
+//
+// Each thread records into its own histograms, registered once in a
+// lock-free list and only ever written by that thread, so recording is a
+// clock read and a few relaxed stores. On x86 the clock is the time stamp
+// counter, a third to half the cost of a steady_clock read, converted to ns
+// only when reporting. report() merges every thread's histograms into count,
+// mean, p50, p99 and max per stage. Durations go into log-linear buckets
+// (8 per power of two), so percentiles are within 12.5%.
+class Profiler {
+public:
+    enum Stage {
+        Step,       // Device::runDevice as a whole
+        Events,     // due scheduled events, extended boluses included
+        State,      // pause/resume handling at the start of a step
+        Noise,      // the step's two noise values
+        Insulin,    // basal delivery and the glucose model
+        Absorption, // insulin on board absorbed
+        Prediction, // the 30 minute prediction
+        Basal,      // the basal rate decision
+        Signals,    // the per-step emits, with whatever is connected
+        Logging,    // event log records and the glucose history
+        Telemetry,  // the per-step telemetry row
+        Snapshot,   // publishing the GUI snapshot
+        GuiRefresh, // MainWindow::refreshDisplay as a whole
+        GuiLabels,  // glucose, IOB, cartridge and battery widgets
+        GuiChart,   // redrawing the chart
+        GuiLog,     // error panel and history view
+        StageCount
+    };
+    enum Counter { Steps, DueEvents, EmittedSignals, Hypo, Hyper, GuiRefreshes, GuiSnapshots, CounterCount };
+
+    static const int Buckets = 320; // up to 2^40 ticks
+
+    struct Summary {
+        quint64 count = 0;
+        double mean = 0.0;  // ns
+        double p50 = 0.0;   // ns
+        double p99 = 0.0;   // ns
+        double max = 0.0;   // ns
+        double total = 0.0; // ns
+    };
+
+    static quint64 steadyNs() {
+        return quint64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    // the profiling clock, in ticks
+    static quint64 now() {
+#ifdef PUMP_PROFILE_TSC
+        return __rdtsc();
+#else
+        return steadyNs();
+#endif
+    }
+    static double nsPerTick(); // measured against steady_clock since startup
+    static void record(Stage stage, quint64 ticks);
+    static void count(Counter counter, quint64 n = 1);
+
+    // Merged over every thread that recorded so far; safe while others record
+    static Summary summary(Stage stage);
+    static quint64 counter(Counter counter);
+    static QString report(); // a table of every stage that ran, then the counters
+    static void reset();     // zeroes every thread's histograms
+
+    static const char *stageName(Stage stage);
+    static const char *counterName(Counter counter);
+    static int bucket(quint64 ticks);
+    static quint64 bucketValue(int bucket); // middle of the bucket, in ticks
+
+private:
+    struct ThreadStats {
+        std::atomic<quint64> histogram[StageCount][Buckets];
+        std::atomic<quint64> total[StageCount];
+        std::atomic<quint64> max[StageCount];
+        std::atomic<quint64> counters[CounterCount];
+        ThreadStats *next;
+    };
+
+    static ThreadStats &local();
+    static std::atomic<ThreadStats*> threads;
+
+    // only the owning thread writes, no read-modify-write needed
+    static void add(std::atomic<quint64> &value, quint64 n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// Times the rest of the enclosing block
+class ProfileScope {
+public:
+    explicit ProfileScope(Profiler::Stage stage) : stage(stage), start(Profiler::now()) {}
+    ~ProfileScope() { Profiler::record(stage, Profiler::now() - start); }
+
+private:
+    Profiler::Stage stage;
+    quint64 start;
+};
+
+#define PUMP_PROFILE_CONCAT2(a, b) a##b
+#define PUMP_PROFILE_CONCAT(a, b) PUMP_PROFILE_CONCAT2(a, b)
+#ifdef PUMP_PROFILE
+#define PUMP_PROFILE_SCOPE(stage) ProfileScope PUMP_PROFILE_CONCAT(profileScope, __LINE__)(Profiler::stage)
+#define PUMP_PROFILE_COUNT(counter, n) Profiler::count(Profiler::counter, n)
+#else
+#define PUMP_PROFILE_SCOPE(stage) ((void)0)
+#define PUMP_PROFILE_COUNT(counter, n) ((void)0)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,161 @@
+#include "profilesweep.h"
+#include "pumpengine.h"
+#include "philoxrng.h"
+#include <utility>
+
+// -------------------- Sweep Space --------------------
+double SweepRange::at(int i) const {
+    if (steps <= 1) return min;
+    return min + (max - min) * i / (steps - 1);
+}
+
+static inline SweepPoint makePoint(double basalRate, double correctionFactor, double carbRatio, double targetGlucose) {
+    SweepPoint p;
+    p.basalRate = basalRate;
+    p.correctionFactor = correctionFactor;
+    p.carbRatio = qRound(carbRatio);
+    p.targetGlucose = targetGlucose;
+    return p;
+}
+
+QVector<SweepPoint> SweepSpace::grid() const {
+    const int nb = qMax(1, basalRate.steps), nc = qMax(1, correctionFactor.steps);
+    const int nr = qMax(1, carbRatio.steps), nt = qMax(1, targetGlucose.steps);
+    QVector<SweepPoint> points;
+    points.reserve(nb * nc * nr * nt);
+    for (int b = 0; b < nb; b++)
+        for (int c = 0; c < nc; c++)
+            for (int r = 0; r < nr; r++)
+                for (int t = 0; t < nt; t++)
+                    points.append(makePoint(basalRate.at(b), correctionFactor.at(c), carbRatio.at(r), targetGlucose.at(t)));
+    return points;
+}
+
+// one value per stratum in a shuffled order
+static QVector<double> stratified(const SweepRange &range, int count, PhiloxRng &rng) {
+    QVector<int> order(count);
+    for (int i = 0; i < count; i++) order[i] = i;
+    for (int i = count - 1; i > 0; i--) {
+        const int j = qMin(i, int(rng.generateDouble() * (i + 1)));
+        std::swap(order[i], order[j]);
+    }
+    QVector<double> values(count);
+    for (int i = 0; i < count; i++) {
+        values[i] = range.min + (range.max - range.min) * (order[i] + rng.generateDouble()) / count;
+    }
+    return values;
+}
+
+QVector<SweepPoint> SweepSpace::latinHypercube(int count, quint64 seed) const {
+    QVector<SweepPoint> points;
+    if (count <= 0) return points;
+    PhiloxRng rng(seed);
+    const QVector<double> b = stratified(basalRate, count, rng);
+    const QVector<double> c = stratified(correctionFactor, count, rng);
+    const QVector<double> r = stratified(carbRatio, count, rng);
+    const QVector<double> t = stratified(targetGlucose, count, rng);
+    points.reserve(count);
+    for (int i = 0; i < count; i++) points.append(makePoint(b[i], c[i], r[i], t[i]));
+    return points;
+}
+
+// -------------------- Profile Sweep --------------------
+ProfileSweep::ProfileSweep(int threads) : pool(threads), model(GlucoseModel::Classic), seed(0) {}
+
+int ProfileSweep::threadCount() const {
+    return pool.threadCount();
+}
+
+bool ProfileSweep::loadScenario(const QString &fileName) {
+    scenario.clear();
+    error.clear();
+    ScenarioReader reader;
+    if (!reader.open(fileName)) {
+        error = reader.errorString();
+        return false;
+    }
+    ScenarioEvent event;
+    while (reader.next(event)) scenario.append(event);
+    if (reader.hasError()) {
+        error = reader.errorString();
+        scenario.clear();
+        return false;
+    }
+    return true;
+}
+
+void ProfileSweep::setScenario(const QVector<ScenarioEvent> &events) {
+    scenario = events;
+    error.clear();
+}
+
+const QVector<ScenarioEvent> &ProfileSweep::getScenario() const {
+    return scenario;
+}
+
+QString ProfileSweep::errorString() const {
+    return error;
+}
+
+void ProfileSweep::setGlucoseModel(GlucoseModel::Kind model) {
+    this->model = model;
+}
+
+void ProfileSweep::setSeed(quint64 seed) {
+    this->seed = seed;
+}
+
+QVector<SweepResult> ProfileSweep::run(const QVector<SweepPoint> &points, int minutes) {
+    QVector<SweepResult> results(points.size());
+    minutes = qMax(0, minutes);
+    // each task only writes its own result
+    pool.run(points.size(), [&](int i) { results[i] = runPoint(points[i], minutes); });
+    return results;
+}
+
+// Same timing as ScenarioDriver: events for minute M are applied once M
+// minutes have passed, and the scenario clock keeps going while the pump is
+// stopped. Stepped minute by minute (no fast-forward) since every minute is
+// a sample. Insulin is counted off the cartridge, which basal, boluses and
+// extended boluses all draw from.
+SweepResult ProfileSweep::runPoint(const SweepPoint &point, int minutes) const {
+    SweepResult result;
+    result.point = point;
+
+    PumpEngine engine(seed);
+    engine.setupDevice();
+    engine.setBatteryDrain(false);
+    engine.setGlucoseModel(model);
+    engine.applyProfile(point.basalRate, point.correctionFactor, point.carbRatio, point.targetGlucose);
+    engine.state().basalRate = point.basalRate;
+    engine.startDevice();
+    result.summary.start = engine.state().timeStep + 1;
+
+    double cart = engine.state().cartLevel;
+    auto sample = [&result, &cart](const PumpState &pump, const StepResult &) {
+        result.summary.add(pump.currentGlucose);
+        if (pump.currentGlucose < ControlIQ::HypoThreshold) result.hypoMinutes++;
+        if (pump.currentGlucose >= ControlIQ::HyperThreshold) result.hyperMinutes++;
+        result.totalInsulin += qMax(0.0, cart - pump.cartLevel);
+        cart = pump.cartLevel;
+    };
+
+    int next = 0;
+    int clock = 0;
+    while (clock < minutes) {
+        for (; next < scenario.size() && scenario[next].minute <= clock; next++) {
+            const ScenarioEvent &e = scenario[next];
+            if (e.kind == ScenarioEvent::End) return result;
+            if (e.kind == ScenarioEvent::Profile) continue;
+            ScenarioDriver::apply(e, engine);
+            const bool refilled = e.kind == ScenarioEvent::Cartridge || e.kind == ScenarioEvent::Refill;
+            if (!refilled) result.totalInsulin += qMax(0.0, cart - engine.state().cartLevel);
+            cart = engine.state().cartLevel;
+        }
+
+        int quiet = minutes - clock;
+        if (next < scenario.size()) quiet = qMin(quiet, scenario[next].minute - clock);
+        clock += engine.isRunning() ? engine.run(quiet, sample) : quiet;
+    }
+    return result;
+}
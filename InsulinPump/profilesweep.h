@@ -0,0 +1,93 @@
+#ifndef PROFILESWEEP_H
+#define PROFILESWEEP_H
+
+#include <QVector>
+#include <QString>
+#include "glucosemodel.h"
+#include "historystore.h"
+#include "scenario.h"
+#include "workstealingpool.h"
+
+// -------------------- Sweep Point --------------------
+// One profile to try, the four values Device::applyProfile takes
+struct SweepPoint {
+    double basalRate = 1.0;
+    double correctionFactor = 1.8;
+    int carbRatio = 10;
+    double targetGlucose = 5.5;
+};
+
+// -------------------- Sweep Space --------------------
+// The range swept for each profile value. A range with one step (or
+// min == max) holds that value fixed.
+struct SweepRange {
+    double min = 0.0;
+    double max = 0.0;
+    int steps = 1; // grid points, ends included
+
+    SweepRange() {}
+    SweepRange(double min, double max, int steps = 1) : min(min), max(max), steps(steps) {}
+    double at(int i) const; // grid point i
+};
+
+struct SweepSpace {
+    SweepRange basalRate = SweepRange(1.0, 1.0);
+    SweepRange correctionFactor = SweepRange(1.8, 1.8);
+    SweepRange carbRatio = SweepRange(10, 10); // rounded to whole grams per unit
+    SweepRange targetGlucose = SweepRange(5.5, 5.5);
+
+    // Every combination of the grid points, basal rate varying slowest
+    QVector<SweepPoint> grid() const;
+    // 'count' points where each value falls in each of 'count' equal strata
+    // exactly once (Latin hypercube), jittered within the stratum. The same
+    // seed gives the same points.
+    QVector<SweepPoint> latinHypercube(int count, quint64 seed = 0) const;
+};
+
+// -------------------- Sweep Result --------------------
+// How a profile did over the scenario, one glucose sample per minute the
+// pump ran
+struct SweepResult {
+    SweepPoint point;
+    HistoryBucket summary;    // min, max, mean and time in range
+    int hypoMinutes = 0;      // glucose below ControlIQ::HypoThreshold
+    int hyperMinutes = 0;     // glucose at or above ControlIQ::HyperThreshold
+    double totalInsulin = 0.0; // units delivered, basal and boluses
+
+    double timeInRange() const { return summary.timeInRange(); } // fraction
+};
+
+// -------------------- Profile Sweep --------------------
+// Replays one scenario against many profiles in parallel, a headless
+// PumpEngine per point on the work stealing pool. The scenario is read once
+// and kept in memory; its profile lines are skipped since the point under
+// test is the profile. Every point starts from the same fresh pump on the
+// same noise stream, with battery drain off, so points differ only by their
+// profile and results don't depend on the thread count.
+class ProfileSweep {
+public:
+    explicit ProfileSweep(int threads = 0); // 0 = one per core
+
+    bool loadScenario(const QString &fileName); // false on a script error, see errorString
+    void setScenario(const QVector<ScenarioEvent> &events);
+    const QVector<ScenarioEvent> &getScenario() const;
+    QString errorString() const;
+
+    void setGlucoseModel(GlucoseModel::Kind model);
+    void setSeed(quint64 seed);
+
+    // Each point for up to 'minutes' scenario minutes (less after 'end')
+    QVector<SweepResult> run(const QVector<SweepPoint> &points, int minutes);
+    int threadCount() const;
+
+private:
+    SweepResult runPoint(const SweepPoint &point, int minutes) const;
+
+    WorkStealingPool pool;
+    QVector<ScenarioEvent> scenario;
+    QString error;
+    GlucoseModel::Kind model;
+    quint64 seed;
+};
+
+#endif // PROFILESWEEP_H
@@ -0,0 +1,308 @@
+#include "pumpengine.h"
+#include <algorithm>
+
+// -------------------- Pump Engine --------------------
+PumpEngine::PumpEngine(quint64 seed, quint64 stream)
+    : noise(seed, stream), trace(nullptr), traceCursor(0), batteryLevel(100), running(false), batteryDrain(true) {}
+
+// mirrors Device::setupDevice
+void PumpEngine::setupDevice() {
+    pump.basalRate = 1.0;
+    pump.currentGlucose = 5.5; // mmol/L baseline
+    pump.currentState = PumpState::Run;
+}
+
+void PumpEngine::startDevice() {
+    running = true;
+    pump.currentState = PumpState::Run;
+}
+
+void PumpEngine::stopDevice() {
+    running = false;
+    pump.currentState = PumpState::Stop;
+}
+
+void PumpEngine::applyProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose) {
+    pump.profileBasalRate = basalRate;
+    pump.correctionFactor = correctionFactor;
+    pump.carbRatio = carbRatio;
+    pump.targetGlucose = targetGlucose;
+}
+
+void PumpEngine::setState(PumpState::Mode mode) {
+    pump.currentState = mode;
+}
+
+void PumpEngine::chargeBattery() {
+    batteryLevel = 100;
+}
+
+void PumpEngine::setBatteryLevel(int level) {
+    batteryLevel = qBound(0, level, 100);
+}
+
+void PumpEngine::setBatteryDrain(bool enabled) {
+    batteryDrain = enabled;
+}
+
+void PumpEngine::setNoiseSource(const PhiloxRng &rng) {
+    noise = rng;
+}
+
+const PhiloxRng &PumpEngine::getNoiseSource() const {
+    return noise;
+}
+
+void PumpEngine::setGlucoseTrace(const CgmTrace *trace) {
+    this->trace = trace;
+    traceCursor = 0;
+}
+
+void PumpEngine::setGlucoseModel(GlucoseModel::Kind model) {
+    pump.glucoseModel = model;
+    pump.physiology = GlucoseModelState();
+}
+
+void PumpEngine::calculateBolus(double carbInput, double glucoseInput, double bolusDurationHour, double bolusDurationMin) {
+    pump.currentGlucose = glucoseInput;
+    BolusPlan b = ControlIQ::planBolus(pump, carbInput, glucoseInput, bolusDurationHour, bolusDurationMin);
+    ControlIQ::addCarbs(pump, carbInput);
+    simulateBolus(b.immediateBolus, b.immediateCorrection);
+    if (b.hours > 0) {
+        events.schedule(SimEvent::extendedBolus(pump.timeStep + 60, b.bolusPerHour, b.correctionPerHour, b.hours));
+    }
+}
+
+void PumpEngine::simulateBolus(double bolus, double correctionOnly) {
+    ControlIQ::applyBolus(pump, bolus, correctionOnly);
+    pump.cartLevel = qMax(0.0, pump.cartLevel - bolus);
+}
+
+void PumpEngine::scheduleEvent(const SimEvent &event) {
+    events.schedule(event);
+}
+
+// mirrors Device::checkpoint
+void PumpEngine::checkpoint(PumpCheckpoint &checkpoint) const {
+    checkpoint.timeStep = pump.timeStep;
+    checkpoint.batteryLevel = batteryLevel;
+    checkpoint.running = running;
+    checkpoint.pump = pump;
+    checkpoint.noiseSeed = noise.getSeed();
+    checkpoint.noiseStream = noise.getStream();
+    checkpoint.events = events.pending();
+    std::sort(checkpoint.events.begin(), checkpoint.events.end(),
+              [](const SimEvent &a, const SimEvent &b) { return a.sequence < b.sequence; });
+}
+
+void PumpEngine::restore(const PumpCheckpoint &checkpoint) {
+    pump = checkpoint.pump;
+    pump.timeStep = checkpoint.timeStep;
+    batteryLevel = checkpoint.batteryLevel;
+    running = checkpoint.running;
+    noise.seed(checkpoint.noiseSeed, checkpoint.noiseStream);
+    last = StepResult();
+    events.clear();
+    for (const SimEvent &e : checkpoint.events) {
+        events.schedule(e);
+    }
+}
+
+// mirrors InsulinControlSystem::runDueEvents
+void PumpEngine::runDueEvents() {
+    SimEvent e;
+    while (events.takeDue(pump.timeStep, e)) {
+        switch (e.kind) {
+        case SimEvent::ExtendedBolus:
+            if (pump.currentState != PumpState::Pause) {
+                simulateBolus(e.values[0], e.values[1]);
+                e.remaining--;
+            }
+            if (e.remaining > 0) {
+                e.due += 60;
+                events.schedule(e);
+            }
+            break;
+        case SimEvent::ProfileSwitch:
+            applyProfile(e.values[0], e.values[1], int(e.values[2]), e.values[3]);
+            break;
+        case SimEvent::PauseInsulin:
+            if (pump.currentState != PumpState::Stop) pump.currentState = PumpState::Pause;
+            break;
+        case SimEvent::ResumeInsulin:
+            if (pump.currentState != PumpState::Stop) pump.currentState = PumpState::Resume;
+            break;
+        }
+    }
+}
+
+const SimEventQueue &PumpEngine::getEventQueue() const {
+    return events;
+}
+
+int PumpEngine::run(int minutes) {
+    int done = 0;
+    while (running && done < minutes) {
+        done += fastForward(minutes - done);
+    }
+    return done;
+}
+
+// Minutes that can be skipped before the next one needs a full step: none
+// may run an event or drain the battery empty
+int PumpEngine::idleMinutes(int minutes) const {
+    const bool paused = pump.currentState == PumpState::Pause;
+    const bool suspended = pump.currentState == PumpState::Run && pump.basalRate == 0.0;
+    if (!running || trace || pump.glucoseModel != GlucoseModel::Classic || !(paused || suspended)) return 0;
+
+    int idle = minutes;
+    if (!events.isEmpty()) {
+        idle = qMin(idle, events.nextDue() - pump.timeStep - 1);
+    }
+    if (batteryDrain) {
+        // one percent every third time step, keep at least one left
+        const int lastStep = 3 * (pump.timeStep / 3 + batteryLevel - 1) + 2;
+        idle = qMin(idle, lastStep - pump.timeStep);
+    }
+    return qMax(0, idle);
+}
+
+// One idle minute the way step() computes it: ClassicModel::basal (x - 0.0
+// is x for the suspended pump), the noise, rounding to cents, absorption.
+// False, with nothing changed, when a suspended pump's prediction lands in
+// the reduce band; every other band keeps a 0 rate at 0.
+static bool idleMinute(bool paused, double targetGlucose, double glucoseNoise, double predictionNoise,
+                       double &glucose, double &insulinOnBoard) {
+    const double nextGlucose = ControlIQ::roundCents((paused ? glucose + 0.05 : glucose) + glucoseNoise);
+    double nextInsulin = insulinOnBoard * 0.98;
+    if (nextInsulin <= 0.01) nextInsulin = 0.0;
+    if (!paused) {
+        const double predicted = ControlIQ::roundCents(nextGlucose - nextInsulin * 0.1667 + predictionNoise);
+        if (predicted > targetGlucose - 0.1 && predicted <= targetGlucose + 0.03) return false;
+    }
+    glucose = nextGlucose;
+    insulinOnBoard = nextInsulin;
+    return true;
+}
+
+// While paused no insulin goes in and the basal decision is undone by the
+// next minute, so only the glucose walk and the insulin decay are carried.
+// A suspended pump (basal 0) stays suspended unless the prediction lands in
+// the reduce band, which is the one minute left to a full step. The last
+// minute is always a full step, so lastStep() and the basal rate come out
+// exactly as stepping.
+//
+// The skip works a chunk of minutes at a time instead of minute by minute:
+//  - Glucose sits on the cents grid after every step, and rounding g + d to
+//    cents is g plus d rounded, as long as d (drift plus noise, in cents) is
+//    not within TieCents of a half cent. A chunk adds up its rounded steps as
+//    whole cents; one that has a near-tie is stepped minute by minute.
+//  - Insulin decay is only multiplied out until it drops to 0, which is a
+//    few hundred minutes at most, and stays 0 after that.
+//  - For a suspended pump the chunk's glucose range, the insulin on board
+//    and the largest prediction noise bound the prediction. A chunk that
+//    can't reach the reduce band skips the per-minute check; one that can
+//    is stepped minute by minute.
+// Only the noise itself is still drawn per minute, vectorized across the chunk.
+int PumpEngine::fastForward(int minutes) {
+    if (!running || minutes <= 0) return 0;
+
+    static const int Chunk = 256;
+    static const double TieCents = 1e-6;         // far above the double error on g + d, for any glucose below 1e5
+    static const qint64 MaxCents = 10000000;
+    const int idle = idleMinutes(minutes - 1);
+    const bool paused = pump.currentState == PumpState::Pause;
+    const double driftCents = paused ? 5.0 : 0.0; // ClassicModel::basal
+    double glucose = pump.currentGlucose;
+    double insulinOnBoard = pump.insulinOnBoard;
+    int t = pump.timeStep;
+    int skipped = 0;
+    bool crossed = false;
+    double glucoseNoise[Chunk], predictionNoise[Chunk];
+    while (skipped < idle && !crossed) {
+        const int chunk = qMin(Chunk, idle - skipped);
+        noise.noiseRange(quint64(t) + 1, chunk, glucoseNoise, predictionNoise);
+
+        qint64 cents = qRound64(glucose * 100);
+        bool bulk = cents / 100.0 == glucose && qAbs(cents) < MaxCents;
+        if (bulk) {
+            // whole cents per minute; the offset keeps d positive so the
+            // int conversion floors, and the loop vectorizes
+            int steps[Chunk];
+            int ties = 0;
+            int total = 0;
+            for (int i = 0; i < chunk; i++) {
+                const double d = glucoseNoise[i] * 100 + driftCents + 16.5;
+                const int whole = int(d);
+                const double fraction = d - whole;
+                ties += fraction < TieCents || fraction > 1.0 - TieCents;
+                steps[i] = whole - 16;
+                total += steps[i];
+            }
+            bulk = ties == 0;
+            if (bulk && !paused) {
+                // how far the walk strays within the chunk; insulin only
+                // decays, and prediction noise is within [-0.1, 0.1) before
+                // the prediction is rounded to cents
+                qint64 walk = cents, low = cents, high = cents;
+                for (int i = 0; i < chunk; i++) {
+                    walk += steps[i];
+                    low = qMin(low, walk);
+                    high = qMax(high, walk);
+                }
+                const double lowest = low / 100.0 - insulinOnBoard * 0.1667 - 0.1 - 0.006;
+                const double highest = high / 100.0 + 0.1 + 0.006;
+                bulk = highest <= pump.targetGlucose - 0.1 || lowest > pump.targetGlucose + 0.03;
+            }
+            cents += total;
+            if (bulk) {
+                glucose = cents / 100.0;
+                for (int i = 0; i < chunk && insulinOnBoard != 0.0; i++) {
+                    insulinOnBoard *= 0.98;
+                    if (insulinOnBoard <= 0.01) insulinOnBoard = 0.0;
+                }
+                t += chunk;
+                skipped += chunk;
+            }
+        }
+        if (!bulk) {
+            for (int i = 0; i < chunk; i++) {
+                if (!idleMinute(paused, pump.targetGlucose, glucoseNoise[i], predictionNoise[i], glucose, insulinOnBoard)) {
+                    crossed = true;
+                    break;
+                }
+                t++;
+                skipped++;
+            }
+        }
+    }
+
+    if (skipped > 0) {
+        if (batteryDrain) batteryLevel -= t / 3 - pump.timeStep / 3;
+        pump.timeStep = t;
+        pump.currentGlucose = glucose;
+        pump.insulinOnBoard = insulinOnBoard;
+    }
+    step();
+    return skipped + 1;
+}
+
+const PumpState &PumpEngine::state() const {
+    return pump;
+}
+
+PumpState &PumpEngine::state() {
+    return pump;
+}
+
+const StepResult &PumpEngine::lastStep() const {
+    return last;
+}
+
+int PumpEngine::getBatteryLevel() const {
+    return batteryLevel;
+}
+
+bool PumpEngine::isRunning() const {
+    return running;
+}
@@ -0,0 +1,142 @@
+#ifndef PUMPENGINE_H
+#define PUMPENGINE_H
+
+#include <QtGlobal>
+#include "controliq.h"
+#include "philoxrng.h"
+#include "simeventqueue.h"
+#include "checkpoint.h"
+#include "cgmtrace.h"
+
+// -------------------- Pump Engine --------------------
+// Headless counterpart of Device + InsulinControlSystem for batch runs.
+// No QObject, no timers and no signals: it steps the same ControlIQ logic as
+// fast as possible. With the same seed (see Device::setNoiseSeed) it follows
+// the exact same trajectory as the GUI.
+class PumpEngine {
+public:
+    explicit PumpEngine(quint64 seed = 0, quint64 stream = 0);
+
+    void setupDevice();
+    void startDevice();
+    void stopDevice();
+    void applyProfile(double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
+    void setState(PumpState::Mode mode);
+    void chargeBattery();
+    void setBatteryLevel(int level);
+    void setBatteryDrain(bool enabled); // off for long runs that shouldn't power down
+    void setNoiseSource(const PhiloxRng &rng);
+    const PhiloxRng &getNoiseSource() const;
+    void setGlucoseTrace(const CgmTrace *trace); // recorded readings replace the glucose model, nullptr to stop
+    void setGlucoseModel(GlucoseModel::Kind model); // the model's own state starts over
+
+    // same bolus calculator and event handling as InsulinControlSystem
+    void calculateBolus(double carbInput, double glucoseInput, double bolusDurationHour, double bolusDurationMin);
+    void simulateBolus(double bolus, double correctionOnly);
+    void scheduleEvent(const SimEvent &event);
+    void runDueEvents();
+    const SimEventQueue &getEventQueue() const;
+
+    // Same checkpoint as Device, so a GUI run can be continued headless (see WhatIfRunner)
+    void checkpoint(PumpCheckpoint &checkpoint) const;
+    void restore(const PumpCheckpoint &checkpoint);
+
+    void step(); // one minute, same as Device::runDevice
+    // Up to 'minutes' minutes, skipping the per-minute work where nothing
+    // can happen: while paused, or suspended by the controller, with the
+    // classic model, no trace and no event due, only glucose drift, noise
+    // and insulin decay change. Chunks of minutes are added up in whole
+    // cents; only the noise is still drawn per minute. Same result as
+    // stepping, bit for bit. Returns the minutes simulated, at least 1
+    // while running.
+    int fastForward(int minutes);
+    // The glucose model is picked once per run, the loop itself steps a
+    // single ControlIQ::step<Model> specialization
+    int run(int minutes); // returns the number of minutes actually simulated, fast-forwards where it can
+    template <typename Observer>
+    int run(int minutes, Observer onStep); // onStep(const PumpState &, const StepResult &)
+
+    const PumpState &state() const;
+    PumpState &state();
+    const StepResult &lastStep() const;
+    int getBatteryLevel() const;
+    bool isRunning() const;
+
+private:
+    template <typename Model>
+    void stepWith();
+    int idleMinutes(int minutes) const; // how far fastForward can skip before a full step
+
+    template <typename Model, typename Observer>
+    int runWith(int minutes, Observer onStep);
+
+    PumpState pump;
+    PhiloxRng noise;
+    SimEventQueue events;
+    StepResult last;
+    const CgmTrace *trace;
+    qint64 traceCursor; // this engine's place in trace, which may be shared
+    int batteryLevel;
+    bool running;
+    bool batteryDrain;
+};
+
+inline void PumpEngine::step() {
+    switch (pump.glucoseModel) {
+    case GlucoseModel::Bergman: stepWith<BergmanModel>(); break;
+    case GlucoseModel::Compartment: stepWith<CompartmentModel>(); break;
+    default: stepWith<ClassicModel>(); break;
+    }
+}
+
+template <typename Model>
+inline void PumpEngine::stepWith() {
+    if (!running) return;
+
+    pump.timeStep++;
+    if (!events.isEmpty() && events.nextDue() <= pump.timeStep) {
+        runDueEvents();
+    }
+    if (pump.currentState != PumpState::Stop) {
+        // same noise as InsulinControlSystem::updateInsulin for this step
+        double glucoseNoise, predictionNoise, reading;
+        noise.noiseAt(pump.timeStep, glucoseNoise, predictionNoise);
+        if (trace && trace->glucoseAt(pump.timeStep, reading, traceCursor)) {
+            last = ControlIQ::sensorStep<Model>(pump, reading, predictionNoise);
+        } else {
+            last = ControlIQ::step<Model>(pump, glucoseNoise, predictionNoise);
+        }
+    } else {
+        last = StepResult();
+    }
+
+    if (batteryDrain && pump.timeStep % 3 == 0) {
+        batteryLevel -= 1;
+        if (batteryLevel <= 0) {
+            batteryLevel = 0;
+            stopDevice();
+        }
+    }
+}
+
+template <typename Observer>
+int PumpEngine::run(int minutes, Observer onStep) {
+    switch (pump.glucoseModel) {
+    case GlucoseModel::Bergman: return runWith<BergmanModel>(minutes, onStep);
+    case GlucoseModel::Compartment: return runWith<CompartmentModel>(minutes, onStep);
+    default: return runWith<ClassicModel>(minutes, onStep);
+    }
+}
+
+template <typename Model, typename Observer>
+int PumpEngine::runWith(int minutes, Observer onStep) {
+    int done = 0;
+    while (running && done < minutes) {
+        stepWith<Model>();
+        onStep(pump, last);
+        done++;
+    }
+    return done;
+}
+
+#endif // PUMPENGINE_H
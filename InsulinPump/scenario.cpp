@@ -0,0 +1,270 @@
+#include "scenario.h"
+#include "insulinpump.h"
+#include "pumpengine.h"
+#include "tracerecorder.h"
+#include <QIODevice>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+// -------------------- Scenario Reader --------------------
+const int ScenarioReader::MaxLineLength;
+
+struct ScenarioCommand {
+    const char *name;
+    ScenarioEvent::Kind kind;
+    int minArguments;
+    int maxArguments;
+};
+
+static const ScenarioCommand commands[] = {
+    { "meal", ScenarioEvent::Meal, 1, 4 },
+    { "glucose", ScenarioEvent::Glucose, 1, 1 },
+    { "profile", ScenarioEvent::Profile, 4, 4 },
+    { "pause", ScenarioEvent::Pause, 0, 0 },
+    { "resume", ScenarioEvent::Resume, 0, 0 },
+    { "occlusion", ScenarioEvent::Occlusion, 0, 0 },
+    { "resolve", ScenarioEvent::Resolve, 0, 0 },
+    { "disconnect", ScenarioEvent::Disconnect, 0, 0 },
+    { "reconnect", ScenarioEvent::Reconnect, 0, 0 },
+    { "battery", ScenarioEvent::Battery, 1, 1 },
+    { "charge", ScenarioEvent::Charge, 0, 0 },
+    { "cartridge", ScenarioEvent::Cartridge, 1, 1 },
+    { "refill", ScenarioEvent::Refill, 0, 0 },
+    { "end", ScenarioEvent::End, 0, 0 },
+};
+
+static inline char *skipSpaces(char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+static inline bool atLineEnd(const char *p) {
+    return *p == '\0' || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+ScenarioReader::ScenarioReader() : input(nullptr), line(0), lastMinute(0) {}
+
+bool ScenarioReader::open(const QString &fileName) {
+    file.close();
+    file.setFileName(fileName);
+    line = 0;
+    lastMinute = 0;
+    error.clear();
+    if (!file.open(QIODevice::ReadOnly)) {
+        input = nullptr;
+        error = "cannot open " + fileName;
+        return false;
+    }
+    input = &file;
+    return true;
+}
+
+void ScenarioReader::setDevice(QIODevice *device) {
+    file.close();
+    input = device;
+    line = 0;
+    lastMinute = 0;
+    error.clear();
+}
+
+bool ScenarioReader::next(ScenarioEvent &event) {
+    if (!input || !error.isEmpty()) return false;
+    for (;;) {
+        const qint64 length = input->readLine(buffer, sizeof(buffer));
+        if (length <= 0) return false;
+        line++;
+        if (length == sizeof(buffer) - 1 && buffer[length - 1] != '\n') return fail("line too long");
+
+        char *p = skipSpaces(buffer);
+        if (atLineEnd(p)) continue; // blank or comment
+        return parse(p, event);
+    }
+}
+
+bool ScenarioReader::parse(char *p, ScenarioEvent &event) {
+    char *end;
+    const long minute = strtol(p, &end, 10);
+    if (end == p || minute < 0 || minute > INT_MAX) return fail("expected a minute");
+    if (minute < lastMinute) return fail("minutes go backwards");
+
+    p = skipSpaces(end);
+    const char *name = p;
+    while (*p >= 'a' && *p <= 'z') p++;
+    const int nameLength = int(p - name);
+    const ScenarioCommand *command = nullptr;
+    for (const ScenarioCommand &c : commands) {
+        if (int(strlen(c.name)) == nameLength && strncmp(c.name, name, nameLength) == 0) {
+            command = &c;
+            break;
+        }
+    }
+    if (!command) return fail("unknown command");
+
+    event = ScenarioEvent();
+    event.minute = int(minute);
+    event.kind = command->kind;
+    p = skipSpaces(p);
+    while (!atLineEnd(p) && event.argumentCount < command->maxArguments) {
+        const double value = strtod(p, &end);
+        if (end == p) return fail("expected a number");
+        event.values[event.argumentCount++] = value;
+        p = skipSpaces(end);
+    }
+    if (event.argumentCount < command->minArguments) return fail("missing arguments");
+
+    lastMinute = event.minute;
+    return true;
+}
+
+bool ScenarioReader::fail(const char *message) {
+    error = QString("line %1: %2").arg(line).arg(message);
+    return false;
+}
+
+bool ScenarioReader::hasError() const {
+    return !error.isEmpty();
+}
+
+QString ScenarioReader::errorString() const {
+    return error;
+}
+
+qint64 ScenarioReader::lineNumber() const {
+    return line;
+}
+
+// -------------------- Scenario Driver --------------------
+ScenarioDriver::ScenarioDriver() : hasPending(false), exhausted(false), ended(false), clock(0) {}
+
+ScenarioReader &ScenarioDriver::getReader() {
+    return reader;
+}
+
+bool ScenarioDriver::open(const QString &fileName) {
+    hasPending = false;
+    exhausted = false;
+    ended = false;
+    clock = 0;
+    return reader.open(fileName);
+}
+
+int ScenarioDriver::minute() const {
+    return clock;
+}
+
+bool ScenarioDriver::finished() const {
+    return ended || reader.hasError();
+}
+
+int ScenarioDriver::run(PumpEngine &engine, int minutes) {
+    return drive(engine, minutes);
+}
+
+int ScenarioDriver::run(Device &device, int minutes) {
+    return drive(device, minutes);
+}
+
+template <typename Pump>
+int ScenarioDriver::drive(Pump &pump, int minutes) {
+    int done = 0;
+    while (done < minutes && !finished()) {
+        // everything due by now, in file order
+        for (;;) {
+            if (!hasPending && !exhausted) {
+                hasPending = reader.next(pending);
+                exhausted = !hasPending;
+            }
+            if (!hasPending || pending.minute > clock) break;
+            hasPending = false;
+            if (pending.kind == ScenarioEvent::End) {
+                ended = true;
+                break;
+            }
+            apply(pending, pump);
+        }
+        if (finished()) break;
+
+        int quiet = minutes - done;
+        if (hasPending) quiet = qMin(quiet, pending.minute - clock);
+        const int stepped = step(pump, quiet);
+        clock += stepped;
+        done += stepped;
+    }
+    return done;
+}
+
+// a stopped engine stands still, the scenario clock doesn't
+int ScenarioDriver::step(PumpEngine &engine, int minutes) {
+    return engine.isRunning() ? engine.fastForward(minutes) : minutes;
+}
+
+int ScenarioDriver::step(Device &device, int minutes) {
+    Q_UNUSED(minutes);
+    device.runDevice();
+    return 1;
+}
+
+// The engine has no GUI, so occlusions and disconnects both just stop it
+void ScenarioDriver::apply(const ScenarioEvent &e, PumpEngine &engine) {
+    PumpState &pump = engine.state();
+    switch (e.kind) {
+    case ScenarioEvent::Meal:
+        engine.calculateBolus(e.values[0], e.argumentCount > 1 ? e.values[1] : pump.currentGlucose, e.values[2], e.values[3]);
+        break;
+    case ScenarioEvent::Glucose: pump.currentGlucose = e.values[0]; break;
+    case ScenarioEvent::Profile: engine.applyProfile(e.values[0], e.values[1], int(e.values[2]), e.values[3]); break;
+    case ScenarioEvent::Pause: engine.setState(PumpState::Pause); break;
+    case ScenarioEvent::Resume: engine.setState(PumpState::Resume); break;
+    case ScenarioEvent::Occlusion:
+    case ScenarioEvent::Disconnect: engine.stopDevice(); break;
+    case ScenarioEvent::Resolve:
+    case ScenarioEvent::Reconnect: engine.startDevice(); break;
+    case ScenarioEvent::Battery: engine.setBatteryLevel(int(e.values[0])); break;
+    case ScenarioEvent::Charge: engine.chargeBattery(); break;
+    case ScenarioEvent::Cartridge: pump.cartLevel = qBound(0.0, e.values[0], 300.0); break;
+    case ScenarioEvent::Refill: pump.cartLevel = 300.0; break;
+    case ScenarioEvent::End: break;
+    }
+}
+
+// Same calls the GUI makes for the matching widgets
+void ScenarioDriver::apply(const ScenarioEvent &e, Device &device) {
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    switch (e.kind) {
+    case ScenarioEvent::Meal:
+        ics->calculateBolus(e.values[0], e.argumentCount > 1 ? e.values[1] : ics->getCurrentGlucose(), e.values[2], e.values[3]);
+        break;
+    case ScenarioEvent::Glucose: ics->setCurrentGlucose(e.values[0]); break;
+    case ScenarioEvent::Profile: device.applyProfile(e.values[0], e.values[1], int(e.values[2]), e.values[3]); break;
+    case ScenarioEvent::Pause: ics->setState(InsulinControlSystem::Pause); break;
+    case ScenarioEvent::Resume: ics->setState(InsulinControlSystem::Resume); break;
+    case ScenarioEvent::Occlusion:
+        TraceRecorder::instant("device", "occlusion");
+        device.logText("Occlusion occured, check infusion site for blockages.", LogRecord::Error);
+        device.stopDevice();
+        break;
+    case ScenarioEvent::Disconnect:
+        TraceRecorder::instant("device", "disconnect");
+        device.logText("Device disconnected, reconnect device to user.", LogRecord::Error);
+        device.stopDevice();
+        break;
+    case ScenarioEvent::Resolve:
+        TraceRecorder::instant("device", "occlusion resolved");
+        device.startDevice();
+        device.logText("Occlusion resolved, infusion site has no blockages.", LogRecord::Error);
+        break;
+    case ScenarioEvent::Reconnect:
+        TraceRecorder::instant("device", "reconnect");
+        device.startDevice();
+        device.logText("Device reconnected to user.", LogRecord::Error);
+        break;
+    case ScenarioEvent::Battery: device.setBatteryLevel(int(e.values[0])); break;
+    case ScenarioEvent::Charge: device.chargeBattery(); break;
+    case ScenarioEvent::Cartridge:
+        ics->depleteCartridge(ics->getCartridgeLevel() - qBound(0.0, e.values[0], 300.0));
+        break;
+    case ScenarioEvent::Refill: device.refillCartridge(); break;
+    case ScenarioEvent::End: break;
+    }
+}
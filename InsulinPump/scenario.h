@@ -0,0 +1,104 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QFile>
+
+class QIODevice;
+class Device;
+class PumpEngine;
+
+// -------------------- Scenario Event --------------------
+// One line of a scenario script:
+//
+//   # comment
+//   <minute> meal <carbs> [glucose] [hours] [minutes]   bolus calculator, glucose defaults to the current reading
+//   <minute> glucose <mmol/L>                            new glucose reading
+//   <minute> profile <basal> <correction> <carb ratio> <target>
+//   <minute> pause | resume                              insulin delivery
+//   <minute> occlusion | resolve | disconnect | reconnect
+//   <minute> battery <percent> | charge
+//   <minute> cartridge <units> | refill
+//   <minute> end
+//
+// Minutes are scenario time from the start of the replay and must not go
+// backwards. Anything after the arguments is ignored.
+struct ScenarioEvent {
+    enum Kind { Meal, Glucose, Profile, Pause, Resume, Occlusion, Resolve, Disconnect, Reconnect,
+                Battery, Charge, Cartridge, Refill, End };
+
+    int minute = 0;
+    Kind kind = End;
+    int argumentCount = 0;
+    double values[4] = { 0.0, 0.0, 0.0, 0.0 };
+};
+
+// -------------------- Scenario Reader --------------------
+// Parses a scenario one line at a time from a file or any QIODevice, into a
+// fixed line buffer, so the size of the script doesn't matter.
+class ScenarioReader {
+public:
+    static const int MaxLineLength = 1024;
+
+    ScenarioReader();
+
+    bool open(const QString &fileName);
+    void setDevice(QIODevice *device); // not owned
+    bool next(ScenarioEvent &event);   // false at the end of the script or on an error
+    bool hasError() const;
+    QString errorString() const;       // includes the line number
+    qint64 lineNumber() const;
+
+private:
+    bool parse(char *line, ScenarioEvent &event);
+    bool fail(const char *message);
+
+    QFile file;
+    QIODevice *input;
+    qint64 line;
+    int lastMinute;
+    QString error;
+    char buffer[MaxLineLength];
+};
+
+// -------------------- Scenario Driver --------------------
+// Replays a scenario into a Device or a PumpEngine. The driver keeps its own
+// scenario clock, one minute per step, so events still come due while the
+// pump is disconnected and its own time step stands still. Events for
+// minute M are applied once M minutes have been stepped, before the next
+// step. Only one event is read ahead. The engine fast-forwards up to the
+// next event (see PumpEngine::fastForward).
+class ScenarioDriver {
+public:
+    ScenarioDriver();
+
+    ScenarioReader &getReader();
+    bool open(const QString &fileName);
+
+    // Step up to 'minutes' minutes; returns the number done (fewer after 'end')
+    int run(PumpEngine &engine, int minutes);
+    int run(Device &device, int minutes);
+
+    int minute() const;    // scenario clock
+    bool finished() const; // reached 'end' or a script error
+
+    static void apply(const ScenarioEvent &event, PumpEngine &engine);
+    static void apply(const ScenarioEvent &event, Device &device);
+
+private:
+    template <typename Pump>
+    int drive(Pump &pump, int minutes);
+    // up to 'minutes' minutes with no scenario event in between, returns how many
+    static int step(PumpEngine &engine, int minutes);
+    static int step(Device &device, int minutes);
+
+    ScenarioReader reader;
+    ScenarioEvent pending;
+    bool hasPending;
+    bool exhausted;
+    bool ended;
+    int clock;
+};
+
+#endif // SCENARIO_H
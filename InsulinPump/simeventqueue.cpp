@@ -0,0 +1,111 @@
+#include "simeventqueue.h"
+#include <climits>
+
+// -------------------- Simulation Event --------------------
+SimEvent SimEvent::extendedBolus(int due, double bolusPerHour, double correctionPerHour, int hours) {
+    SimEvent e;
+    e.due = due;
+    e.kind = ExtendedBolus;
+    e.remaining = hours;
+    e.values[0] = bolusPerHour;
+    e.values[1] = correctionPerHour;
+    return e;
+}
+
+SimEvent SimEvent::profileSwitch(int due, double basalRate, double correctionFactor, int carbRatio, double targetGlucose) {
+    SimEvent e;
+    e.due = due;
+    e.kind = ProfileSwitch;
+    e.values[0] = basalRate;
+    e.values[1] = correctionFactor;
+    e.values[2] = carbRatio;
+    e.values[3] = targetGlucose;
+    return e;
+}
+
+SimEvent SimEvent::pauseInsulin(int due) {
+    SimEvent e;
+    e.due = due;
+    e.kind = PauseInsulin;
+    return e;
+}
+
+SimEvent SimEvent::resumeInsulin(int due) {
+    SimEvent e;
+    e.due = due;
+    e.kind = ResumeInsulin;
+    return e;
+}
+
+// -------------------- Simulation Event Queue --------------------
+SimEventQueue::SimEventQueue(int capacity) : nextSequence(0) {
+    heap.reserve(capacity);
+}
+
+void SimEventQueue::schedule(SimEvent event) {
+    event.sequence = nextSequence++;
+    heap.append(event);
+    siftUp(heap.size() - 1);
+}
+
+bool SimEventQueue::takeDue(int now, SimEvent &event) {
+    if (heap.isEmpty() || heap.first().due > now) return false;
+
+    event = heap.first();
+    heap.first() = heap.last();
+    heap.removeLast();
+    if (!heap.isEmpty()) {
+        siftDown(0);
+    }
+    return true;
+}
+
+int SimEventQueue::nextDue() const {
+    return heap.isEmpty() ? INT_MAX : heap.first().due;
+}
+
+int SimEventQueue::size() const {
+    return heap.size();
+}
+
+bool SimEventQueue::isEmpty() const {
+    return heap.isEmpty();
+}
+
+void SimEventQueue::clear() {
+    heap.clear(); // keeps the reserved capacity
+}
+
+const QVector<SimEvent> &SimEventQueue::pending() const {
+    return heap;
+}
+
+bool SimEventQueue::earlier(const SimEvent &a, const SimEvent &b) {
+    // sequence comparison survives wrap-around as long as fewer than 2^31 events are pending
+    return a.due < b.due || (a.due == b.due && qint32(a.sequence - b.sequence) < 0);
+}
+
+void SimEventQueue::siftUp(int i) {
+    SimEvent moving = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!earlier(moving, heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = moving;
+}
+
+void SimEventQueue::siftDown(int i) {
+    const int n = heap.size();
+    SimEvent moving = heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && earlier(heap[child + 1], heap[child])) child++;
+        if (!earlier(heap[child], moving)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = moving;
+}
@@ -0,0 +1,52 @@
+#ifndef SIMEVENTQUEUE_H
+#define SIMEVENTQUEUE_H
+
+#include <QtGlobal>
+#include <QVector>
+
+// -------------------- Simulation Event --------------------
+// Something that has to happen at a given simulated minute. Plain value so a
+// queue of them can live in one preallocated array.
+struct SimEvent {
+    enum Kind { ExtendedBolus, ProfileSwitch, PauseInsulin, ResumeInsulin };
+
+    int due = 0;           // simulated minute (time step)
+    quint32 sequence = 0;  // keeps events due on the same minute in FIFO order
+    Kind kind = ExtendedBolus;
+    int remaining = 0;     // extended bolus: hourly deliveries left
+    // extended bolus: bolus per hour, correction per hour
+    // profile switch: basal rate, correction factor, carb ratio, target glucose
+    double values[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+    static SimEvent extendedBolus(int due, double bolusPerHour, double correctionPerHour, int hours);
+    static SimEvent profileSwitch(int due, double basalRate, double correctionFactor, int carbRatio, double targetGlucose);
+    static SimEvent pauseInsulin(int due);
+    static SimEvent resumeInsulin(int due);
+};
+
+// -------------------- Simulation Event Queue --------------------
+// Binary min-heap on (due, sequence) stored in a reserved QVector, so
+// scheduling and draining are O(log n) with no allocation per event.
+class SimEventQueue {
+public:
+    explicit SimEventQueue(int capacity = 64);
+
+    void schedule(SimEvent event);
+    bool takeDue(int now, SimEvent &event); // pops the earliest event due at or before now
+    int nextDue() const; // INT_MAX when empty
+
+    int size() const;
+    bool isEmpty() const;
+    void clear();
+    const QVector<SimEvent> &pending() const; // heap order, not sorted
+
+private:
+    static bool earlier(const SimEvent &a, const SimEvent &b);
+    void siftUp(int i);
+    void siftDown(int i);
+
+    QVector<SimEvent> heap;
+    quint32 nextSequence;
+};
+
+#endif // SIMEVENTQUEUE_H
@@ -0,0 +1,91 @@
+#include "simulationclock.h"
+#include <QTimer>
+
+// -------------------- Simulation Clock --------------------
+const int SimulationClock::FrameMs;
+const int SimulationClock::FrameBudgetMs;
+
+SimulationClock::SimulationClock(QObject *parent)
+    : QObject(parent), timer(new QTimer(this)), speed(Speed60x), stepsDone(0), nsPerStep(50000.0) {
+    connect(timer, &QTimer::timeout, this, &SimulationClock::onTick);
+}
+
+void SimulationClock::setSpeed(Speed newSpeed) {
+    speed = newSpeed;
+    if (timer->isActive()) {
+        start(); // restart the catch-up accounting at the new rate
+    }
+}
+
+SimulationClock::Speed SimulationClock::getSpeed() const {
+    return speed;
+}
+
+bool SimulationClock::isFast() const {
+    return speed == Speed3600x || speed == Unlimited;
+}
+
+void SimulationClock::start() {
+    stepsDone = 0;
+    wallClock.start();
+    timer->start(timerInterval());
+}
+
+void SimulationClock::stop() {
+    timer->stop();
+}
+
+bool SimulationClock::isActive() const {
+    return timer->isActive();
+}
+
+double SimulationClock::stepsPerSecond(Speed speed) {
+    switch (speed) {
+    case RealTime: return 1.0 / 60.0;
+    case Speed60x: return 1.0;
+    case Speed3600x: return 60.0;
+    case Unlimited: return 0.0;
+    }
+    return 0.0;
+}
+
+int SimulationClock::timerInterval() const {
+    switch (speed) {
+    case RealTime: return 60000; // 1 minute = 1 time step
+    case Speed60x: return 1000;  // 1 second = 1 time step
+    case Speed3600x:
+    case Unlimited: return FrameMs; // a batch per frame, Unlimited sized to FrameBudgetMs
+    }
+    return 1000;
+}
+
+void SimulationClock::onTick() {
+    if (!isFast()) {
+        emit advance(1);
+        return;
+    }
+
+    int steps;
+    if (speed == Speed3600x) {
+        qint64 due = qint64(wallClock.elapsed() * stepsPerSecond(speed) / 1000.0) - stepsDone;
+        // after a stall, drop the backlog rather than spiral trying to catch up
+        qint64 maxSteps = qint64(stepsPerSecond(speed) * FrameMs * 4 / 1000.0);
+        if (due > maxSteps) {
+            stepsDone += due - maxSteps;
+            due = maxSteps;
+        }
+        steps = int(due);
+    } else {
+        // fill the frame budget based on how long steps have been taking
+        steps = qMax(1, int(FrameBudgetMs * 1e6 / nsPerStep));
+    }
+    if (steps <= 0) return;
+
+    QElapsedTimer batch;
+    batch.start();
+    emit advance(steps);
+    stepsDone += steps;
+
+    double measured = double(batch.nsecsElapsed()) / steps;
+    nsPerStep = 0.8 * nsPerStep + 0.2 * qMax(measured, 1.0);
+}
@@ -0,0 +1,50 @@
+#ifndef SIMULATIONCLOCK_H
+#define SIMULATIONCLOCK_H
+
+#include <QObject>
+#include <QElapsedTimer>
+
+class QTimer;
+
+// -------------------- Simulation Clock --------------------
+// Decides how many simulated minutes are due and asks for them with
+// advance(). The slow speeds give one step per timer tick. The fast ones tick
+// once per frame and catch up against the wall clock in a batch, so the GUI
+// is refreshed per frame instead of per step.
+class SimulationClock : public QObject {
+    Q_OBJECT
+
+public:
+    enum Speed { RealTime, Speed60x, Speed3600x, Unlimited };
+
+    static const int FrameMs = 16;       // tick period of the fast speeds (~60 Hz)
+    static const int FrameBudgetMs = 10; // time Unlimited spends stepping per frame
+
+    explicit SimulationClock(QObject *parent = nullptr);
+
+    void setSpeed(Speed speed);
+    Speed getSpeed() const;
+    bool isFast() const; // true when steps are batched per frame
+    void start();
+    void stop();
+    bool isActive() const;
+
+    static double stepsPerSecond(Speed speed); // 0 for Unlimited
+
+signals:
+    void advance(int steps);
+
+private slots:
+    void onTick();
+
+private:
+    int timerInterval() const;
+
+    QTimer *timer;
+    QElapsedTimer wallClock;
+    Speed speed;
+    qint64 stepsDone;       // since start(), for catching up in Speed3600x
+    double nsPerStep;       // running estimate used to size Unlimited batches
+};
+
+#endif // SIMULATIONCLOCK_H
@@ -0,0 +1,21 @@
+#include "snapshotmailbox.h"
+
+// -------------------- Snapshot Mailbox --------------------
+const int SnapshotMailbox::IndexMask;
+const int SnapshotMailbox::Fresh;
+
+SnapshotMailbox::SnapshotMailbox() : back(0), front(1), middle(2) {}
+
+void SnapshotMailbox::publish(const PumpSnapshot &snapshot) {
+    buffers[back] = snapshot;
+    // release makes the write visible to the consumer, acquire gets us a buffer it is done with
+    back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & IndexMask;
+}
+
+bool SnapshotMailbox::take(PumpSnapshot &snapshot) {
+    if (!(middle.load(std::memory_order_relaxed) & Fresh)) return false;
+
+    front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+    snapshot = buffers[front];
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef SNAPSHOTMAILBOX_H
+#define SNAPSHOTMAILBOX_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// -------------------- Pump Snapshot --------------------
+// What the GUI shows, copied out of the simulation once per step
+struct PumpSnapshot {
+    int timeStep = 0;
+    double currentGlucose = 0.0;
+    double insulinOnBoard = 0.0;
+    double cartLevel = 0.0;
+    double basalRate = 0.0;
+    int batteryLevel = 0;
+    int currentState = 0; // PumpState::Mode
+};
+
+// -------------------- Snapshot Mailbox --------------------
+// Lock-free single-producer/single-consumer triple buffer. The simulation
+// publishes every step and never waits; the GUI takes the newest snapshot
+// whenever it refreshes and anything published in between is overwritten.
+class SnapshotMailbox {
+public:
+    SnapshotMailbox();
+
+    void publish(const PumpSnapshot &snapshot); // producer thread only
+    bool take(PumpSnapshot &snapshot);          // consumer thread only, false if nothing new
+
+private:
+    static const int IndexMask = 0x3;
+    static const int Fresh = 0x4;
+
+    PumpSnapshot buffers[3];
+    int back;                  // producer's buffer
+    int front;                 // consumer's buffer
+    std::atomic<int> middle;   // buffer being handed over, plus the Fresh bit
+};
+
+#endif // SNAPSHOTMAILBOX_H
@@ -0,0 +1,191 @@
+#include "telemetryfile.h"
+#include <cstring>
+
+// -------------------- Telemetry File --------------------
+const int TelemetryFile::HeaderBytes;
+const int TelemetryFile::BlockRows;
+const quint32 TelemetryFile::Version;
+
+static const char TelemetryMagic[8] = { 'P', 'U', 'M', 'P', 'T', 'L', 'M', '1' };
+
+static_assert(std::atomic<quint64>::is_always_lock_free, "the row count is shared through the mapping");
+
+TelemetryFile::TelemetryFile() : header(nullptr), writable(false) {}
+
+TelemetryFile::~TelemetryFile() {
+    close();
+}
+
+int TelemetryFile::columnWidth(Column column) {
+    switch (column) {
+    case TimeStep:
+    case BatteryLevel:
+    case State:
+        return int(sizeof(qint32));
+    default:
+        return int(sizeof(double));
+    }
+}
+
+qint64 TelemetryFile::columnOffset(Column column) {
+    qint64 offset = 0;
+    for (int c = 0; c < column; c++) {
+        offset += qint64(BlockRows) * columnWidth(Column(c));
+    }
+    return offset;
+}
+
+qint64 TelemetryFile::blockBytes() {
+    return columnOffset(ColumnCount);
+}
+
+bool TelemetryFile::open(const QString &fileName) {
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadWrite)) return fail("cannot open " + fileName);
+    writable = true;
+
+    const bool created = file.size() == 0;
+    if (created && !file.resize(HeaderBytes)) return fail("cannot grow " + fileName);
+    header = reinterpret_cast<Header *>(file.map(0, HeaderBytes));
+    if (!header) return fail("cannot map " + fileName);
+
+    if (created) {
+        memcpy(header->magic, TelemetryMagic, sizeof(TelemetryMagic));
+        header->version = Version;
+        header->columnCount = ColumnCount;
+        header->blockRows = BlockRows;
+        header->headerBytes = HeaderBytes;
+        header->rows.store(0, std::memory_order_release);
+        return true;
+    }
+
+    // appending to an earlier run: the layout must match and the blocks must be there
+    if (memcmp(header->magic, TelemetryMagic, sizeof(TelemetryMagic)) != 0 || header->version != Version
+            || header->columnCount != ColumnCount || header->blockRows != BlockRows) {
+        return fail(fileName + " is not a telemetry file of this version");
+    }
+    const qint64 fullBlocks = (qint64(rows()) + BlockRows - 1) / BlockRows;
+    if (file.size() < HeaderBytes + fullBlocks * blockBytes()) return fail(fileName + " is truncated");
+    return true;
+}
+
+bool TelemetryFile::openReadOnly(const QString &fileName) {
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return fail("cannot open " + fileName);
+    if (file.size() < HeaderBytes) return fail(fileName + " is too short");
+    header = reinterpret_cast<Header *>(file.map(0, HeaderBytes));
+    if (!header) return fail("cannot map " + fileName);
+    if (memcmp(header->magic, TelemetryMagic, sizeof(TelemetryMagic)) != 0 || header->version != Version
+            || header->columnCount != ColumnCount || header->blockRows != BlockRows) {
+        return fail(fileName + " is not a telemetry file of this version");
+    }
+    return true;
+}
+
+void TelemetryFile::close() {
+    for (uchar *b : blocks) {
+        if (b) file.unmap(b);
+    }
+    blocks.clear();
+    if (header) file.unmap(reinterpret_cast<uchar *>(header));
+    header = nullptr;
+    writable = false;
+    file.close();
+}
+
+bool TelemetryFile::isOpen() const {
+    return header != nullptr;
+}
+
+bool TelemetryFile::isWritable() const {
+    return header != nullptr && writable;
+}
+
+QString TelemetryFile::errorString() const {
+    return error;
+}
+
+bool TelemetryFile::fail(const QString &message) {
+    error = message;
+    close();
+    return false;
+}
+
+bool TelemetryFile::append(const TelemetryRow &row) {
+    if (!isWritable()) return false;
+    const qint64 n = qint64(header->rows.load(std::memory_order_relaxed));
+    const qint64 b = n / BlockRows;
+    if (b >= blocks.size() || !blocks[int(b)]) {
+        // a new block: grow the file first so readers never map past its end
+        if (file.size() < HeaderBytes + (b + 1) * blockBytes() && !file.resize(HeaderBytes + (b + 1) * blockBytes())) {
+            error = "cannot grow " + file.fileName();
+            return false;
+        }
+        if (!block(b)) {
+            error = "cannot map " + file.fileName();
+            return false;
+        }
+    }
+
+    uchar *base = blocks[int(b)];
+    const int r = int(n % BlockRows);
+    auto put32 = [&](Column c, qint32 v) { reinterpret_cast<qint32 *>(base + columnOffset(c))[r] = v; };
+    auto put64 = [&](Column c, double v) { reinterpret_cast<double *>(base + columnOffset(c))[r] = v; };
+    put32(TimeStep, row.timeStep);
+    put64(Glucose, row.glucose);
+    put64(PredictedGlucose, row.predictedGlucose);
+    put64(InsulinOnBoard, row.insulinOnBoard);
+    put64(BasalRate, row.basalRate);
+    put64(Delivered, row.delivered);
+    put64(CartLevel, row.cartLevel);
+    put32(BatteryLevel, row.batteryLevel);
+    put32(State, row.state);
+
+    // publishes the row: a reader that sees the new count also sees its values
+    header->rows.store(quint64(n + 1), std::memory_order_release);
+    return true;
+}
+
+qint64 TelemetryFile::rows() const {
+    return header ? qint64(header->rows.load(std::memory_order_acquire)) : 0;
+}
+
+bool TelemetryFile::row(qint64 index, TelemetryRow &row) const {
+    if (index < 0 || index >= rows()) return false;
+    const uchar *base = block(index / BlockRows);
+    if (!base) return false;
+    const int r = int(index % BlockRows);
+    auto get32 = [&](Column c) { return reinterpret_cast<const qint32 *>(base + columnOffset(c))[r]; };
+    auto get64 = [&](Column c) { return reinterpret_cast<const double *>(base + columnOffset(c))[r]; };
+    row.timeStep = get32(TimeStep);
+    row.glucose = get64(Glucose);
+    row.predictedGlucose = get64(PredictedGlucose);
+    row.insulinOnBoard = get64(InsulinOnBoard);
+    row.basalRate = get64(BasalRate);
+    row.delivered = get64(Delivered);
+    row.cartLevel = get64(CartLevel);
+    row.batteryLevel = get32(BatteryLevel);
+    row.state = get32(State);
+    return true;
+}
+
+const void *TelemetryFile::columnData(Column column, qint64 firstRow, int &count) const {
+    count = 0;
+    const qint64 n = rows();
+    if (firstRow < 0 || firstRow >= n || column < 0 || column >= ColumnCount) return nullptr;
+    const uchar *base = block(firstRow / BlockRows);
+    if (!base) return nullptr;
+    const int r = int(firstRow % BlockRows);
+    count = int(qMin<qint64>(BlockRows - r, n - firstRow));
+    return base + columnOffset(column) + qint64(r) * columnWidth(column);
+}
+
+// Blocks never move once written, so each is mapped once and kept
+uchar *TelemetryFile::block(qint64 index) const {
+    if (index >= blocks.size()) blocks.resize(int(index + 1), nullptr);
+    uchar *&b = blocks[int(index)];
+    if (!b) b = file.map(HeaderBytes + index * blockBytes(), blockBytes());
+    return b;
+}
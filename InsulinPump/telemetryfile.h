@@ -0,0 +1,82 @@
+#ifndef TELEMETRYFILE_H
+#define TELEMETRYFILE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include <atomic>
+
+// -------------------- Telemetry Row --------------------
+// One simulated minute as stored in a TelemetryFile
+struct TelemetryRow {
+    int timeStep = 0;
+    double glucose = 0.0;
+    double predictedGlucose = 0.0;
+    double insulinOnBoard = 0.0;
+    double basalRate = 0.0;
+    double delivered = 0.0;   // basal units delivered this step
+    double cartLevel = 0.0;
+    int batteryLevel = 0;
+    int state = 0;            // PumpState::Mode
+};
+
+// -------------------- Telemetry File --------------------
+// Append-only, memory-mapped, columnar record of a run. After a one page
+// header the file is a sequence of blocks of BlockRows rows; inside a block
+// each column is one contiguous array, so a tool can read a whole column of
+// a block straight from the mapping. Rows are written in place in the
+// mapping and only then counted in the header, so a reader (or a run that
+// crashed) never sees a half written row. Any number of readers can map
+// the file read-only while it is being written. Native byte order.
+class TelemetryFile {
+public:
+    enum Column { TimeStep, Glucose, PredictedGlucose, InsulinOnBoard, BasalRate, Delivered,
+                  CartLevel, BatteryLevel, State, ColumnCount };
+
+    static const int HeaderBytes = 4096;
+    static const int BlockRows = 4096; // keeps every column array page aligned
+    static const quint32 Version = 1;
+
+    TelemetryFile();
+    ~TelemetryFile();
+
+    bool open(const QString &fileName);         // creates the file or appends to it
+    bool openReadOnly(const QString &fileName); // for analysis, may be growing
+    void close();
+    bool isOpen() const;
+    bool isWritable() const;
+    QString errorString() const;
+
+    bool append(const TelemetryRow &row);
+    qint64 rows() const; // rows complete so far, re-read from the header every call
+    bool row(qint64 index, TelemetryRow &row) const;
+    // Start of 'column' at row firstRow; count is set to how many rows follow
+    // contiguously in the same block (0 if firstRow isn't written yet)
+    const void *columnData(Column column, qint64 firstRow, int &count) const;
+
+    static int columnWidth(Column column); // bytes per value, qint32 or double
+    static qint64 blockBytes();
+
+private:
+    struct Header {
+        char magic[8];
+        quint32 version;
+        quint32 columnCount;
+        quint32 blockRows;
+        quint32 headerBytes;
+        std::atomic<quint64> rows;
+    };
+
+    static qint64 columnOffset(Column column); // within a block
+    bool fail(const QString &message);
+    uchar *block(qint64 index) const; // maps blocks on first use
+
+    mutable QFile file;
+    Header *header;
+    mutable QVector<uchar *> blocks;
+    bool writable;
+    QString error;
+};
+
+#endif // TELEMETRYFILE_H
@@ -2,7 +2,30 @@
 #include <QDebug>
 #include <QtGlobal>
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include "insulinpump.h"
+#include "pumpengine.h"
+#include "patientcohort.h"
+#include "cohortrunner.h"
+#include "philoxrng.h"
+#include "snapshotmailbox.h"
+#include "glucosering.h"
+#include "historystore.h"
+#include "eventlog.h"
+#include "logmodel.h"
+#include "telemetryfile.h"
+#include "whatifrunner.h"
+#include "scenario.h"
+#include "cgmtrace.h"
+#include "glucosemodel.h"
+#include "odeintegrator.h"
+#include "profilesweep.h"
+#include "profiler.h"
+#include "tracerecorder.h"
+#include "commandqueue.h"
+#include <thread>
+#include <QTemporaryDir>
 
 class InsulinPumpTest : public QObject {
     Q_OBJECT
@@ -21,6 +44,31 @@ private slots:
     void testProfiles();
     void testInsulinOnBoard();
     void testCartridgeLevel();
+
+    // Headless engine tests
+    void testHeadlessEngineMatchesDevice();
+    void testSimulatedEvents();
+    void testSimulationClock();
+    void testSnapshotMailbox();
+    void testGlucoseRing();
+    void testHistoryStore();
+    void testEventLog();
+    void testLogModel();
+    void testTelemetryFile();
+    void testCheckpoint();
+    void testWhatIfBranches();
+    void testScenarioReplay();
+    void testCgmTrace();
+    void testGlucoseModels();
+    void testOdeIntegrator();
+    void testFastForward();
+    void testProfileSweep();
+    void testProfiler();
+    void testTraceRecorder();
+    void testCommandQueue();
+    void testCohortMatchesEngine();
+    void testCohortRunnerDeterminism();
+    void testPhiloxRng();
 };
 
 // Device tests implementation
@@ -306,6 +354,1622 @@ void InsulinPumpTest::testCartridgeLevel() {
     QVERIFY2(lowerBoundCorrect, "Cartridge level should be bounded to 0");
 }
 
+// Headless engine tests implementation
+void InsulinPumpTest::testHeadlessEngineMatchesDevice() {
+    qDebug() << "=== TEST: Headless Engine Matches Device ===";
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setNoiseSeed(42);
+    device.setupDevice();
+    device.applyProfile(1.2, 1.8, 10, 5.5);
+    device.startDevice();
+
+    PumpEngine engine(42);
+    engine.setupDevice();
+    engine.applyProfile(1.2, 1.8, 10, 5.5);
+    engine.startDevice();
+
+    // Step both the same way, including an extended bolus, a pause and a resume
+    bool sameTrajectory = true;
+    for (int i = 0; i < 250 && sameTrajectory; i++) {
+        if (i == 20) {
+            ics->calculateBolus(45, 7.5, 3, 0);
+            engine.calculateBolus(45, 7.5, 3, 0);
+        } else if (i == 60) {
+            ics->setState(InsulinControlSystem::Pause);
+            engine.setState(PumpState::Pause);
+        } else if (i == 90) {
+            ics->setState(InsulinControlSystem::Resume);
+            engine.setState(PumpState::Resume);
+        }
+        device.runDevice();
+        engine.step();
+
+        const PumpState &a = ics->getState();
+        const PumpState &b = engine.state();
+        sameTrajectory = a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+                         && a.basalRate == b.basalRate && a.cartLevel == b.cartLevel
+                         && device.getBatteryLevel() == engine.getBatteryLevel();
+        if (!sameTrajectory) {
+            qDebug() << "FAIL: Trajectories differ at step" << i + 1 << "glucose" << a.currentGlucose << "vs" << b.currentGlucose;
+        }
+    }
+    if (sameTrajectory) {
+        qDebug() << "Headless engine follows the same trajectory as the device";
+    }
+    QVERIFY2(sameTrajectory, "Headless engine should match the device for the same seed");
+
+    // A long run without battery drain doesn't stop early
+    PumpEngine longRun(7);
+    longRun.setupDevice();
+    longRun.setBatteryDrain(false);
+    longRun.startDevice();
+    int minutes = longRun.run(30 * 24 * 60);
+    bool fullRun = minutes == 30 * 24 * 60 && longRun.state().timeStep == minutes;
+    if (fullRun) {
+        qDebug() << "Headless engine can simulate 30 days";
+    } else {
+        qDebug() << "FAIL: Headless engine stopped after" << minutes << "minutes";
+    }
+    QVERIFY2(fullRun, "Headless engine should run 30 days without stopping");
+}
+
+void InsulinPumpTest::testSimulatedEvents() {
+    qDebug() << "=== TEST: Simulated Events ===";
+    SimEventQueue queue(4);
+    queue.schedule(SimEvent::resumeInsulin(30));
+    queue.schedule(SimEvent::pauseInsulin(10));
+    queue.schedule(SimEvent::profileSwitch(10, 1.5, 2.0, 12, 6.0));
+    queue.schedule(SimEvent::extendedBolus(20, 1.0, 0.5, 2));
+    QVector<int> order;
+    SimEvent e;
+    for (int t = 0; t <= 30; t++) {
+        while (queue.takeDue(t, e)) order.append(e.kind);
+    }
+    bool ordered = order == QVector<int>({ SimEvent::PauseInsulin, SimEvent::ProfileSwitch,
+                                           SimEvent::ExtendedBolus, SimEvent::ResumeInsulin });
+    if (ordered) {
+        qDebug() << "Events come out by due minute, FIFO within a minute";
+    } else {
+        qDebug() << "FAIL: Events came out in order" << order;
+    }
+    QVERIFY2(ordered, "Event queue should order by due time then scheduling order");
+
+    // Extended bolus is delivered hourly on the simulated clock and a pause delays it
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setupDevice();
+    device.applyProfile(1.0, 1.8, 10, 5.5);
+    device.setBatteryLevel(100);
+    device.startDevice();
+    ics->calculateBolus(30, 6.0, 2, 0);
+    device.scheduleEvent(SimEvent::pauseInsulin(50));
+    device.scheduleEvent(SimEvent::resumeInsulin(70));
+
+    double cartridge = ics->getCartridgeLevel();
+    int deliveries = 0;
+    int firstDelivery = 0;
+    for (int i = 0; i < 200; i++) {
+        device.runDevice();
+        // basal only takes a tenth of the rate per minute, a delivery takes more
+        if (cartridge - ics->getCartridgeLevel() > 0.25) {
+            deliveries++;
+            if (firstDelivery == 0) firstDelivery = ics->getState().timeStep;
+        }
+        cartridge = ics->getCartridgeLevel();
+    }
+    bool delayed = firstDelivery == 120 && deliveries == 2 && ics->getEventQueue().isEmpty();
+    if (delayed) {
+        qDebug() << "Extended bolus skipped the paused hour and finished after two deliveries";
+    } else {
+        qDebug() << "FAIL: First delivery at" << firstDelivery << "with" << deliveries << "deliveries";
+    }
+    QVERIFY2(delayed, "Paused hours should not count towards the extended bolus");
+}
+
+void InsulinPumpTest::testSimulationClock() {
+    qDebug() << "=== TEST: Simulation Clock ===";
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    SimulationClock *clock = device.getClock();
+
+    bool defaultSpeed = clock->getSpeed() == SimulationClock::Speed60x && !clock->isFast()
+                        && SimulationClock::stepsPerSecond(SimulationClock::Speed3600x) == 60.0;
+    if (defaultSpeed) {
+        qDebug() << "Clock defaults to one step per second";
+    } else {
+        qDebug() << "FAIL: Clock defaults to speed" << clock->getSpeed();
+    }
+    QVERIFY2(defaultSpeed, "Clock should default to 60x");
+
+    // A fast batch runs every step but keeps the per-step signals quiet
+    device.setupDevice();
+    device.startDevice();
+    clock->setSpeed(SimulationClock::Unlimited);
+    device.advance(4 * 60); // battery lasts 300 steps
+    bool batched = ics->getState().timeStep == 4 * 60 && !ics->signalsBlocked() && clock->isFast();
+    if (batched) {
+        qDebug() << "Four simulated hours run as one batch";
+    } else {
+        qDebug() << "FAIL: Batch ended at step" << ics->getState().timeStep;
+    }
+    QVERIFY2(batched, "Fast batches should run every step and restore the ICS signals");
+}
+
+void InsulinPumpTest::testSnapshotMailbox() {
+    qDebug() << "=== TEST: Snapshot Mailbox ===";
+    // The device publishes every step and the GUI only sees the newest one
+    Device device;
+    device.setupDevice();
+    device.startDevice();
+    PumpSnapshot snapshot;
+    device.takeSnapshot(snapshot); // drop anything from setup
+    for (int i = 0; i < 5; i++) device.runDevice();
+    bool newest = device.takeSnapshot(snapshot) && snapshot.timeStep == 5 && !device.takeSnapshot(snapshot);
+    if (newest) {
+        qDebug() << "Reader gets the latest step once";
+    } else {
+        qDebug() << "FAIL: Reader got step" << snapshot.timeStep;
+    }
+    QVERIFY2(newest, "Mailbox should hand out only the newest snapshot, once");
+
+    // Producer on another thread: snapshots arrive in order and never torn
+    SnapshotMailbox mailbox;
+    const int count = 200000;
+    std::thread producer([&mailbox]() {
+        for (int i = 1; i <= count; i++) {
+            PumpSnapshot s;
+            s.timeStep = i;
+            s.currentGlucose = i * 0.5;
+            s.cartLevel = -i;
+            mailbox.publish(s);
+        }
+    });
+    int last = 0;
+    bool consistent = true;
+    while (last < count && consistent) {
+        if (mailbox.take(snapshot)) {
+            consistent = snapshot.timeStep > last && snapshot.currentGlucose == snapshot.timeStep * 0.5
+                         && snapshot.cartLevel == -snapshot.timeStep;
+            last = snapshot.timeStep;
+        }
+    }
+    producer.join();
+    if (consistent) {
+        qDebug() << "Concurrent snapshots stay ordered and whole";
+    } else {
+        qDebug() << "FAIL: Torn or stale snapshot at step" << snapshot.timeStep << "after" << last;
+    }
+    QVERIFY2(consistent, "Snapshots should never go backwards or mix two steps");
+}
+
+void InsulinPumpTest::testGlucoseRing() {
+    qDebug() << "=== TEST: Glucose Ring ===";
+    // Bounded: only the newest samples are kept
+    GlucoseRing small(100);
+    for (int t = 1; t <= 1000; t++) small.append(t, 5.0);
+    QVector<QPointF> points;
+    small.decimate(0, 1000, 1000, points);
+    int t = 0;
+    double g = 0;
+    bool bounded = small.size() == 100 && points.size() == 100 && points.first().x() == 901
+                   && small.latest(t, g) && t == 1000;
+    if (bounded) {
+        qDebug() << "Ring keeps the newest 100 of 1000 samples";
+    } else {
+        qDebug() << "FAIL: Ring holds" << small.size() << "samples, decimation returned" << points.size();
+    }
+    QVERIFY2(bounded, "Ring should drop the oldest samples");
+
+    // 30 days squeezed into 700 columns still shows a single-minute spike and dip
+    GlucoseRing month;
+    for (int t = 1; t <= 30 * 24 * 60; t++) {
+        month.append(t, t == 20000 ? 15.0 : (t == 30000 ? 2.0 : 5.5));
+    }
+    month.decimate(1, 30 * 24 * 60, 700, points);
+    bool spike = false, dip = false;
+    for (const QPointF &p : points) {
+        spike = spike || (p.x() == 20000 && p.y() == 15.0);
+        dip = dip || (p.x() == 30000 && p.y() == 2.0);
+    }
+    bool decimated = points.size() <= 2 * 700 && spike && dip;
+    if (decimated) {
+        qDebug() << "Decimated 30 days to" << points.size() << "points without losing extremes";
+    } else {
+        qDebug() << "FAIL: Decimation gave" << points.size() << "points, spike" << spike << "dip" << dip;
+    }
+    QVERIFY2(decimated, "Min/max decimation should keep hypo and hyper spikes");
+
+    // Reader on another thread never sees a sample from two different steps
+    GlucoseRing shared(500);
+    std::thread writer([&shared]() {
+        for (int t = 1; t <= 300000; t++) shared.append(t, t * 0.25);
+    });
+    bool untorn = true;
+    int reads = 0;
+    while (untorn && (reads < 50 || shared.size() < 500)) {
+        int newest = 0;
+        double value = 0;
+        if (!shared.latest(newest, value)) continue;
+        shared.decimate(newest - 600, newest, 100, points);
+        for (const QPointF &p : points) {
+            untorn = untorn && p.y() == p.x() * 0.25;
+        }
+        reads++;
+    }
+    writer.join();
+    if (untorn) {
+        qDebug() << "Concurrent reads stay consistent over" << reads << "reads";
+    } else {
+        qDebug() << "FAIL: Torn sample seen while writing";
+    }
+    QVERIFY2(untorn, "Readers should retry instead of returning overwritten samples");
+}
+
+void InsulinPumpTest::testHistoryStore() {
+    qDebug() << "=== TEST: History Store ===";
+    // 90 days of a daily swing between 3 and 10 mmol/L, with one hypo dip
+    const int minutes = 90 * 24 * 60;
+    QVector<double> glucose(minutes + 1);
+    HistoryStore store;
+    for (int t = 1; t <= minutes; t++) {
+        glucose[t] = t == 100000 ? 1.5 : 6.5 + 3.5 * std::sin(t * 2 * M_PI / (24 * 60));
+        store.append(t, glucose[t]);
+    }
+
+    QVector<HistoryBucket> buckets;
+    bool levels = store.query(minutes - 60, minutes, 700, buckets) == HistoryStore::Minute && buckets.size() == 61
+                  && store.query(minutes - 7 * 24 * 60, minutes, 700, buckets) == HistoryStore::Hour
+                  && store.query(1, minutes, 700, buckets) == HistoryStore::Day && buckets.size() <= 700;
+    double lowest = 10.0;
+    for (const HistoryBucket &b : buckets) lowest = qMin(lowest, b.min);
+    levels = levels && lowest == 1.5;
+    if (levels) {
+        qDebug() << "Each zoom reads one level and 90 days still shows the hypo dip";
+    } else {
+        qDebug() << "FAIL: Wrong level or lost the dip, lowest" << lowest;
+    }
+    QVERIFY2(levels, "Queries should use the finest level that fits the requested points");
+
+    // Unaligned range spanning all four levels, against a plain loop
+    const int from = minutes - 3 * 24 * 60 - 17, to = minutes - 7;
+    HistoryBucket expected;
+    for (int t = from; t <= to; t++) expected.add(glucose[t]);
+    HistoryBucket summary = store.summarize(from, to);
+    bool exact = summary.count == expected.count && summary.inRange == expected.inRange
+                 && summary.min == expected.min && summary.max == expected.max
+                 && std::fabs(summary.sum - expected.sum) < 1e-6 * expected.count;
+    if (exact) {
+        qDebug() << "Roll-up summary matches a full scan, time in range" << summary.timeInRange();
+    } else {
+        qDebug() << "FAIL: Summary count" << summary.count << "expected" << expected.count;
+    }
+    QVERIFY2(exact, "Summaries built from roll-ups should match the raw samples");
+
+    // The device rolls up every step itself, so a reader that falls more
+    // than the whole glucose ring behind still sees every minute
+    Device device;
+    device.setNoiseSeed(1);
+    device.setupDevice();
+    device.startDevice();
+    const int steps = GlucoseRing::DefaultCapacity + GlucoseRing::WriterSlack + 24 * 60;
+    for (int i = 0; i < steps; i++) {
+        if (i % 240 == 0) device.chargeBattery();
+        device.runDevice();
+    }
+    const HistoryStore &history = device.getHistory();
+    const int newest = history.latestTimeStep();
+    HistoryBucket all = history.summarize(0, newest); // a day-aligned start, past the finer levels' retention
+    bool complete = all.count == steps && device.getGlucoseHistory().size() < steps;
+    if (complete) {
+        qDebug() << "Device roll-ups hold all" << all.count << "minutes, the ring only" << device.getGlucoseHistory().size();
+    } else {
+        qDebug() << "FAIL: Roll-ups hold" << all.count << "of" << steps << "minutes";
+    }
+    QVERIFY2(complete, "The history should count every step however far the device ran ahead");
+
+    // Queries on another thread never see a half-written bucket or a gap
+    HistoryStore shared;
+    std::thread writer([&shared]() {
+        for (int t = 1; t <= 300000; t++) shared.append(t, 4.0 + t % 7);
+    });
+    bool whole = true;
+    int reads = 0;
+    while (whole && (reads < 50 || shared.latestTimeStep() < 3000)) {
+        const int latest = shared.latestTimeStep();
+        if (latest < 2000) continue;
+        whole = shared.summarize(latest - 1500, latest).count == 1501
+                && shared.query(latest - 600, latest, 700, buckets) == HistoryStore::Minute && buckets.size() == 601;
+        for (const HistoryBucket &b : buckets) {
+            whole = whole && b.count == 1 && b.min == 4.0 + b.start % 7 && b.sum == b.min;
+        }
+        reads++;
+    }
+    writer.join();
+    if (whole) {
+        qDebug() << "Concurrent queries stay consistent over" << reads << "reads";
+    } else {
+        qDebug() << "FAIL: Torn or missing bucket seen while writing";
+    }
+    QVERIFY2(whole, "History readers should retry instead of returning torn or overwritten buckets");
+}
+
+void InsulinPumpTest::testEventLog() {
+    qDebug() << "=== TEST: Event Log ===";
+    EventLog log(8);
+    log.append(5, LogRecord::TimeStep);
+    log.append(5, LogRecord::BasalDelivered, LogRecord::Event, 0.5, 6.2, 6.4);
+    log.appendText(6, "Custom note");
+    log.appendText(7, "Custom note");
+    log.append(7, LogRecord::CartridgeEmpty, LogRecord::Error);
+
+    LogRecord record;
+    log.at(0, record);
+    QString step = log.format(record);
+    log.at(1, record);
+    QString basal = log.format(record);
+    log.at(3, record);
+    bool formatted = step == "Time Step: 5"
+                     && basal == "Basal insulin delivered: 0.5 | Glucose: 6.2 | Predicted: 6.4"
+                     && log.format(record) == "Custom note" && record.values[0] == 1;
+    if (formatted) {
+        qDebug() << "Records format to the original log lines";
+    } else {
+        qDebug() << "FAIL: Formatted" << step << basal << log.format(record);
+    }
+    QVERIFY2(formatted, "Log records should format to the original strings");
+
+    // Overflow the ring, the oldest records drop off
+    for (int i = 0; i < 10; i++) log.append(8 + i, LogRecord::TimeStep);
+    QVector<LogRecord> records;
+    qint64 first = log.read(0, 100, records);
+    bool wrapped = log.end() == 15 && log.begin() == 7 && first == 7 && records.size() == 8
+                   && records.last().timeStep == 17 && !log.at(6, record) && log.lastError() == -1;
+    if (wrapped) {
+        qDebug() << "Ring keeps the newest" << records.size() << "records";
+    } else {
+        qDebug() << "FAIL: begin" << log.begin() << "end" << log.end() << "read" << records.size();
+    }
+    QVERIFY2(wrapped, "The log should keep only the newest records");
+
+    // Texts have their own bounded ring, long ones are cut between characters
+    EventLog texts(8, 2);
+    texts.appendText(0, "First");
+    texts.appendText(1, "Second");
+    const QString accent = QString::fromUtf8("\xc3\xa9"); // two UTF-8 bytes
+    QString longText, fits;
+    for (int i = 0; i < 100; i++) longText += accent;
+    for (int i = 0; i < LogText::MaxBytes / 2; i++) fits += accent;
+    texts.appendText(2, longText);
+    LogRecord oldest, longest;
+    texts.at(0, oldest);
+    texts.at(2, longest);
+    const QString cut = texts.format(longest);
+    bool bounded = texts.format(oldest) == "(text overwritten)" && cut == fits;
+    if (bounded) {
+        qDebug() << "Text ring keeps the newest texts, long text cut to" << cut.size() << "characters";
+    } else {
+        qDebug() << "FAIL: Oldest text" << texts.format(oldest) << "long text" << cut.size() << "characters";
+    }
+    QVERIFY2(bounded, "Log texts should be bounded in number and length");
+
+    // Readers on another thread never see a torn record, a text that isn't
+    // its record's, or records out of order while the device thread writes
+    EventLog shared(500, 50);
+    std::thread writer([&shared]() {
+        for (int t = 1; t <= 300000; t++) {
+            if (t % 7 == 0) {
+                shared.appendText(t, QString::number(t));
+            } else {
+                shared.append(t, LogRecord::BasalDelivered, LogRecord::Event, t * 0.25, t * 0.5);
+            }
+        }
+    });
+    bool untorn = true;
+    int reads = 0;
+    while (untorn && (reads < 50 || shared.end() < 1000)) {
+        const qint64 from = shared.firstAtOrAfter(int(shared.end()) - 300);
+        const qint64 first = shared.read(from, 200, records);
+        untorn = first >= from;
+        for (int i = 0; i < records.size() && untorn; i++) {
+            const LogRecord &r = records[i];
+            const QString text = r.kind == LogRecord::Text ? shared.format(r) : QString();
+            untorn = (i == 0 || r.timeStep == records[i - 1].timeStep + 1)
+                     && (r.kind == LogRecord::Text ? r.timeStep % 7 == 0
+                             && (text == QString::number(r.timeStep) || text == "(text overwritten)")
+                         : r.values[0] == r.timeStep * 0.25 && r.values[1] == r.timeStep * 0.5);
+        }
+        reads++;
+    }
+    writer.join();
+    if (untorn) {
+        qDebug() << "Concurrent log reads stay consistent over" << reads << "reads";
+    } else {
+        qDebug() << "FAIL: Torn or out of order record seen while writing";
+    }
+    QVERIFY2(untorn, "Log readers should retry instead of returning overwritten records");
+
+    // The device writes binary records on each step
+    Device device;
+    device.setupDevice();
+    device.startDevice();
+    const qint64 before = device.getEventLog().end();
+    device.runDevice();
+    device.getLogger()->logBolus(2.5);
+    EventLog &deviceLog = device.getEventLog();
+    deviceLog.read(before, 100, records);
+    bool hasBasal = false, hasStep = false;
+    for (const LogRecord &r : records) {
+        if (r.kind == LogRecord::BasalDelivered) hasBasal = true;
+        if (r.kind == LogRecord::TimeStep) hasStep = true;
+    }
+    bool logged = hasBasal && hasStep && deviceLog.format(records.last()) == "Bolus: 2.5";
+    if (logged) {
+        qDebug() << "Device step logged" << records.size() << "records";
+    } else {
+        qDebug() << "FAIL: Device step logged" << records.size() << "records";
+    }
+    QVERIFY2(logged, "Running the device should append binary log records");
+}
+
+void InsulinPumpTest::testLogModel() {
+    qDebug() << "=== TEST: Log Model ===";
+    EventLog log(1000);
+    for (int t = 0; t < 300; t++) {
+        log.append(t, LogRecord::TimeStep);
+        if (t % 50 == 0) log.append(t, LogRecord::CartridgeEmpty, LogRecord::Error);
+    }
+    LogModel model(&log);
+    bool all = model.rowCount() == 306 && model.data(model.index(0)).toString() == "Time Step: 0";
+    if (all) {
+        qDebug() << "Unfiltered model has" << model.rowCount() << "rows";
+    } else {
+        qDebug() << "FAIL: Unfiltered model has" << model.rowCount() << "rows";
+    }
+    QVERIFY2(all, "The model should show every record when unfiltered");
+
+    // Errors between steps 100 and 200
+    model.setFilter(LogModel::ErrorsOnly, 100, 200);
+    bool filtered = model.rowCount() == 3 && model.data(model.index(0)).toString() == "Cartridge is empty."
+                    && model.data(model.index(0), Qt::ForegroundRole).isValid();
+    LogRecord record;
+    for (int row = 0; row < model.rowCount(); row++) {
+        log.at(model.sequenceAt(row), record);
+        if (record.timeStep < 100 || record.timeStep > 200 || record.severity != LogRecord::Error) filtered = false;
+    }
+    if (filtered) {
+        qDebug() << "Filtered model has" << model.rowCount() << "error rows";
+    } else {
+        qDebug() << "FAIL: Filtered model has" << model.rowCount() << "rows";
+    }
+    QVERIFY2(filtered, "Severity and time step filters should both apply");
+
+    // New records show up on refresh, overwritten ones are dropped
+    model.setFilter(LogModel::EventsOnly, 0, -1);
+    for (int t = 300; t < 1000; t++) log.append(t, LogRecord::TimeStep);
+    model.refresh();
+    bool followed = model.rowCount() == 995 && model.sequenceAt(0) == log.begin() // 5 errors left in the ring
+                    && model.data(model.index(994)).toString() == "Time Step: 999";
+    if (followed) {
+        qDebug() << "Model follows the log ring," << model.rowCount() << "rows";
+    } else {
+        qDebug() << "FAIL: Model has" << model.rowCount() << "rows, first" << model.sequenceAt(0);
+    }
+    QVERIFY2(followed, "Refreshing should add new records and drop overwritten ones");
+}
+
+void InsulinPumpTest::testTelemetryFile() {
+    qDebug() << "=== TEST: Telemetry File ===";
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("run.tlm");
+    const int total = TelemetryFile::BlockRows + 500; // spills into a second block
+
+    TelemetryFile writer;
+    bool opened = writer.open(fileName);
+    TelemetryFile reader;
+    opened = opened && reader.openReadOnly(fileName);
+    for (int i = 0; i < total && opened; i++) {
+        TelemetryRow row;
+        row.timeStep = i + 1;
+        row.glucose = 5.0 + i * 0.001;
+        row.cartLevel = 300.0 - i * 0.01;
+        row.batteryLevel = 100 - i % 100;
+        writer.append(row);
+    }
+
+    // the reader sees rows written after it opened the file
+    TelemetryRow last;
+    int count = 0;
+    const double *glucose = static_cast<const double *>(reader.columnData(TelemetryFile::Glucose, 10, count));
+    bool readBack = opened && reader.rows() == total && reader.row(total - 1, last) && last.timeStep == total
+                    && last.batteryLevel == 100 - (total - 1) % 100 && glucose && glucose[0] == 5.0 + 10 * 0.001
+                    && count == TelemetryFile::BlockRows - 10;
+    if (readBack) {
+        qDebug() << "Reader mapped" << reader.rows() << "rows while the writer was open";
+    } else {
+        qDebug() << "FAIL: Reader sees" << reader.rows() << "rows," << writer.errorString() << reader.errorString();
+    }
+    QVERIFY2(readBack, "A read-only mapping should see rows as they are appended");
+
+    // reopening continues the same file
+    writer.close();
+    TelemetryRow extra;
+    extra.timeStep = total + 1;
+    bool appended = writer.open(fileName) && writer.rows() == total && writer.append(extra)
+                    && reader.rows() == total + 1 && reader.row(total, last) && last.timeStep == total + 1;
+    if (appended) {
+        qDebug() << "Reopened file continues at row" << total;
+    } else {
+        qDebug() << "FAIL: Reopened file has" << writer.rows() << "rows";
+    }
+    QVERIFY2(appended, "Opening an existing telemetry file should append to it");
+    writer.close();
+
+    // the device writes one row per step
+    Device device;
+    bool recording = device.getLogger()->openTelemetry(dir.filePath("device.tlm"));
+    device.setupDevice();
+    device.startDevice();
+    for (int i = 0; i < 10; i++) device.runDevice();
+    const TelemetryFile &telemetry = device.getLogger()->getTelemetry();
+    recording = recording && telemetry.rows() == 10 && telemetry.row(9, last) && last.timeStep == 10
+                && last.batteryLevel == device.getBatteryLevel() && last.cartLevel > 0.0;
+    if (recording) {
+        qDebug() << "Device recorded" << telemetry.rows() << "steps";
+    } else {
+        qDebug() << "FAIL: Device recorded" << telemetry.rows() << "steps";
+    }
+    QVERIFY2(recording, "The device should append a telemetry row per step");
+}
+
+void InsulinPumpTest::testCheckpoint() {
+    qDebug() << "=== TEST: Checkpoint ===";
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("pump.ckpt");
+
+    Device original;
+    InsulinControlSystem *ics = original.findChild<InsulinControlSystem*>();
+    original.setNoiseSeed(7);
+    original.setupDevice();
+    original.applyProfile(1.2, 1.8, 10, 5.5);
+    original.startDevice();
+    for (int i = 0; i < 30; i++) original.runDevice();
+    ics->calculateBolus(45, 8.0, 3, 0); // leaves three hourly deliveries queued
+    original.scheduleEvent(SimEvent::pauseInsulin(100));
+    original.scheduleEvent(SimEvent::resumeInsulin(130));
+    bool saved = original.saveCheckpoint(fileName);
+
+    Device resumed;
+    QElapsedTimer timer;
+    timer.start();
+    bool restored = saved && resumed.restoreCheckpoint(fileName);
+    const qint64 restoreNs = timer.nsecsElapsed();
+    InsulinControlSystem *resumedIcs = resumed.findChild<InsulinControlSystem*>();
+
+    bool same = restored && resumedIcs->getEventQueue().size() == ics->getEventQueue().size();
+    for (int i = 0; i < 200 && same; i++) {
+        original.runDevice();
+        resumed.runDevice();
+        const PumpState &a = ics->getState();
+        const PumpState &b = resumedIcs->getState();
+        same = a.timeStep == b.timeStep && a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+               && a.cartLevel == b.cartLevel && a.currentState == b.currentState
+               && original.getBatteryLevel() == resumed.getBatteryLevel();
+    }
+    if (same) {
+        qDebug() << "Resumed pump matches the original for 200 steps, restore took" << restoreNs / 1000 << "us";
+    } else {
+        qDebug() << "FAIL: Resumed pump diverged, saved" << saved << "restored" << restored;
+    }
+    QVERIFY2(same, "A restored pump should continue exactly like the original");
+
+    // a damaged file is rejected and leaves the device alone
+    QFile damaged(dir.filePath("damaged.ckpt"));
+    damaged.open(QIODevice::WriteOnly);
+    damaged.write("PCKP", 4);
+    damaged.close();
+    // a flipped payload byte still parses, only the checksum catches it;
+    // a truncated copy loses its checksum
+    QFile good(fileName);
+    good.open(QIODevice::ReadOnly);
+    const QByteArray bytes = good.readAll();
+    good.close();
+    QByteArray flipped = bytes;
+    flipped.data()[20] ^= 0x10; // past the header, inside the payload
+    QFile corrupted(dir.filePath("corrupted.ckpt"));
+    corrupted.open(QIODevice::WriteOnly);
+    corrupted.write(flipped);
+    corrupted.close();
+    QFile truncated(dir.filePath("truncated.ckpt"));
+    truncated.open(QIODevice::WriteOnly);
+    truncated.write(bytes.constData(), bytes.size() - 3);
+    truncated.close();
+    const int step = resumedIcs->getState().timeStep;
+    bool rejected = !resumed.restoreCheckpoint(dir.filePath("damaged.ckpt"))
+                    && !resumed.restoreCheckpoint(dir.filePath("missing.ckpt"))
+                    && !resumed.restoreCheckpoint(dir.filePath("corrupted.ckpt"))
+                    && !resumed.restoreCheckpoint(dir.filePath("truncated.ckpt"))
+                    && resumedIcs->getState().timeStep == step;
+    if (rejected) {
+        qDebug() << "Damaged, corrupted, truncated and missing checkpoints are rejected";
+    } else {
+        qDebug() << "FAIL: Damaged checkpoint was accepted";
+    }
+    QVERIFY2(rejected, "Restoring should fail cleanly on a bad file");
+
+    // periodic checkpoints
+    resumed.setCheckpointFile(dir.filePath("periodic.ckpt"), 15);
+    while (resumedIcs->getState().timeStep % 15 != 14) resumed.runDevice();
+    resumed.runDevice();
+    PumpCheckpoint periodic;
+    bool written = periodic.load(dir.filePath("periodic.ckpt")) && periodic.timeStep == resumedIcs->getState().timeStep;
+    if (written) {
+        qDebug() << "Periodic checkpoint written at step" << periodic.timeStep;
+    } else {
+        qDebug() << "FAIL: No periodic checkpoint";
+    }
+    QVERIFY2(written, "The device should checkpoint every interval");
+}
+
+void InsulinPumpTest::testWhatIfBranches() {
+    qDebug() << "=== TEST: What-If Branches ===";
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setNoiseSeed(11);
+    device.setupDevice();
+    device.applyProfile(1.0, 1.8, 10, 5.5);
+    device.startDevice();
+    for (int i = 0; i < 30; i++) device.runDevice();
+
+    PumpCheckpoint fork;
+    device.checkpoint(fork);
+    QVector<WhatIfBranch> branches;
+    branches << WhatIfBranch::noBolus() << WhatIfBranch::carbBolus(40) << WhatIfBranch::carbBolus(60)
+             << WhatIfBranch::carbBolus(60, -1.0, 2, 0);
+    const int minutes = 180;
+    WhatIfRunner serial(1), parallel(4);
+    QVector<WhatIfTrajectory> a = serial.run(fork, branches, minutes);
+    QVector<WhatIfTrajectory> b = parallel.run(fork, branches, minutes);
+
+    bool deterministic = a.size() == branches.size();
+    for (int i = 0; i < a.size() && deterministic; i++) {
+        deterministic = a[i].glucose == b[i].glucose && a[i].insulinOnBoard == b[i].insulinOnBoard
+                        && a[i].glucose.size() == minutes;
+    }
+    if (deterministic) {
+        qDebug() << "Branches are identical on 1 and" << parallel.threadCount() << "threads";
+    } else {
+        qDebug() << "FAIL: Branches differ between thread counts";
+    }
+    QVERIFY2(deterministic, "What-if branches should not depend on the thread count");
+
+    // the 60 g branch is what the live device does when given the same bolus
+    ics->calculateBolus(60, ics->getCurrentGlucose(), 0, 0);
+    bool matchesDevice = true;
+    for (int m = 0; m < minutes && matchesDevice; m++) {
+        device.runDevice();
+        matchesDevice = a[2].timeSteps[m] == ics->getState().timeStep && a[2].glucose[m] == ics->getCurrentGlucose();
+    }
+    bool ordered = a[0].finalState.insulinOnBoard < a[1].finalState.insulinOnBoard
+                   && a[1].finalState.insulinOnBoard < a[2].finalState.insulinOnBoard && a[1].glucose != a[2].glucose;
+    if (matchesDevice && ordered) {
+        qDebug() << "Mean glucose: no bolus" << a[0].summary.mean() << "| 40 g" << a[1].summary.mean()
+                 << "| 60 g" << a[2].summary.mean() << "| 60 g extended" << a[3].summary.mean();
+    } else {
+        qDebug() << "FAIL: Branch matches device" << matchesDevice << "ordered" << ordered;
+    }
+    QVERIFY2(matchesDevice && ordered, "A branch should follow the device given the same input");
+}
+
+void InsulinPumpTest::testScenarioReplay() {
+    qDebug() << "=== TEST: Scenario Replay ===";
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("day.scn");
+    QFile script(fileName);
+    script.open(QIODevice::WriteOnly);
+    script.write("# breakfast, a pause and a disconnect\n"
+                 "0 profile 1.0 1.8 10 5.5\n"
+                 "20 meal 45 7.5\n"
+                 "\n"
+                 "40   pause   # meeting\n"
+                 "55 resume\n"
+                 "60 glucose 9.1\n"
+                 "80 disconnect\n"
+                 "90 reconnect\n"
+                 "100 meal 30 6.0 2 0\n"
+                 "150 cartridge 50\n"
+                 "200 end\n");
+    script.close();
+
+    // the same script through the GUI device and the headless engine
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setNoiseSeed(5);
+    device.setupDevice();
+    device.startDevice();
+    PumpEngine engine(5);
+    engine.setupDevice();
+    engine.setBatteryDrain(false);
+    engine.startDevice();
+
+    ScenarioDriver onDevice, onEngine;
+    bool opened = onDevice.open(fileName) && onEngine.open(fileName);
+    bool same = opened;
+    int minutes = 0;
+    while (same && !onDevice.finished()) {
+        minutes += onDevice.run(device, 1);
+        onEngine.run(engine, 1);
+        same = onDevice.minute() == onEngine.minute() && ics->getState().timeStep == engine.state().timeStep
+               && ics->getCurrentGlucose() == engine.state().currentGlucose
+               && ics->getCartridgeLevel() == engine.state().cartLevel;
+        if (onDevice.minute() == 85 && device.isDeviceRunning()) same = false; // disconnected
+    }
+    // ten minutes disconnected, the pump's own clock stood still
+    same = same && minutes == 200 && onEngine.finished() && ics->getState().timeStep == 190
+           && ics->getCartridgeLevel() < 50.0 + 1e-9 && !onDevice.getReader().hasError();
+    if (same) {
+        qDebug() << "Device and engine replayed" << minutes << "scenario minutes identically";
+    } else {
+        qDebug() << "FAIL: Replay diverged at minute" << onDevice.minute() << onDevice.getReader().errorString();
+    }
+    QVERIFY2(same, "A scenario should drive the device and the engine the same way");
+
+    // errors name the line
+    QFile broken(dir.filePath("broken.scn"));
+    broken.open(QIODevice::WriteOnly);
+    broken.write("0 charge\n10 meal\n");
+    broken.close();
+    ScenarioReader reader;
+    ScenarioEvent event;
+    bool reported = reader.open(dir.filePath("broken.scn")) && reader.next(event) && event.kind == ScenarioEvent::Charge
+                    && !reader.next(event) && reader.errorString() == "line 2: missing arguments";
+    if (reported) {
+        qDebug() << "Bad line reported as" << reader.errorString();
+    } else {
+        qDebug() << "FAIL: Error was" << reader.errorString();
+    }
+    QVERIFY2(reported, "Script errors should be reported with their line");
+
+    // a long script streams through the engine without being loaded
+    QFile month(dir.filePath("month.scn"));
+    month.open(QIODevice::WriteOnly);
+    QByteArray chunk;
+    for (int m = 0; m < 30 * 24 * 60; m += 5) {
+        chunk += QByteArray::number(m) + (m % 240 == 0 ? " meal 40\n" : " glucose 6.5\n");
+        if (chunk.size() > 60000) {
+            month.write(chunk);
+            chunk.clear();
+        }
+    }
+    month.write(chunk);
+    month.close();
+    PumpEngine longRun(9);
+    longRun.setupDevice();
+    longRun.setBatteryDrain(false);
+    longRun.startDevice();
+    ScenarioDriver driver;
+    QElapsedTimer timer;
+    timer.start();
+    bool streamed = driver.open(dir.filePath("month.scn")) && driver.run(longRun, 30 * 24 * 60) == 30 * 24 * 60
+                    && !driver.getReader().hasError() && driver.getReader().lineNumber() == 30 * 24 * 12;
+    const qint64 ms = qMax<qint64>(1, timer.elapsed());
+    if (streamed) {
+        qDebug() << "Replayed a 30 day script," << driver.getReader().lineNumber() << "lines in" << ms << "ms";
+    } else {
+        qDebug() << "FAIL: Long script stopped at line" << driver.getReader().lineNumber() << driver.getReader().errorString();
+    }
+    QVERIFY2(streamed, "Long scripts should replay to the end");
+}
+
+void InsulinPumpTest::testCgmTrace() {
+    qDebug() << "=== TEST: CGM Trace ===";
+    QTemporaryDir dir;
+    QFile csv(dir.filePath("trace.csv"));
+    csv.open(QIODevice::WriteOnly);
+    csv.write("minute,glucose\n"
+              "0,6.0\n"
+              "5,7.0\r\n"
+              "# sensor warm-up gap\n"
+              "10;7.5\n"
+              "40\t9.25\n"
+              "45 180\n"); // mg/dL
+    csv.close();
+
+    CgmTrace trace;
+    double g2 = 0, g7 = 0, g45 = 0, g20 = 0;
+    bool parsed = trace.open(dir.filePath("trace.csv")) && trace.size() == 5
+                  && trace.glucoseAt(2, g2) && std::fabs(g2 - 6.4) < 1e-6
+                  && trace.glucoseAt(7, g7) && std::fabs(g7 - 7.2) < 1e-6
+                  && !trace.glucoseAt(20, g20) && !trace.glucoseAt(46, g20)
+                  && trace.glucoseAt(45, g45) && std::fabs(g45 - 180 / 18.016) < 1e-5;
+    if (parsed) {
+        qDebug() << "CSV trace interpolates to" << g2 << "at minute 2 and skips the gap";
+    } else {
+        qDebug() << "FAIL: CSV trace" << trace.errorString() << trace.size() << g2 << g7 << g45;
+    }
+    QVERIFY2(parsed, "CSV traces should parse and interpolate to the minute");
+
+    // a binary trace whose minutes go backwards is rejected like the CSV would be
+    bool written = trace.writeBinary(dir.filePath("trace.cgm"));
+    QFile binary(dir.filePath("trace.cgm"));
+    binary.open(QIODevice::ReadOnly);
+    QByteArray bytes = binary.readAll();
+    binary.close();
+    CgmSample swapped;
+    memcpy(&swapped, bytes.constData() + 32 + 2 * sizeof(CgmSample), sizeof(swapped));
+    swapped.minute = 3; // after minute 5
+    memcpy(bytes.data() + 32 + 2 * sizeof(CgmSample), &swapped, sizeof(swapped));
+    QFile unordered(dir.filePath("unordered.cgm"));
+    unordered.open(QIODevice::WriteOnly);
+    unordered.write(bytes);
+    unordered.close();
+    CgmTrace reordered;
+    bool rejected = written && bytes.size() == 32 + 5 * int(sizeof(CgmSample))
+                    && !reordered.open(dir.filePath("unordered.cgm")) && !reordered.isOpen()
+                    && reordered.errorString().endsWith("minutes must increase");
+    if (rejected) {
+        qDebug() << "Unordered binary trace rejected:" << reordered.errorString();
+    } else {
+        qDebug() << "FAIL: Unordered binary trace opened" << reordered.size();
+    }
+    QVERIFY2(rejected, "Binary traces should be rejected when minutes don't increase");
+
+    // a year at 5 minute cadence, through the binary format and the controller
+    QFile year(dir.filePath("year.csv"));
+    year.open(QIODevice::WriteOnly);
+    QByteArray chunk;
+    const int yearMinutes = 365 * 24 * 60;
+    for (int m = 0; m <= yearMinutes; m += 5) {
+        const double glucose = 7.0 + 3.0 * std::sin(m / 180.0);
+        chunk += QByteArray::number(m) + "," + QByteArray::number(qRound(glucose * 10) / 10.0) + "\n";
+        if (chunk.size() > 60000) {
+            year.write(chunk);
+            chunk.clear();
+        }
+    }
+    year.write(chunk);
+    year.close();
+
+    QElapsedTimer timer;
+    timer.start();
+    CgmTrace csvYear, binaryYear;
+    bool loaded = csvYear.open(dir.filePath("year.csv")) && csvYear.writeBinary(dir.filePath("year.cgm"))
+                  && binaryYear.open(dir.filePath("year.cgm")) && binaryYear.size() == csvYear.size()
+                  && binaryYear.lastMinute() == yearMinutes;
+    const qint64 parseMs = timer.restart();
+    for (qint64 i = 0; i < binaryYear.size() && loaded; i += 997) {
+        loaded = binaryYear.sample(i).minute == csvYear.sample(i).minute && binaryYear.sample(i).glucose == csvYear.sample(i).glucose;
+    }
+
+    PumpEngine engine(3);
+    engine.setupDevice();
+    engine.setBatteryDrain(false);
+    engine.applyProfile(1.0, 1.8, 10, 6.0);
+    engine.startDevice();
+    engine.setGlucoseTrace(&binaryYear);
+    bool followed = loaded;
+    engine.run(yearMinutes, [&](const PumpState &pump, const StepResult &) {
+        double reading;
+        binaryYear.glucoseAt(pump.timeStep, reading);
+        if (pump.currentGlucose != ControlIQ::roundCents(reading)) followed = false;
+    });
+    const qint64 runMs = timer.elapsed();
+    if (followed) {
+        qDebug() << "Year of CGM data:" << binaryYear.size() << "readings parsed in" << parseMs << "ms, replayed in" << runMs << "ms";
+    } else {
+        qDebug() << "FAIL: Engine did not follow the trace" << csvYear.errorString() << binaryYear.errorString();
+    }
+    QVERIFY2(followed, "The controller should run on the recorded readings");
+
+    // the device's controller takes the same readings
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setNoiseSeed(3);
+    device.setupDevice();
+    device.applyProfile(1.0, 1.8, 10, 6.0);
+    device.startDevice();
+    ics->setGlucoseTrace(&binaryYear);
+    PumpEngine check(3);
+    check.setupDevice();
+    check.applyProfile(1.0, 1.8, 10, 6.0);
+    check.startDevice();
+    check.setGlucoseTrace(&binaryYear);
+    bool same = true;
+    for (int i = 0; i < 200 && same; i++) {
+        device.runDevice();
+        check.step();
+        same = ics->getCurrentGlucose() == check.state().currentGlucose && ics->getState().basalRate == check.state().basalRate;
+    }
+    if (same) {
+        qDebug() << "Device and engine agree on the trace";
+    } else {
+        qDebug() << "FAIL: Device and engine differ on the trace";
+    }
+    QVERIFY2(same, "Device and engine should replay a trace identically");
+}
+
+void InsulinPumpTest::testGlucoseModels() {
+    qDebug() << "=== TEST: Glucose Models ===";
+    GlucoseModel::Kind kind = GlucoseModel::Classic;
+    bool named = GlucoseModel::fromName("Bergman", kind) && kind == GlucoseModel::Bergman
+                 && !GlucoseModel::fromName("hovorka", kind) && GlucoseModel::name(GlucoseModel::Classic) == "classic";
+    QVERIFY2(named, "Glucose models should be found by name");
+
+    // without noise: a meal raises glucose, suspending insulin lets it drift up
+    PumpState fasting;
+    fasting.glucoseModel = GlucoseModel::Bergman;
+    fasting.profileBasalRate = 1.0;
+    fasting.targetGlucose = 6.0;
+    fasting.currentGlucose = 6.0;
+    for (int m = 0; m < 600; m++) ControlIQ::step<BergmanModel>(fasting, 0.0, 0.0);
+    PumpState fed = fasting, suspended = fasting;
+    ControlIQ::addCarbs(fed, 60);
+    suspended.currentState = PumpState::Pause;
+    double fastingPeak = 0, fedPeak = 0;
+    for (int m = 0; m < 180; m++) {
+        ControlIQ::step<BergmanModel>(fasting, 0.0, 0.0);
+        ControlIQ::step<BergmanModel>(fed, 0.0, 0.0);
+        ControlIQ::step<BergmanModel>(suspended, 0.0, 0.0);
+        fastingPeak = qMax(fastingPeak, fasting.currentGlucose);
+        fedPeak = qMax(fedPeak, fed.currentGlucose);
+    }
+    bool physiological = fedPeak > fastingPeak + 2.0 && fed.physiology.carbsOnBoard < 3.0
+                         && suspended.currentGlucose > fasting.currentGlucose + 1.0
+                         && fasting.currentGlucose > ControlIQ::HypoThreshold && fasting.currentGlucose < ControlIQ::HyperThreshold;
+    if (physiological) {
+        qDebug() << "Bergman peaks: fasting" << fastingPeak << "| 60 g meal" << fedPeak
+                 << "| 3 h suspended ends at" << suspended.currentGlucose;
+    } else {
+        qDebug() << "FAIL: Bergman model" << fastingPeak << fedPeak << suspended.currentGlucose << fasting.currentGlucose;
+    }
+    QVERIFY2(physiological, "The Bergman model should respond to carbs and insulin");
+
+    // the device picks the model at run time and still matches the engine's specialized loop
+    Device device;
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.setNoiseSeed(21);
+    device.setupDevice();
+    device.setGlucoseModel(GlucoseModel::Bergman);
+    device.applyProfile(1.0, 1.8, 10, 6.0);
+    device.startDevice();
+    PumpEngine engine(21);
+    engine.setupDevice();
+    engine.setGlucoseModel(GlucoseModel::Bergman);
+    engine.applyProfile(1.0, 1.8, 10, 6.0);
+    engine.startDevice();
+    bool same = true;
+    for (int m = 0; m < 240 && same; m++) {
+        if (m == 30) {
+            ics->calculateBolus(50, ics->getCurrentGlucose(), 1, 0);
+            engine.calculateBolus(50, engine.state().currentGlucose, 1, 0);
+        }
+        device.runDevice();
+        engine.run(1);
+        same = ics->getCurrentGlucose() == engine.state().currentGlucose
+               && ics->getState().physiology.insulinAction == engine.state().physiology.insulinAction;
+    }
+
+    // the model and its state survive a checkpoint
+    QTemporaryDir dir;
+    PumpCheckpoint saved, loaded;
+    engine.checkpoint(saved);
+    bool restored = saved.save(dir.filePath("bergman.ckp")) && loaded.load(dir.filePath("bergman.ckp"))
+                    && loaded.pump.glucoseModel == GlucoseModel::Bergman
+                    && loaded.pump.physiology.insulinAction == engine.state().physiology.insulinAction
+                    && loaded.pump.physiology.carbsOnBoard == engine.state().physiology.carbsOnBoard;
+    if (same && restored) {
+        qDebug() << "Device and engine agree on the Bergman model, glucose" << engine.state().currentGlucose;
+    } else {
+        qDebug() << "FAIL: Device matches engine" << same << "checkpoint" << restored;
+    }
+    QVERIFY2(same && restored, "Device and engine should run the same glucose model identically");
+}
+
+// dx/dt = -k x, with its own rate per lane
+struct DecaySystem {
+    static const int Variables = 2;
+    const double *rates;
+
+    void derivatives(const double *const *x, double *const *dx, int lane, int n) const {
+        for (int i = 0; i < n; i++) {
+            dx[0][i] = -rates[lane + i] * x[0][i];
+            dx[1][i] = rates[lane + i] * x[0][i]; // what the first one lost
+        }
+    }
+};
+
+void InsulinPumpTest::testOdeIntegrator() {
+    qDebug() << "=== TEST: ODE Integrator ===";
+    const int lanes = 1000; // several passes, the last one partial
+    QVector<double> rates(lanes), fixedA(lanes, 1.0), fixedB(lanes, 0.0);
+    for (int i = 0; i < lanes; i++) rates[i] = 0.001 + 0.1 * i / lanes;
+    double *fixed[2] = { fixedA.data(), fixedB.data() };
+    OdeIntegrator::rk4(DecaySystem{ rates.constData() }, fixed, lanes, 1.0, 120);
+
+    // a lane on its own (the one-lane scratch) lands on the same bits as inside the batch
+    bool sameAsBatch = true, accurate = true;
+    for (int i = 0; i < lanes; i += 37) {
+        double x0 = 1.0, x1 = 0.0;
+        double *single[2] = { &x0, &x1 };
+        OdeIntegrator::rk4(DecaySystem{ rates.constData() + i }, single, 1, 1.0, 120);
+        sameAsBatch = sameAsBatch && x0 == fixedA[i] && x1 == fixedB[i];
+        accurate = accurate && std::fabs(fixedA[i] - std::exp(-rates[i] * 120)) < 1e-8
+                   && std::fabs(fixedA[i] + fixedB[i] - 1.0) < 1e-12;
+    }
+
+    if (sameAsBatch && accurate) {
+        qDebug() << "RK4 agrees with exp(-kt) over" << lanes << "lanes, single lanes match the batch";
+    } else {
+        qDebug() << "FAIL: Integrator same as batch" << sameAsBatch << "accurate" << accurate;
+    }
+    QVERIFY2(sameAsBatch && accurate, "The batch integrator should be accurate and lane independent");
+
+    // adaptive: each lane picks its own steps, so alone it matches the batch too
+    QVector<double> adaptiveA(lanes, 1.0), adaptiveB(lanes, 0.0);
+    double *adapted[2] = { adaptiveA.data(), adaptiveB.data() };
+    int steps = 0;
+    bool finished = OdeIntegrator::adaptive(DecaySystem{ rates.constData() }, adapted, lanes, 120.0, 1e-9, 1.0, &steps);
+    bool adaptiveAlone = true, adaptiveAccurate = finished;
+    for (int i = 0; i < lanes; i += 37) {
+        double x0 = 1.0, x1 = 0.0;
+        double *single[2] = { &x0, &x1 };
+        adaptiveAlone = adaptiveAlone && OdeIntegrator::adaptive(DecaySystem{ rates.constData() + i }, single, 1, 120.0, 1e-9)
+                        && x0 == adaptiveA[i] && x1 == adaptiveB[i];
+        adaptiveAccurate = adaptiveAccurate && std::fabs(adaptiveA[i] - std::exp(-rates[i] * 120)) < 1e-6;
+    }
+
+    // NaN and Inf states are rejected at every step size and give up at the
+    // minimum one, the finite lane between them is unaffected
+    double badA[3] = { std::numeric_limits<double>::quiet_NaN(), 1.0, std::numeric_limits<double>::infinity() };
+    double badB[3] = { 0.0, 0.0, 0.0 };
+    double *bad[2] = { badA, badB };
+    const bool badFinished = OdeIntegrator::adaptive(DecaySystem{ rates.constData() + 36 }, bad, 3, 120.0, 1e-9);
+    bool stops = !badFinished && badA[1] == adaptiveA[37] && badB[1] == adaptiveB[37];
+    if (adaptiveAlone && adaptiveAccurate && stops) {
+        qDebug() << "Adaptive agrees with exp(-kt) in" << steps << "steps, lanes match alone, NaN and Inf lanes stop";
+    } else {
+        qDebug() << "FAIL: Adaptive alone" << adaptiveAlone << "accurate" << adaptiveAccurate << "stops" << stops;
+    }
+    QVERIFY2(adaptiveAlone && adaptiveAccurate && stops,
+             "The adaptive integrator should be accurate, lane independent and stop on non-finite states");
+
+    // the cohort's block integration against single engines, boluses included
+    const int patients = 600;
+    PatientCohort cohort(patients, 40);
+    cohort.setGlucoseModel(GlucoseModel::Compartment);
+    QVector<PumpEngine> engines;
+    for (int i = 0; i < patients; i++) {
+        engines.append(PumpEngine(40, i));
+        PumpEngine &engine = engines.last();
+        engine.setupDevice();
+        engine.setBatteryDrain(false);
+        engine.setGlucoseModel(GlucoseModel::Compartment);
+        engine.applyProfile(0.8 + (i % 5) * 0.1, 1.5, 10, 5.5 + (i % 3) * 0.5);
+        engine.startDevice();
+        if (i % 4 == 0) engine.calculateBolus(20 + i % 50, 6.5, 0, 0);
+        cohort.setPatient(i, engine.state());
+    }
+    for (int minute = 0; minute < 240; minute++) {
+        for (int i = 0; i < patients; i += 97) {
+            PumpState::Mode mode = minute == 30 ? PumpState::Pause
+                                 : minute == 70 ? PumpState::Resume
+                                 : minute == 200 && i % 2 ? PumpState::Stop : PumpState::Run;
+            if (mode != PumpState::Run) {
+                engines[i].setState(mode);
+                cohort.setState(i, mode);
+            }
+        }
+        cohort.step();
+        for (int i = 0; i < patients; i++) engines[i].step();
+    }
+    bool sameTrajectory = true;
+    double lowest = 100, highest = 0;
+    for (int i = 0; i < patients && sameTrajectory; i++) {
+        PumpState a = cohort.patient(i);
+        const PumpState &b = engines[i].state();
+        sameTrajectory = a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+                         && a.basalRate == b.basalRate && a.physiology.plasmaInsulin == b.physiology.plasmaInsulin
+                         && a.physiology.gut[1] == b.physiology.gut[1];
+        lowest = qMin(lowest, a.currentGlucose);
+        highest = qMax(highest, a.currentGlucose);
+        if (!sameTrajectory) {
+            qDebug() << "FAIL: Patient" << i << "glucose" << a.currentGlucose << "vs" << b.currentGlucose;
+        }
+    }
+    if (sameTrajectory) {
+        qDebug() << "Compartment cohort matches single engines, glucose after 4 h between" << lowest << "and" << highest;
+    }
+    QVERIFY2(sameTrajectory, "The compartment cohort should match PumpEngine for every patient");
+}
+
+void InsulinPumpTest::testFastForward() {
+    qDebug() << "=== TEST: Fast Forward ===";
+    // a night paused, a suspended stretch, an extended bolus and the battery running down
+    PumpEngine stepped(9), skipped(9);
+    for (PumpEngine *engine : { &stepped, &skipped }) {
+        engine->setupDevice();
+        engine->applyProfile(1.0, 1.8, 10, 5.5);
+        engine->startDevice();
+        engine->calculateBolus(40, 7.0, 3, 0);
+        engine->scheduleEvent(SimEvent::pauseInsulin(120));
+        engine->scheduleEvent(SimEvent::resumeInsulin(600));
+        engine->scheduleEvent(SimEvent::profileSwitch(700, 1.0, 1.8, 10, 8.0)); // high target, the controller suspends
+    }
+
+    bool same = true;
+    int minutes = 0;
+    while (same && stepped.isRunning()) {
+        // charged now and then for the first day, then left to run flat
+        if (minutes < 1440 && stepped.getBatteryLevel() < 20) {
+            stepped.chargeBattery();
+            skipped.chargeBattery();
+        }
+        for (int m = 0; m < 37; m++) stepped.step();
+        minutes += skipped.run(37);
+        const PumpState &a = stepped.state(), &b = skipped.state();
+        same = a.timeStep == b.timeStep && a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+               && a.basalRate == b.basalRate && a.cartLevel == b.cartLevel && a.currentState == b.currentState
+               && stepped.getBatteryLevel() == skipped.getBatteryLevel() && stepped.isRunning() == skipped.isRunning()
+               && stepped.lastStep().predictedGlucose == skipped.lastStep().predictedGlucose;
+    }
+    if (same) {
+        qDebug() << "Fast-forward matches stepping over" << minutes << "minutes until the battery ran out";
+    } else {
+        qDebug() << "FAIL: Fast-forward differs at time step" << stepped.state().timeStep
+                 << stepped.state().currentGlucose << "vs" << skipped.state().currentGlucose;
+    }
+    QVERIFY2(same && !skipped.isRunning(), "Fast-forward should give the same result as stepping");
+
+    // a week paused, the case it's for, and a week suspended by a high
+    // target: the same bits as stepping over many noise streams (the speedup
+    // is the engine.pausedWeek benchmark's)
+    const int week = 7 * 24 * 60;
+    bool weeks = true;
+    int seed = 0;
+    for (; seed < 40 && weeks; seed++) {
+        const bool pause = seed % 2 == 0;
+        PumpEngine slow(seed), fast(seed);
+        for (PumpEngine *engine : { &slow, &fast }) {
+            engine->setupDevice();
+            engine->setBatteryDrain(false);
+            engine->applyProfile(1.0, 1.8, 10, pause ? 5.5 : 9.0);
+            engine->startDevice();
+            if (pause) engine->setState(PumpState::Pause);
+        }
+        for (int m = 0; m < week; m++) slow.step();
+        fast.run(week);
+        const PumpState &a = slow.state(), &b = fast.state();
+        weeks = a.timeStep == b.timeStep && a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+                && a.basalRate == b.basalRate && slow.lastStep().predictedGlucose == fast.lastStep().predictedGlucose;
+    }
+    if (weeks) {
+        qDebug() << "Paused and suspended weeks match stepping for" << seed << "seeds";
+    } else {
+        qDebug() << "FAIL: Week differs for seed" << seed - 1;
+    }
+    QVERIFY2(weeks, "A fast-forwarded pause or suspension should match stepping");
+}
+
+void InsulinPumpTest::testProfileSweep() {
+    qDebug() << "=== TEST: Profile Sweep ===";
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("meals.scn");
+    const QString plainName = dir.filePath("plain.scn");
+    const char *meals = "30 meal 60 7.0\n"
+                        "300 meal 40\n"
+                        "400 disconnect\n"
+                        "420 reconnect\n"
+                        "600 meal 80 8.0 2 0\n"
+                        "900 end\n";
+    QFile script(fileName), plain(plainName);
+    script.open(QIODevice::WriteOnly);
+    script.write("0 profile 2.0 1.0 5 4.0\n"); // the sweep's point replaces this
+    script.write(meals);
+    script.close();
+    plain.open(QIODevice::WriteOnly);
+    plain.write(meals);
+    plain.close();
+
+    SweepSpace space;
+    space.basalRate = SweepRange(0.6, 1.4, 3);
+    space.correctionFactor = SweepRange(1.2, 2.4, 2);
+    space.carbRatio = SweepRange(8, 14, 2);
+    space.targetGlucose = SweepRange(5.0, 6.5, 2);
+    QVector<SweepPoint> grid = space.grid();
+    bool gridOk = grid.size() == 24 && grid.first().basalRate == 0.6 && grid.last().basalRate == 1.4
+                  && grid[1].targetGlucose == 6.5 && grid[2].carbRatio == 14 && grid.last().correctionFactor == 2.4;
+
+    // every stratum of every value taken exactly once
+    const int samples = 50;
+    QVector<SweepPoint> lhs = space.latinHypercube(samples, 3);
+    QVector<int> hits(samples, 0);
+    for (const SweepPoint &p : lhs) {
+        const int stratum = int((p.basalRate - 0.6) / 0.8 * samples);
+        if (stratum >= 0 && stratum < samples) hits[stratum]++;
+    }
+    bool stratifiedOk = lhs.size() == samples && hits == QVector<int>(samples, 1)
+                        && lhs[7].carbRatio == space.latinHypercube(samples, 3)[7].carbRatio;
+    if (gridOk && stratifiedOk) {
+        qDebug() << "Grid of" << grid.size() << "points and a Latin hypercube of" << samples;
+    } else {
+        qDebug() << "FAIL: Grid" << gridOk << "Latin hypercube" << stratifiedOk;
+    }
+    QVERIFY2(gridOk && stratifiedOk, "The sweep should cover the grid and one point per stratum");
+
+    ProfileSweep serial(1), parallel(4);
+    bool loaded = serial.loadScenario(fileName) && parallel.loadScenario(fileName);
+    const int day = 24 * 60;
+    QVector<SweepResult> a = serial.run(grid, day);
+    QVector<SweepResult> b = parallel.run(grid, day);
+    bool deterministic = loaded && a.size() == grid.size();
+    for (int i = 0; i < a.size() && deterministic; i++) {
+        deterministic = a[i].summary.sum == b[i].summary.sum && a[i].totalInsulin == b[i].totalInsulin
+                        && a[i].hypoMinutes == b[i].hypoMinutes && a[i].hyperMinutes == b[i].hyperMinutes
+                        && a[i].hypoMinutes + a[i].summary.inRange + a[i].hyperMinutes == a[i].summary.count;
+    }
+
+    // a point is the scenario without its profile line replayed by hand with
+    // that profile; 20 minutes disconnected, so 880 samples before 'end'
+    const SweepPoint &point = grid[17];
+    PumpEngine engine;
+    engine.setupDevice();
+    engine.setBatteryDrain(false);
+    engine.applyProfile(point.basalRate, point.correctionFactor, point.carbRatio, point.targetGlucose);
+    engine.state().basalRate = point.basalRate;
+    engine.startDevice();
+    ScenarioDriver driver;
+    driver.open(plainName);
+    HistoryBucket replay;
+    int lastStep = engine.state().timeStep;
+    while (!driver.finished()) {
+        driver.run(engine, 1);
+        if (engine.state().timeStep != lastStep) replay.add(engine.state().currentGlucose);
+        lastStep = engine.state().timeStep;
+    }
+    bool matches = a[17].summary.count == 880 && replay.count == 880 && replay.sum == a[17].summary.sum
+                   && a[17].totalInsulin > 0.0;
+    if (deterministic && matches) {
+        qDebug() << "Point 17: time in range" << a[17].timeInRange() << "hypo" << a[17].hypoMinutes << "min, hyper"
+                 << a[17].hyperMinutes << "min," << a[17].totalInsulin << "U";
+    } else {
+        qDebug() << "FAIL: Deterministic" << deterministic << "matches replay" << matches << a[17].summary.count
+                 << replay.count;
+    }
+    QVERIFY2(deterministic && matches, "Sweep results should match a replay and not depend on the thread count");
+
+    QElapsedTimer timer;
+    timer.start();
+    const int points = 2000;
+    QVector<SweepResult> many = parallel.run(space.latinHypercube(points, 1), day);
+    const qint64 ns = timer.nsecsElapsed();
+    qDebug() << points << "profiles over a day in" << ns / 1000000 << "ms on" << parallel.threadCount() << "threads,"
+             << (ns > 0 ? qint64(double(points) * 1e9 / ns) : 0) << "profiles/s";
+    QVERIFY2(many.size() == points, "Every point should get a result");
+}
+
+void InsulinPumpTest::testProfiler() {
+    qDebug() << "=== TEST: Profiler ===";
+    // buckets are exact below 16 ticks and within 12.5% above
+    bool buckets = true;
+    const quint64 samples[] = { 0, 5, 8, 15, 16, 100, 1000, 123456, quint64(1) << 35 };
+    for (quint64 ticks : samples) {
+        const quint64 value = Profiler::bucketValue(Profiler::bucket(ticks));
+        buckets = buckets && (ticks < 16 ? value == ticks : std::fabs(double(value) - double(ticks)) <= ticks / 8.0);
+    }
+
+    // two threads, 1 to 1000 ticks each, merged
+    Profiler::reset();
+    auto record = [] {
+        for (quint64 ticks = 1; ticks <= 1000; ticks++) Profiler::record(Profiler::Basal, ticks);
+        Profiler::count(Profiler::Steps, 3);
+    };
+    std::thread first(record), second(record);
+    first.join();
+    second.join();
+    const Profiler::Summary s = Profiler::summary(Profiler::Basal);
+    const double ns = Profiler::nsPerTick(); // recalibrated per call, so within 1%
+    auto near = [](double value, double expected, double tolerance) {
+        return std::fabs(value - expected) <= expected * tolerance;
+    };
+    bool merged = s.count == 2000 && near(s.max, 1000 * ns, 0.01) && near(s.mean, 500.5 * ns, 0.01)
+                  && near(s.p50, 500 * ns, 0.125) && near(s.p99, 990 * ns, 0.125)
+                  && Profiler::counter(Profiler::Steps) == 6;
+    Profiler::reset();
+    bool cleared = Profiler::summary(Profiler::Basal).count == 0 && Profiler::counter(Profiler::Steps) == 0;
+    if (buckets && merged && cleared) {
+        qDebug() << "Merged" << s.count << "samples, p50" << s.p50 << "ns, p99" << s.p99 << "ns at" << ns << "ns per tick";
+    } else {
+        qDebug() << "FAIL: Buckets" << buckets << "merged" << merged << "cleared" << cleared << s.count << s.p50 << s.p99;
+    }
+    QVERIFY2(buckets && merged && cleared, "The profiler should merge every thread's histograms");
+}
+
+void InsulinPumpTest::testTraceRecorder() {
+    qDebug() << "=== TEST: Trace Recorder ===";
+    // a full buffer drops the rest and counts them
+    TraceRecorder::start(4);
+    std::thread small([] {
+        for (int i = 0; i < 10; i++) TraceRecorder::instant("test", "tick");
+    });
+    small.join();
+    bool dropping = TraceRecorder::recorded() == 4 && TraceRecorder::dropped() == 6;
+
+    // nothing is recorded while stopped
+    TraceRecorder::stop();
+    Device device;
+    device.setNoiseSeed(1);
+    device.setupDevice();
+    device.startDevice();
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.runDevice();
+    bool off = TraceRecorder::recorded() == 4;
+
+    // 130 steps, the two hourly deliveries of a 2 hour extended bolus, its
+    // scheduling, a pause, a profile apply and a resume
+    TraceRecorder::start();
+    ics->calculateBolus(30.0, 7.0, 2, 0);
+    for (int i = 0; i < 130; i++) device.runDevice();
+    ics->setState(InsulinControlSystem::Pause);
+    device.applyProfile(0.8, 2.0, 12, 6.0);
+    ics->setState(InsulinControlSystem::Resume);
+    TraceRecorder::stop();
+    const quint64 recorded = TraceRecorder::recorded();
+
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("trace.json");
+    bool written = TraceRecorder::write(fileName);
+    QFile file(fileName);
+    file.open(QIODevice::ReadOnly);
+    const QString json = QString::fromUtf8(file.readAll());
+    bool complete = json.startsWith("{\"displayTimeUnit\"") && json.endsWith("\"dropped\": 0}}\n")
+                    && json.contains("\"name\": \"step\"") && json.contains("\"name\": \"extended bolus\"")
+                    && json.contains("\"name\": \"schedule extended bolus\"") && json.contains("\"name\": \"pause\"")
+                    && json.contains("\"name\": \"apply profile\"") && json.contains("\"name\": \"resume\"")
+                    && json.contains("\"ph\": \"X\", \"dur\": ") && json.contains("\"args\": {\"time step\": 131}");
+
+    if (dropping && off && recorded == 136 && written && complete) {
+        qDebug() << "Recorded" << recorded << "events," << json.size() << "bytes of trace";
+    } else {
+        qDebug() << "FAIL: Dropping" << dropping << "off" << off << "recorded" << recorded
+                 << "written" << written << "complete" << complete;
+    }
+    QVERIFY2(dropping && off && recorded == 136 && written && complete,
+             "The trace should hold every step and pump event recorded while on");
+}
+
+void InsulinPumpTest::testCommandQueue() {
+    qDebug() << "=== TEST: Command Queue ===";
+    // fills up, then hands everything back in order
+    CommandQueue queue;
+    bool fills = true;
+    for (int i = 0; i < CommandQueue::Capacity; i++) fills = fills && queue.push(PumpCommand::setBattery(i));
+    fills = fills && !queue.push(PumpCommand(PumpCommand::Charge));
+    PumpCommand c;
+    bool ordered = true;
+    for (int i = 0; i < CommandQueue::Capacity; i++) {
+        ordered = ordered && queue.take(c) && c.kind == PumpCommand::SetBattery && c.values[0] == i;
+    }
+    ordered = ordered && !queue.take(c) && queue.isEmpty();
+
+    // four producers against one consumer, many laps around the ring; each
+    // producer's commands come out in the order it pushed them
+    const int producers = 4;
+    const int perProducer = 5000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p] {
+            for (int i = 0; i < perProducer; i++) {
+                while (!queue.push(PumpCommand::applyProfile(p, i, 0, 0))) std::this_thread::yield();
+            }
+        });
+    }
+    int next[producers] = {};
+    int taken = 0;
+    bool fifo = true;
+    while (taken < producers * perProducer && fifo) {
+        if (!queue.take(c)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const int p = int(c.values[0]);
+        fifo = p >= 0 && p < producers && int(c.values[1]) == next[p];
+        if (fifo) next[p]++;
+        taken++;
+    }
+    for (std::thread &t : threads) t.join();
+
+    // the device applies what was posted before its next step
+    Device device;
+    device.setNoiseSeed(1);
+    device.setupDevice();
+    InsulinControlSystem *ics = device.findChild<InsulinControlSystem*>();
+    device.post(PumpCommand::setBattery(40));
+    device.post(PumpCommand(PumpCommand::PowerOn));
+    device.post(PumpCommand(PumpCommand::Pause));
+    device.post(PumpCommand::applyProfile(0.8, 2.0, 12, 6.0));
+    bool waits = !device.isDeviceRunning() && device.getBatteryLevel() == 100;
+    device.advance(3);
+    const PumpState &pump = ics->getState();
+    bool applied = device.isDeviceRunning() && device.getClock()->isActive() && pump.timeStep == 3
+                   && device.getBatteryLevel() == 39 && pump.currentState == PumpState::Pause
+                   && pump.profileBasalRate == 0.8 && pump.correctionFactor == 2.0 && pump.carbRatio == 12;
+
+    // a power off stops it before the batch's first step; an idle device
+    // applies commands in runCommands and publishes the result
+    device.post(PumpCommand(PumpCommand::PowerOff));
+    device.advance(5);
+    bool stopped = !device.isDeviceRunning() && !device.getClock()->isActive() && pump.timeStep == 3;
+    PumpSnapshot snapshot;
+    device.takeSnapshot(snapshot);
+    device.post(PumpCommand(PumpCommand::Charge));
+    device.runCommands();
+    bool idle = device.takeSnapshot(snapshot) && snapshot.batteryLevel == 100;
+
+    // log text from the GUI is stamped with the device's own time step
+    device.post(PumpCommand::log("Infusion site changed.", LogRecord::Error));
+    device.runCommands();
+    const EventLog &log = device.getEventLog();
+    LogRecord note;
+    bool logged = log.at(log.lastError(), note) && note.timeStep == 3 && log.format(note) == "Infusion site changed.";
+
+    if (fills && ordered && fifo && taken == producers * perProducer && waits && applied && stopped && idle && logged) {
+        qDebug() << "Took" << taken << "commands from" << producers << "producers in order";
+    } else {
+        qDebug() << "FAIL: Fills" << fills << "ordered" << ordered << "fifo" << fifo << "taken" << taken
+                 << "waits" << waits << "applied" << applied << "stopped" << stopped << "idle" << idle
+                 << "logged" << logged;
+    }
+    QVERIFY2(fills && ordered && fifo && taken == producers * perProducer && waits && applied && stopped && idle && logged,
+             "Commands should reach the device in order, between steps");
+}
+
+void InsulinPumpTest::testCohortMatchesEngine() {
+    qDebug() << "=== TEST: Cohort Matches Engine ===";
+    const int patients = 600; // more than two blocks, last one partial
+    PatientCohort cohort(patients, 100);
+    QVector<PumpEngine> engines;
+    for (int i = 0; i < patients; i++) {
+        engines.append(PumpEngine(100, i));
+        PumpEngine &engine = engines.last();
+        engine.setupDevice();
+        engine.setBatteryDrain(false);
+        engine.applyProfile(0.8 + (i % 5) * 0.1, 1.5, 10, 5.0 + (i % 3) * 0.5);
+        engine.startDevice();
+        cohort.setPatient(i, engine.state());
+    }
+
+    bool sameTrajectory = true;
+    for (int minute = 0; minute < 180; minute++) {
+        // a few patients pause, resume and stop along the way
+        for (int i = 0; i < patients; i += 97) {
+            PumpState::Mode mode = minute == 30 ? PumpState::Pause
+                                 : minute == 70 ? PumpState::Resume
+                                 : minute == 150 && i % 2 ? PumpState::Stop : PumpState::Run;
+            if (mode != PumpState::Run) {
+                engines[i].setState(mode);
+                cohort.setState(i, mode);
+            }
+        }
+        cohort.step();
+        for (int i = 0; i < patients; i++) {
+            engines[i].step();
+        }
+    }
+    for (int i = 0; i < patients && sameTrajectory; i++) {
+        PumpState a = cohort.patient(i);
+        const PumpState &b = engines[i].state();
+        sameTrajectory = a.currentGlucose == b.currentGlucose && a.insulinOnBoard == b.insulinOnBoard
+                         && a.basalRate == b.basalRate && a.cartLevel == b.cartLevel
+                         && a.currentState == b.currentState;
+        if (!sameTrajectory) {
+            qDebug() << "FAIL: Patient" << i << "glucose" << a.currentGlucose << "vs" << b.currentGlucose;
+        }
+    }
+    if (sameTrajectory) {
+        qDebug() << "Cohort patients follow the same trajectories as single engines";
+    }
+    QVERIFY2(sameTrajectory, "Cohort stepping should match PumpEngine for every patient");
+}
+
+void InsulinPumpTest::testCohortRunnerDeterminism() {
+    qDebug() << "=== TEST: Cohort Runner Determinism ===";
+    const int patients = 3000;
+    PatientCohort reference(patients, 5);
+    PatientCohort single(patients, 5);
+    PatientCohort parallel(patients, 5);
+    for (int i = 0; i < patients; i++) {
+        double basal = 0.5 + (i % 7) * 0.2;
+        reference.applyProfile(i, basal, 1.5, 10, 5.5);
+        single.applyProfile(i, basal, 1.5, 10, 5.5);
+        parallel.applyProfile(i, basal, 1.5, 10, 5.5);
+    }
+
+    reference.run(240);
+    CohortRunner(1).run(single, 240);
+    CohortRunner(4).run(parallel, 240);
+
+    bool identical = single.glucose == reference.glucose && parallel.glucose == reference.glucose
+                     && parallel.insulinOnBoard == reference.insulinOnBoard
+                     && parallel.basalRate == reference.basalRate
+                     && parallel.getTimeStep() == reference.getTimeStep();
+    if (identical) {
+        qDebug() << "Cohort runner gives identical results on 1 and 4 threads";
+    } else {
+        qDebug() << "FAIL: Cohort runner results depend on the thread count";
+    }
+    QVERIFY2(identical, "Cohort runner should be bit-identical for any thread count");
+}
+
+void InsulinPumpTest::testPhiloxRng() {
+    qDebug() << "=== TEST: Philox RNG ===";
+
+    // Known answer from the Random123 reference implementation
+    quint32 ctr[4] = { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 };
+    PhiloxRng::philox(0xa4093822, 0x299f31d0, ctr);
+    bool knownAnswer = ctr[0] == 0xd16cfe09 && ctr[1] == 0x94fdcceb && ctr[2] == 0x5001e420 && ctr[3] == 0x24126ea1;
+    if (knownAnswer) {
+        qDebug() << "Philox rounds match the reference vector";
+    } else {
+        qDebug() << "FAIL: Philox output" << ctr[0] << ctr[1] << ctr[2] << ctr[3];
+    }
+    QVERIFY2(knownAnswer, "Philox4x32-10 should match the reference known-answer vector");
+
+    // Jumping ahead lands on the same values as drawing through
+    PhiloxRng drawn(9), jumped(9);
+    for (int i = 0; i < 200; i++) {
+        drawn.generateDouble();
+    }
+    jumped.jumpAhead(100);
+    bool jumpWorks = drawn.generateDouble() == jumped.generateDouble();
+    if (jumpWorks) {
+        qDebug() << "Jump ahead matches sequential draws";
+    } else {
+        qDebug() << "FAIL: Jump ahead gave a different value";
+    }
+    QVERIFY2(jumpWorks, "jumpAhead should match drawing the same number of blocks");
+
+    // Split streams differ, and the batch version matches one stream at a time
+    double glucoseNoise[8], predictionNoise[8];
+    PhiloxRng::noiseBlock(9, 0, 8, 1234, glucoseNoise, predictionNoise);
+    bool batchMatches = true;
+    for (int i = 0; i < 8; i++) {
+        double g, p;
+        drawn.split(i).noiseAt(1234, g, p);
+        batchMatches = batchMatches && g == glucoseNoise[i] && p == predictionNoise[i]
+                       && g >= -0.1 && g < 0.1;
+    }
+    bool streamsDiffer = glucoseNoise[0] != glucoseNoise[1];
+    if (batchMatches && streamsDiffer) {
+        qDebug() << "Batch noise matches per-stream noise and streams are independent";
+    } else {
+        qDebug() << "FAIL: Batch noise" << batchMatches << "streams differ" << streamsDiffer;
+    }
+    QVERIFY2(batchMatches && streamsDiffer, "noiseBlock should match noiseAt on each split stream");
+
+    // A run can be replayed from a saved state and its step index
+    PumpEngine original(77);
+    original.setupDevice();
+    original.setBatteryDrain(false);
+    original.startDevice();
+    original.run(100);
+    PumpState saved = original.state();
+    original.run(100);
+
+    PumpEngine replay(77);
+    replay.setBatteryDrain(false);
+    replay.startDevice();
+    replay.state() = saved;
+    replay.run(100);
+    bool replayWorks = replay.state().currentGlucose == original.state().currentGlucose
+                       && replay.state().insulinOnBoard == original.state().insulinOnBoard;
+    if (replayWorks) {
+        qDebug() << "Run replays exactly from seed and step index";
+    } else {
+        qDebug() << "FAIL: Replayed glucose" << replay.state().currentGlucose << "expected" << original.state().currentGlucose;
+    }
+    QVERIFY2(replayWorks, "Replaying from a saved step should reproduce the trajectory");
+}
+
 // Function that will be called from main.cpp to run the tests
 void runTests() {
     InsulinPumpTest testInstance;
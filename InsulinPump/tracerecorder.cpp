@@ -0,0 +1,107 @@
+#include "tracerecorder.h"
+#include <QFile>
+#include <QTextStream>
+
+// -------------------- Trace Recorder --------------------
+std::atomic<bool> TraceRecorder::enabled(false);
+std::atomic<int> TraceRecorder::capacity(TraceRecorder::DefaultCapacity);
+std::atomic<quint64> TraceRecorder::origin(0);
+std::atomic<TraceRecorder::ThreadBuffer*> TraceRecorder::buffers(nullptr);
+
+// Racy against a thread recording at the same moment, like Profiler::reset;
+// a buffer already allocated keeps its capacity
+void TraceRecorder::start(int capacityPerThread) {
+    enabled.store(false, std::memory_order_relaxed);
+    capacity.store(qMax(1, capacityPerThread), std::memory_order_relaxed);
+    for (ThreadBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+        b->size.store(0, std::memory_order_relaxed);
+        b->dropped.store(0, std::memory_order_relaxed);
+    }
+    origin.store(Profiler::now(), std::memory_order_relaxed);
+    enabled.store(true, std::memory_order_release);
+}
+
+void TraceRecorder::stop() {
+    enabled.store(false, std::memory_order_release);
+}
+
+// First event on a thread allocates its whole buffer; never freed, like the
+// profiler's per-thread stats
+TraceRecorder::ThreadBuffer &TraceRecorder::local() {
+    thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+        buffer = new ThreadBuffer();
+        buffer->capacity = capacity.load(std::memory_order_relaxed);
+        buffer->events = new Event[buffer->capacity];
+        ThreadBuffer *head = buffers.load(std::memory_order_relaxed);
+        do {
+            buffer->next = head;
+            buffer->thread = head ? head->thread + 1 : 1;
+        } while (!buffers.compare_exchange_weak(head, buffer, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return *buffer;
+}
+
+// only the owning thread writes; the release makes the event visible to write()
+void TraceRecorder::append(const Event &event) {
+    ThreadBuffer &b = local();
+    const int size = b.size.load(std::memory_order_relaxed);
+    if (size >= b.capacity) {
+        b.dropped.store(b.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    b.events[size] = event;
+    b.size.store(size + 1, std::memory_order_release);
+}
+
+quint64 TraceRecorder::recorded() {
+    quint64 total = 0;
+    for (ThreadBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+        total += quint64(b->size.load(std::memory_order_acquire));
+    }
+    return total;
+}
+
+quint64 TraceRecorder::dropped() {
+    quint64 total = 0;
+    for (ThreadBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+        total += b->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// The JSON object format: complete ("X") and instant ("i") events in
+// microseconds since start(), one named track per thread
+bool TraceRecorder::write(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    QTextStream out(&file);
+
+    const double usPerTick = Profiler::nsPerTick() / 1000.0;
+    const quint64 from = origin.load(std::memory_order_relaxed);
+    const char *separator = "\n";
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    for (ThreadBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->thread
+            << ", \"args\": {\"name\": \"thread " << b->thread << "\"}}";
+        separator = ",\n";
+        const int size = b->size.load(std::memory_order_acquire);
+        for (int i = 0; i < size; i++) {
+            const Event &e = b->events[i];
+            if (e.start < from) continue; // began before the latest start()
+            out << separator << "{\"cat\": \"" << e.category << "\", \"name\": \"" << e.name
+                << "\", \"pid\": 1, \"tid\": " << b->thread
+                << ", \"ts\": " << QString::number((e.start - from) * usPerTick, 'f', 3);
+            if (e.duration == Instant) {
+                out << ", \"ph\": \"i\", \"s\": \"t\"";
+            } else {
+                out << ", \"ph\": \"X\", \"dur\": " << QString::number(e.duration * usPerTick, 'f', 3);
+            }
+            if (e.argName) out << ", \"args\": {\"" << e.argName << "\": " << QString::number(e.arg, 'g', 10) << "}";
+            out << "}";
+        }
+    }
+    out << "\n], \"otherData\": {\"dropped\": " << dropped() << "}}\n";
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
@@ -0,0 +1,92 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <QtGlobal>
+#include <QString>
+#include <atomic>
+#include "profiler.h"
+
+// -------------------- Trace Recorder --------------------
+// A timeline of the simulation for chrome://tracing or ui.perfetto.dev:
+// device steps, extended bolus deliveries, profile applies, state changes,
+// occlusions, disconnects and GUI refreshes. Off until start() (main's
+// --trace option); while off an instrumentation point is one relaxed load
+// and a branch.
+//
+// Each thread appends to its own buffer, allocated once at the capacity
+// given to start() the first time the thread records, so recording never
+// allocates and never locks. A full buffer drops further events and counts
+// them. write() turns every buffer into Chrome trace JSON, call it once the
+// recording threads are done (or stopped). Times use the profiler's clock.
+//
+// Names, categories and argument names are string literals, kept as
+// pointers and written out unescaped.
+class TraceRecorder {
+public:
+    static const int DefaultCapacity = 1 << 18; // events per thread, 48 bytes each
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void start(int capacityPerThread = DefaultCapacity); // drops what was recorded
+    static void stop();
+
+    // a span [start, end) in Profiler::now() ticks, or a point in time
+    static void complete(const char *category, const char *name, quint64 start, quint64 end,
+                         const char *argName = nullptr, double arg = 0.0) {
+        if (isEnabled()) append({ category, name, argName, arg, start, end - start });
+    }
+    static void instant(const char *category, const char *name, const char *argName = nullptr, double arg = 0.0) {
+        if (isEnabled()) append({ category, name, argName, arg, Profiler::now(), Instant });
+    }
+
+    static quint64 recorded(); // over every thread
+    static quint64 dropped();
+    static bool write(const QString &fileName);
+
+private:
+    struct Event {
+        const char *category;
+        const char *name;
+        const char *argName; // nullptr = no argument
+        double arg;
+        quint64 start;
+        quint64 duration; // Instant for a point in time
+    };
+    static const quint64 Instant = ~quint64(0);
+    struct ThreadBuffer {
+        Event *events;
+        int capacity;
+        std::atomic<int> size;
+        std::atomic<quint64> dropped;
+        int thread; // 1, 2, ... in order of first use
+        ThreadBuffer *next;
+    };
+
+    static void append(const Event &event);
+    static ThreadBuffer &local();
+
+    static std::atomic<bool> enabled;
+    static std::atomic<int> capacity;
+    static std::atomic<quint64> origin;
+    static std::atomic<ThreadBuffer*> buffers;
+};
+
+// Records the rest of the enclosing block as a span, if tracing was on when
+// the block started
+class TraceScope {
+public:
+    TraceScope(const char *category, const char *name, const char *argName = nullptr, double arg = 0.0)
+        : category(category), name(name), argName(argName), arg(arg),
+          start(TraceRecorder::isEnabled() ? Profiler::now() : 0) {}
+    ~TraceScope() {
+        if (start) TraceRecorder::complete(category, name, start, Profiler::now(), argName, arg);
+    }
+
+private:
+    const char *category;
+    const char *name;
+    const char *argName;
+    double arg;
+    quint64 start;
+};
+
+#endif // TRACERECORDER_H
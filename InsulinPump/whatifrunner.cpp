@@ -0,0 +1,54 @@
+#include "whatifrunner.h"
+#include "pumpengine.h"
+
+// -------------------- What-If Branch --------------------
+WhatIfBranch WhatIfBranch::noBolus() {
+    return WhatIfBranch();
+}
+
+WhatIfBranch WhatIfBranch::carbBolus(double carbs, double glucose, double durationHours, double durationMinutes) {
+    WhatIfBranch b;
+    b.bolus = true;
+    b.carbs = carbs;
+    b.glucose = glucose;
+    b.durationHours = durationHours;
+    b.durationMinutes = durationMinutes;
+    return b;
+}
+
+// -------------------- What-If Runner --------------------
+WhatIfRunner::WhatIfRunner(int threads) : pool(threads) {}
+
+int WhatIfRunner::threadCount() const {
+    return pool.threadCount();
+}
+
+QVector<WhatIfTrajectory> WhatIfRunner::run(const PumpCheckpoint &fork, const QVector<WhatIfBranch> &branches, int minutes) {
+    QVector<WhatIfTrajectory> trajectories(branches.size());
+    minutes = qMax(0, minutes);
+
+    // each task only touches its own trajectory, no locking needed
+    pool.run(branches.size(), [&](int i) {
+        WhatIfTrajectory &t = trajectories[i];
+        t.branch = branches[i];
+        t.timeSteps.reserve(minutes);
+        t.glucose.reserve(minutes);
+        t.insulinOnBoard.reserve(minutes);
+        t.summary.start = fork.timeStep + 1;
+
+        PumpEngine engine;
+        engine.restore(fork);
+        if (t.branch.bolus) {
+            const double glucose = t.branch.glucose < 0.0 ? engine.state().currentGlucose : t.branch.glucose;
+            engine.calculateBolus(t.branch.carbs, glucose, t.branch.durationHours, t.branch.durationMinutes);
+        }
+        engine.run(minutes, [&t](const PumpState &pump, const StepResult &) {
+            t.timeSteps.append(pump.timeStep);
+            t.glucose.append(pump.currentGlucose);
+            t.insulinOnBoard.append(pump.insulinOnBoard);
+            t.summary.add(pump.currentGlucose);
+        });
+        t.finalState = engine.state();
+    });
+    return trajectories;
+}
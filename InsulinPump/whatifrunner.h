@@ -0,0 +1,51 @@
+#ifndef WHATIFRUNNER_H
+#define WHATIFRUNNER_H
+
+#include <QVector>
+#include "checkpoint.h"
+#include "historystore.h"
+#include "workstealingpool.h"
+
+// -------------------- What-If Branch --------------------
+// One alternative to try from the fork point: a bolus through the regular
+// calculator, or nothing at all
+struct WhatIfBranch {
+    bool bolus = false;
+    double carbs = 0.0;
+    double glucose = -1.0;        // glucose entered in the calculator, < 0 uses the current reading
+    double durationHours = 0.0;   // extended part, as in calculateBolus
+    double durationMinutes = 0.0;
+
+    static WhatIfBranch noBolus();
+    static WhatIfBranch carbBolus(double carbs, double glucose = -1.0, double durationHours = 0.0, double durationMinutes = 0.0);
+};
+
+// -------------------- What-If Trajectory --------------------
+// What one branch did, one entry per simulated minute after the fork
+struct WhatIfTrajectory {
+    WhatIfBranch branch;
+    QVector<int> timeSteps;
+    QVector<double> glucose;
+    QVector<double> insulinOnBoard;
+    HistoryBucket summary;        // min, max, mean and time in range over the branch
+    PumpState finalState;
+};
+
+// -------------------- What-If Runner --------------------
+// Forks a running pump into independent headless branches and runs them in
+// parallel. Forking is copying a PumpCheckpoint (the pump state plus the
+// pending events), no replay; every branch starts from that copy in its own
+// PumpEngine with the same noise stream, so branches differ only by their
+// input and are reproducible for any thread count.
+class WhatIfRunner {
+public:
+    explicit WhatIfRunner(int threads = 0); // 0 = one per core
+
+    QVector<WhatIfTrajectory> run(const PumpCheckpoint &fork, const QVector<WhatIfBranch> &branches, int minutes);
+    int threadCount() const;
+
+private:
+    WorkStealingPool pool;
+};
+
+#endif // WHATIFRUNNER_H
@@ -0,0 +1,108 @@
+#include "workstealingpool.h"
+
+// -------------------- Work Stealing Pool --------------------
+WorkStealingPool::WorkStealingPool(int threadCount)
+    : job(nullptr), generation(0), busyWorkers(0), shuttingDown(false) {
+    int n = threadCount > 0 ? threadCount : int(std::thread::hardware_concurrency());
+    n = qMax(n, 1);
+    for (int i = 0; i < n; i++) {
+        workers.append(new Worker);
+    }
+    // worker 0 is whoever calls run()
+    for (int i = 1; i < n; i++) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        shuttingDown = true;
+    }
+    jobStarted.notify_all();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    qDeleteAll(workers);
+}
+
+int WorkStealingPool::threadCount() const {
+    return workers.size();
+}
+
+void WorkStealingPool::run(int count, const std::function<void(int)> &task) {
+    if (count <= 0) return;
+    const int n = workers.size();
+
+    // Contiguous slices per worker so neighbouring tasks share a core,
+    // stealing only kicks in once a worker runs dry
+    for (int w = 0; w < n; w++) {
+        std::lock_guard<std::mutex> guard(workers[w]->lock);
+        for (int i = qint64(count) * w / n; i < qint64(count) * (w + 1) / n; i++) {
+            workers[w]->tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        job = &task;
+        busyWorkers = n - 1;
+        generation++;
+    }
+    jobStarted.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> wait(jobLock);
+    jobFinished.wait(wait, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void WorkStealingPool::workerLoop(int self) {
+    quint64 seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> wait(jobLock);
+            jobStarted.wait(wait, [&] { return shuttingDown || generation != seen; });
+            if (shuttingDown) return;
+            seen = generation;
+        }
+
+        drain(self);
+
+        std::lock_guard<std::mutex> guard(jobLock);
+        if (--busyWorkers == 0) {
+            jobFinished.notify_one();
+        }
+    }
+}
+
+void WorkStealingPool::drain(int self) {
+    int task;
+    while (popLocal(self, task) || steal(self, task)) {
+        (*job)(task);
+    }
+}
+
+bool WorkStealingPool::popLocal(int self, int &task) {
+    Worker *w = workers[self];
+    std::lock_guard<std::mutex> guard(w->lock);
+    if (w->tasks.empty()) return false;
+    task = w->tasks.back();
+    w->tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(int self, int &task) {
+    const int n = workers.size();
+    for (int k = 1; k < n; k++) {
+        Worker *victim = workers[(self + k) % n];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
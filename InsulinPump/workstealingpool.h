@@ -0,0 +1,51 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <QVector>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -------------------- Work Stealing Pool --------------------
+// Fixed set of worker threads for batch simulations. run() spreads task
+// indices over per-worker deques; a worker pops from the back of its own
+// deque and, once that is empty, steals from the front of the others, so
+// uneven tasks (e.g. stopped patients) still keep every core busy.
+// The calling thread works too, so a pool of 1 runs everything inline.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads = 0); // 0 = one per core
+    ~WorkStealingPool();
+
+    int threadCount() const;
+
+    // Runs task(i) for every i in [0, count) and returns once all are done
+    void run(int count, const std::function<void(int)> &task);
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    void workerLoop(int self);
+    void drain(int self);
+    bool popLocal(int self, int &task);
+    bool steal(int self, int &task);
+
+    QVector<Worker*> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex jobLock;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    const std::function<void(int)> *job;
+    quint64 generation;
+    int busyWorkers;
+    bool shuttingDown;
+};
+
+#endif // WORKSTEALINGPOOL_H